@@ -1,12 +1,709 @@
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "apu.h"
+#include "cpu.h"
+#include "blip.h"
+#include "rom.h"
+#include "audio.h"
+#include "shmexport.h"
+#include "pacing.h"
+#include "util.h"
 
-APU_t* apu_init() {
-    APU_t* apu = (APU_t*) malloc(sizeof(APU_t));
+static const uint8_t LENGTH_TABLE[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
 
-    return apu;
+static const uint8_t DUTY_TABLE[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0}, // 12.5%
+    {0, 1, 1, 0, 0, 0, 0, 0}, // 25%
+    {0, 1, 1, 1, 1, 0, 0, 0}, // 50%
+    {1, 0, 0, 1, 1, 1, 1, 1}  // 25% negated
+};
+
+static const uint8_t TRIANGLE_TABLE[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+// In CPU cycles
+static const uint16_t NOISE_PERIODS[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const uint16_t DMC_PERIODS[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// The 2A03's nonlinear DAC, indexed by pulse1 + pulse2 and by
+// 3 * triangle + 2 * noise + dmc, already scaled to the output level
+static float pulse_table[31];
+static float tnd_table[203];
+static pthread_once_t mixer_once = PTHREAD_ONCE_INIT;
+
+static void apu_build_mixer() {
+    float scale = APU_VOLUME / APU_MAX_LEVEL;
+
+    pulse_table[0] = 0;
+    for (int n = 1; n < 31; ++n)
+        pulse_table[n] = 95.52 / (8128.0 / n + 100) * scale;
+
+    tnd_table[0] = 0;
+    for (int n = 1; n < 203; ++n)
+        tnd_table[n] = 163.67 / (24329.0 / n + 100) * scale;
+}
+
+// Expects the APU zeroed and its blip buffer set, see console_init()
+void apu_init(APU_t* apu) {
+    blip_init(apu->blip, CPU_CLOCK, AUDIO_SAMPLE_RATE);
+
+    pthread_once(&mixer_once, &apu_build_mixer);
+
+    apu->pulse[0].ones_complement = true;
+    apu->noise.shift = 1;
+    apu->noise.period = NOISE_PERIODS[0];
+    apu->dmc.period = DMC_PERIODS[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+
+    // Gets the first sync to work out the rest
+    sched_set(&apu->cpu->sched, SCHED_APU, 0);
+}
+
+// Has to happen before any sound is produced
+void apu_set_sample_rate(APU_t* apu, uint32_t sample_rate) {
+    blip_init(apu->blip, CPU_CLOCK, sample_rate);
+}
+
+// UNITS SHARED BETWEEN CHANNELS
+
+static uint8_t apu_envelope_volume(Envelope_t* envelope) {
+    return envelope->constant ? envelope->volume : envelope->decay;
+}
+
+static void apu_envelope_clock(Envelope_t* envelope) {
+    if (envelope->start) {
+        envelope->start = false;
+        envelope->decay = 15;
+        envelope->divider = envelope->volume;
+    } else if (envelope->divider == 0) {
+        envelope->divider = envelope->volume;
+
+        if (envelope->decay > 0)
+            envelope->decay--;
+        else if (envelope->loop)
+            envelope->decay = 15;
+    } else {
+        envelope->divider--;
+    }
+}
+
+static void apu_envelope_write(Envelope_t* envelope, uint8_t value) {
+    envelope->loop = value & 0x20;
+    envelope->constant = value & 0x10;
+    envelope->volume = value & 0x0F;
+}
+
+static void apu_length_clock(uint8_t* length, bool halt) {
+    if (!halt && *length > 0)
+        (*length)--;
+}
+
+// Runs a down-counting timer that reloads to `reload - 1` for `cycles` CPU
+// cycles in one go, returning how many times it expired
+static uint32_t apu_timer_skip(uint16_t* timer, uint32_t reload, uint32_t cycles) {
+    if (cycles <= *timer) {
+        *timer -= cycles;
+        return 0;
+    }
+
+    cycles -= *timer + 1;
+    *timer = reload - 1 - cycles % reload;
+    return 1 + cycles / reload;
+}
+
+// PULSE
+
+static uint16_t apu_sweep_target(Pulse_t* pulse) {
+    uint16_t change = pulse->period >> pulse->sweep_shift;
+
+    if (!pulse->sweep_negate)
+        return pulse->period + change;
+
+    // Pulse 1 subtracts one more than pulse 2
+    uint16_t negated = change + (pulse->ones_complement ? 1 : 0);
+    return negated > pulse->period ? 0 : pulse->period - negated;
+}
+
+static bool apu_pulse_output(Pulse_t* pulse) {
+    uint8_t output = 0;
+
+    if (pulse->length > 0 && pulse->period >= 8 &&
+        apu_sweep_target(pulse) <= 0x7FF &&
+        DUTY_TABLE[pulse->duty][pulse->step]) {
+        output = apu_envelope_volume(&pulse->envelope);
+    }
+
+    bool changed = output != pulse->output;
+    pulse->output = output;
+    return changed;
+}
+
+// The pulse timers only count on every other CPU cycle
+static uint32_t apu_pulse_reload(Pulse_t* pulse) {
+    return (pulse->period + 1) * 2;
+}
+
+// A channel is quiet when no timer step can change its output, so it can be
+// skipped over in closed form instead of step by step
+static bool apu_pulse_quiet(Pulse_t* pulse) {
+    return pulse->output == 0 && (pulse->length == 0 || pulse->period < 8 ||
+        apu_sweep_target(pulse) > 0x7FF || apu_envelope_volume(&pulse->envelope) == 0);
+}
+
+static bool apu_pulse_advance(Pulse_t* pulse, uint32_t cycles) {
+    uint32_t steps = apu_timer_skip(&pulse->timer, apu_pulse_reload(pulse), cycles);
+
+    if (steps == 0)
+        return false;
+
+    pulse->step = (pulse->step + steps) % 8;
+    return apu_pulse_output(pulse);
+}
+
+static void apu_sweep_clock(Pulse_t* pulse) {
+    uint16_t target = apu_sweep_target(pulse);
+
+    if (pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift > 0 &&
+        pulse->period >= 8 && target <= 0x7FF) {
+        pulse->period = target;
+    }
+
+    if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = false;
+    } else {
+        pulse->sweep_divider--;
+    }
+}
+
+static void apu_pulse_write(Pulse_t* pulse, uint8_t reg, uint8_t value) {
+    switch (reg) {
+        case 0:
+            pulse->duty = value >> 6;
+            apu_envelope_write(&pulse->envelope, value);
+            break;
+        case 1:
+            pulse->sweep_enabled = value & 0x80;
+            pulse->sweep_period = (value >> 4) & 0x07;
+            pulse->sweep_negate = value & 0x08;
+            pulse->sweep_shift = value & 0x07;
+            pulse->sweep_reload = true;
+            break;
+        case 2:
+            pulse->period = (pulse->period & 0x0700) | value;
+            break;
+        case 3:
+            pulse->period = (pulse->period & 0x00FF) | ((uint16_t) (value & 0x07) << 8);
+            if (pulse->enabled)
+                pulse->length = LENGTH_TABLE[value >> 3];
+            pulse->step = 0;
+            pulse->envelope.start = true;
+            break;
+    }
+}
+
+// TRIANGLE
+
+// Periods below 2 are ultrasonic, real hardware just produces a DC offset
+// around the midpoint so hold the current step instead
+static bool apu_triangle_quiet(Triangle_t* triangle) {
+    return triangle->length == 0 || triangle->linear == 0 || triangle->period < 2;
+}
+
+static bool apu_triangle_advance(Triangle_t* triangle, uint32_t cycles) {
+    uint32_t steps = apu_timer_skip(&triangle->timer, triangle->period + 1, cycles);
+
+    if (steps == 0 || apu_triangle_quiet(triangle))
+        return false;
+
+    triangle->step = (triangle->step + steps) % 32;
+    triangle->output = TRIANGLE_TABLE[triangle->step];
+    return true;
+}
+
+static void apu_linear_clock(Triangle_t* triangle) {
+    if (triangle->linear_start)
+        triangle->linear = triangle->linear_reload;
+    else if (triangle->linear > 0)
+        triangle->linear--;
+
+    if (!triangle->control)
+        triangle->linear_start = false;
+}
+
+// NOISE
+
+static bool apu_noise_output(Noise_t* noise) {
+    uint8_t output = 0;
+
+    if (noise->length > 0 && !(noise->shift & 1))
+        output = apu_envelope_volume(&noise->envelope);
+
+    bool changed = output != noise->output;
+    noise->output = output;
+    return changed;
+}
+
+static bool apu_noise_quiet(Noise_t* noise) {
+    return noise->output == 0 &&
+        (noise->length == 0 || apu_envelope_volume(&noise->envelope) == 0);
+}
+
+static bool apu_noise_advance(Noise_t* noise, uint32_t cycles) {
+    uint32_t steps = apu_timer_skip(&noise->timer, noise->period, cycles);
+
+    if (steps == 0)
+        return false;
+
+    // The shift register isn't worth stepping while nobody can hear it, it
+    // just resumes from where it stopped
+    if (apu_noise_quiet(noise))
+        return false;
+
+    uint8_t tap = noise->mode ? 6 : 1;
+    uint16_t feedback = (noise->shift ^ (noise->shift >> tap)) & 1;
+    noise->shift = (noise->shift >> 1) | (feedback << 14);
+
+    return apu_noise_output(noise);
+}
+
+// DMC
+
+static void apu_dmc_fetch(APU_t* apu) {
+    DMC_t* dmc = &apu->dmc;
+
+    if (dmc->buffer_full || dmc->remaining == 0)
+        return;
+
+    cpu_dmc_fetch(apu->cpu, apu->cycle);
+    dmc->buffer = *rom_map_read(apu->cpu->cartridge, dmc->address);
+    dmc->buffer_full = true;
+    dmc->address = dmc->address == 0xFFFF ? 0x8000 : dmc->address + 1;
+    dmc->remaining--;
+
+    if (dmc->remaining == 0) {
+        if (dmc->loop) {
+            dmc->address = dmc->sample_address;
+            dmc->remaining = dmc->sample_length;
+        } else if (dmc->irq_enabled) {
+            apu->dmc_irq = true;
+        }
+    }
+}
+
+static bool apu_dmc_quiet(DMC_t* dmc) {
+    return dmc->silence && !dmc->buffer_full && dmc->remaining == 0;
+}
+
+// One step of the output unit
+static bool apu_dmc_step(APU_t* apu) {
+    DMC_t* dmc = &apu->dmc;
+    bool changed = false;
+
+    if (!dmc->silence) {
+        if ((dmc->shift & 1) && dmc->output <= 125) {
+            dmc->output += 2;
+            changed = true;
+        } else if (!(dmc->shift & 1) && dmc->output >= 2) {
+            dmc->output -= 2;
+            changed = true;
+        }
+    }
+
+    dmc->shift >>= 1;
+
+    if (--dmc->bits == 0) {
+        dmc->bits = 8;
+        dmc->silence = !dmc->buffer_full;
+
+        if (dmc->buffer_full) {
+            dmc->shift = dmc->buffer;
+            dmc->buffer_full = false;
+        }
+
+        // The reader refills the buffer as soon as it empties
+        apu_dmc_fetch(apu);
+    }
+
+    return changed;
+}
+
+static bool apu_dmc_advance(APU_t* apu, uint32_t cycles) {
+    DMC_t* dmc = &apu->dmc;
+    uint32_t steps = apu_timer_skip(&dmc->timer, dmc->period, cycles);
+
+    if (steps == 0)
+        return false;
+
+    // Nothing to play, only the bit counter moves
+    if (apu_dmc_quiet(dmc)) {
+        dmc->bits = (dmc->bits + 7 - steps % 8) % 8 + 1;
+        dmc->shift = 0;
+        return false;
+    }
+
+    return apu_dmc_step(apu);
+}
+
+// CPU cycles until the output unit next empties the sample buffer, which is
+// when the next DMA fetch (and possibly the DMC IRQ) happens
+static uint32_t apu_dmc_next_fetch(DMC_t* dmc) {
+    if (!dmc->buffer_full)
+        return APU_NO_EVENT;
+
+    return dmc->timer + 1 + (uint32_t) (dmc->bits - 1) * dmc->period;
+}
+
+// FRAME SEQUENCER
+
+static void apu_quarter_frame(APU_t* apu) {
+    apu_envelope_clock(&apu->pulse[0].envelope);
+    apu_envelope_clock(&apu->pulse[1].envelope);
+    apu_envelope_clock(&apu->noise.envelope);
+    apu_linear_clock(&apu->triangle);
+}
+
+static void apu_half_frame(APU_t* apu) {
+    for (int i = 0; i < 2; ++i) {
+        apu_length_clock(&apu->pulse[i].length, apu->pulse[i].envelope.loop);
+        apu_sweep_clock(&apu->pulse[i]);
+    }
+
+    apu_length_clock(&apu->triangle.length, apu->triangle.control);
+    apu_length_clock(&apu->noise.length, apu->noise.envelope.loop);
+}
+
+static uint16_t apu_sequencer_next(APU_t* apu) {
+    uint16_t cycle = apu->sequence_cycle;
+
+    if (cycle < SEQ_STEP_1) return SEQ_STEP_1;
+    if (cycle < SEQ_STEP_2) return SEQ_STEP_2;
+    if (cycle < SEQ_STEP_3) return SEQ_STEP_3;
+    if (cycle < SEQ_STEP_4 || !apu->five_step) return SEQ_STEP_4;
+    return SEQ_STEP_5;
+}
+
+// Runs the sequencer to its next step, which must be exactly `cycles` away
+static void apu_sequencer_step(APU_t* apu, uint16_t cycles) {
+    uint16_t cycle = apu->sequence_cycle += cycles;
+
+    switch (cycle) {
+        case SEQ_STEP_1:
+        case SEQ_STEP_3:
+            apu_quarter_frame(apu);
+            break;
+        case SEQ_STEP_2:
+            apu_quarter_frame(apu);
+            apu_half_frame(apu);
+            break;
+        case SEQ_STEP_4:
+            if (apu->five_step)
+                break;
+
+            apu_quarter_frame(apu);
+            apu_half_frame(apu);
+            apu->sequence_cycle = 0;
+
+            if (!apu->irq_inhibit)
+                apu->frame_irq = true;
+            break;
+        case SEQ_STEP_5:
+            apu_quarter_frame(apu);
+            apu_half_frame(apu);
+            apu->sequence_cycle = 0;
+            break;
+    }
+}
+
+// OUTPUT
+
+static float apu_mix(APU_t* apu) {
+    uint8_t pulse = apu->pulse[0].output + apu->pulse[1].output;
+    uint8_t tnd = 3 * apu->triangle.output + 2 * apu->noise.output + apu->dmc.output;
+
+    return pulse_table[pulse] + tnd_table[tnd];
+}
+
+// Hands any change in the mixed level to the blip buffer, stamped with the
+// current cycle
+static void apu_update_output(APU_t* apu) {
+    float amplitude = apu_mix(apu);
+
+    if (amplitude != apu->amplitude) {
+        blip_add_delta(apu->blip, apu->cycle - apu->frame_start, amplitude - apu->amplitude);
+        apu->amplitude = amplitude;
+    }
+}
+
+static void apu_update_irq(APU_t* apu) {
+    cpu_set_irq(apu->cpu, IRQ_APU, apu->frame_irq || apu->dmc_irq);
 }
 
-void apu_free(APU_t* apu) {
-    free(apu);
+static uint32_t apu_min(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+// Brings the APU up to `target` one event at a time. Every iteration jumps
+// straight to the nearest timer expiry or sequencer step, and quiet channels
+// are skipped over in closed form, so the cost is the number of audible
+// transitions rather than the number of cycles.
+void apu_run(APU_t* apu, uint64_t target) {
+    while (apu->cycle < target) {
+        uint32_t cycles = target - apu->cycle > APU_NO_EVENT ? APU_NO_EVENT : target - apu->cycle;
+        uint16_t sequencer = apu_sequencer_next(apu) - apu->sequence_cycle;
+
+        cycles = apu_min(cycles, sequencer);
+        for (int i = 0; i < 2; ++i)
+            if (!apu_pulse_quiet(&apu->pulse[i]))
+                cycles = apu_min(cycles, apu->pulse[i].timer + 1);
+        if (!apu_triangle_quiet(&apu->triangle))
+            cycles = apu_min(cycles, apu->triangle.timer + 1);
+        if (!apu_noise_quiet(&apu->noise))
+            cycles = apu_min(cycles, apu->noise.timer + 1);
+        if (!apu_dmc_quiet(&apu->dmc))
+            cycles = apu_min(cycles, apu->dmc.timer + 1);
+
+        bool changed = false;
+        changed |= apu_pulse_advance(&apu->pulse[0], cycles);
+        changed |= apu_pulse_advance(&apu->pulse[1], cycles);
+        changed |= apu_triangle_advance(&apu->triangle, cycles);
+        changed |= apu_noise_advance(&apu->noise, cycles);
+        changed |= apu_dmc_advance(apu, cycles);
+
+        apu->cycle += cycles;
+
+        // Envelopes, sweeps and length counters change levels without a
+        // timer step, so recompute every channel
+        if (cycles == sequencer) {
+            apu_sequencer_step(apu, sequencer);
+            apu_pulse_output(&apu->pulse[0]);
+            apu_pulse_output(&apu->pulse[1]);
+            apu_noise_output(&apu->noise);
+            changed = true;
+        } else {
+            apu->sequence_cycle += cycles;
+        }
+
+        if (changed)
+            apu_update_output(apu);
+    }
+}
+
+// Works out the next CPU cycle the APU has to be caught up by
+static void apu_schedule(APU_t* apu) {
+    uint64_t next = apu->frame_start + APU_FRAME_CYCLES;
+
+    if (!apu->five_step && !apu->irq_inhibit && !apu->frame_irq) {
+        uint64_t irq = apu->cycle + (SEQ_STEP_4 - apu->sequence_cycle);
+        next = irq < next ? irq : next;
+    }
+
+    uint32_t fetch = apu_dmc_next_fetch(&apu->dmc);
+    if (fetch != APU_NO_EVENT && apu->cycle + fetch < next)
+        next = apu->cycle + fetch;
+
+    sched_set(&apu->cpu->sched, SCHED_APU, next);
+}
+
+// Catches up with the CPU. Called by the CPU at the cycle scheduled by
+// apu_schedule() and whenever an APU register is accessed.
+void apu_sync(APU_t* apu) {
+    apu_run(apu, apu->cpu->cycle);
+
+    if (apu->cycle - apu->frame_start >= APU_FRAME_CYCLES)
+        apu_end_frame(apu);
+
+    apu_update_irq(apu);
+    apu_schedule(apu);
+}
+
+// Closes the current audio frame and sends its samples to every sink
+void apu_end_frame(APU_t* apu) {
+    int16_t samples[BLIP_BUFFER_SIZE];
+    PPU_t* ppu = apu->cpu->ppu;
+
+    blip_end_frame(apu->blip, apu->cycle - apu->frame_start);
+    apu->frame_start = apu->cycle;
+
+    uint32_t count = blip_read_samples(apu->blip, samples, BLIP_BUFFER_SIZE);
+
+    if (apu->output != NULL)
+        audio_push(apu->output, samples, count);
+    if (ppu->shm != NULL)
+        shmexport_push_audio(ppu->shm, samples, count);
+    if (ppu->pacer != NULL)
+        pacer_audio_queued(ppu->pacer, count);
+}
+
+// REGISTERS
+
+void apu_write(APU_t* apu, uint16_t address, uint8_t value) {
+    apu_run(apu, apu->cpu->cycle);
+
+    switch (address) {
+        case 0x4000: apu->reg_P1DLCV = value;        break;
+        case 0x4001: apu->reg_P1SWEEP = value;       break;
+        case 0x4002: apu->reg_P1TIMERLOW = value;    break;
+        case 0x4003: apu->reg_P1LT = value;          break;
+        case 0x4004: apu->reg_P2DLCV = value;        break;
+        case 0x4005: apu->reg_P2SWEEP = value;       break;
+        case 0x4006: apu->reg_P2TIMERLOW = value;    break;
+        case 0x4007: apu->reg_P2LT = value;          break;
+        case 0x4008: apu->reg_TRLINEARCOUNT = value; break;
+        case 0x400A: apu->reg_TRTIMER = value;       break;
+        case 0x400B: apu->reg_TRLT = value;          break;
+        case 0x400C: apu->reg_NLCV = value;          break;
+        case 0x400E: apu->reg_NLP = value;           break;
+        case 0x400F: apu->reg_NLENGTH = value;       break;
+        case 0x4010: apu->reg_DMCILR = value;        break;
+        case 0x4011: apu->reg_DMCCOUNTER = value;    break;
+        case 0x4012: apu->reg_DMCADDRESS = value;    break;
+        case 0x4013: apu->reg_DMCLENGTH = value;     break;
+        case 0x4017: apu->reg_FRAMECOUNTER = value;  break;
+    }
+
+    if (address < 0x4008) {
+        Pulse_t* pulse = &apu->pulse[(address >> 2) & 1];
+        apu_pulse_write(pulse, address & 0x03, value);
+        apu_pulse_output(pulse);
+        apu_update_output(apu);
+        apu_schedule(apu);
+        return;
+    }
+
+    Triangle_t* triangle = &apu->triangle;
+    Noise_t* noise = &apu->noise;
+    DMC_t* dmc = &apu->dmc;
+
+    switch (address) {
+        case 0x4008:
+            triangle->control = value & 0x80;
+            triangle->linear_reload = value & 0x7F;
+            break;
+        case 0x400A:
+            triangle->period = (triangle->period & 0x0700) | value;
+            break;
+        case 0x400B:
+            triangle->period = (triangle->period & 0x00FF) | ((uint16_t) (value & 0x07) << 8);
+            if (triangle->enabled)
+                triangle->length = LENGTH_TABLE[value >> 3];
+            triangle->linear_start = true;
+            break;
+        case 0x400C:
+            apu_envelope_write(&noise->envelope, value);
+            apu_noise_output(noise);
+            break;
+        case 0x400E:
+            noise->mode = value & 0x80;
+            noise->period = NOISE_PERIODS[value & 0x0F];
+            break;
+        case 0x400F:
+            if (noise->enabled)
+                noise->length = LENGTH_TABLE[value >> 3];
+            noise->envelope.start = true;
+            apu_noise_output(noise);
+            break;
+        case 0x4010:
+            dmc->irq_enabled = value & 0x80;
+            dmc->loop = value & 0x40;
+            dmc->period = DMC_PERIODS[value & 0x0F];
+            if (!dmc->irq_enabled)
+                apu->dmc_irq = false;
+            break;
+        case 0x4011:
+            dmc->output = value & 0x7F;
+            break;
+        case 0x4012:
+            dmc->sample_address = 0xC000 + (uint16_t) value * 64;
+            break;
+        case 0x4013:
+            dmc->sample_length = (uint16_t) value * 16 + 1;
+            break;
+        case 0x4015:
+            apu->pulse[0].enabled = get_bit(value, apu_PULSE1);
+            apu->pulse[1].enabled = get_bit(value, apu_PULSE2);
+            triangle->enabled = get_bit(value, apu_TRIANGLE);
+            noise->enabled = get_bit(value, apu_NOISE);
+
+            for (int i = 0; i < 2; ++i) {
+                if (!apu->pulse[i].enabled)
+                    apu->pulse[i].length = 0;
+                apu_pulse_output(&apu->pulse[i]);
+            }
+            if (!triangle->enabled)
+                triangle->length = 0;
+            if (!noise->enabled)
+                noise->length = 0;
+            apu_noise_output(noise);
+
+            if (!get_bit(value, apu_DMC)) {
+                dmc->remaining = 0;
+            } else if (dmc->remaining == 0) {
+                dmc->address = dmc->sample_address;
+                dmc->remaining = dmc->sample_length;
+                apu_dmc_fetch(apu);
+            }
+
+            apu->dmc_irq = false;
+            apu_update_irq(apu);
+            break;
+        case 0x4017:
+            apu->five_step = value & 0x80;
+            apu->irq_inhibit = value & 0x40;
+            apu->sequence_cycle = 0;
+
+            if (apu->irq_inhibit) {
+                apu->frame_irq = false;
+                apu_update_irq(apu);
+            }
+
+            // The 5-step mode clocks everything straight away
+            if (apu->five_step) {
+                apu_quarter_frame(apu);
+                apu_half_frame(apu);
+                apu_pulse_output(&apu->pulse[0]);
+                apu_pulse_output(&apu->pulse[1]);
+                apu_noise_output(noise);
+            }
+            break;
+    }
+
+    apu_update_output(apu);
+    apu_update_irq(apu);
+    apu_schedule(apu);
+}
+
+uint8_t* apu_read_status(APU_t* apu) {
+    uint8_t status = 0;
+
+    apu_run(apu, apu->cpu->cycle);
+
+    status = set_bit(status, apu_PULSE1, apu->pulse[0].length > 0);
+    status = set_bit(status, apu_PULSE2, apu->pulse[1].length > 0);
+    status = set_bit(status, apu_TRIANGLE, apu->triangle.length > 0);
+    status = set_bit(status, apu_NOISE, apu->noise.length > 0);
+    status = set_bit(status, apu_DMC, apu->dmc.remaining > 0);
+    status = set_bit(status, apu_FRAMEIRQ, apu->frame_irq);
+    status = set_bit(status, apu_DMCIRQ, apu->dmc_irq);
+    apu->reg_APUSTATUS = status;
+
+    // Reading the status acknowledges the frame interrupt
+    apu->frame_irq = false;
+    apu_update_irq(apu);
+    apu_schedule(apu);
+
+    return &apu->reg_APUSTATUS;
 }
@@ -2,11 +2,42 @@
 #define APU_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "console.h"
 
 #define FRAME_COUNTER_CLOCK 60
+#define AUDIO_SAMPLE_RATE   48000
+#define APU_FRAME_CYCLES    29781 // CPU cycles per audio frame, ~1 video frame
+#define APU_VOLUME          32000 // Output level with every channel at full
+#define APU_MAX_LEVEL       1.0f  // Mixer output with every channel at full
+#define APU_NO_EVENT        UINT32_MAX
 
-APU_t* apu_init();
-void apu_free(APU_t* apu);
+// Frame sequencer steps, in CPU cycles since the last $4017 write
+#define SEQ_STEP_1          7457
+#define SEQ_STEP_2          14913
+#define SEQ_STEP_3          22371
+#define SEQ_STEP_4          29829
+#define SEQ_STEP_5          37281
+
+enum APUStatusBits {
+    apu_PULSE1   = 0,
+    apu_PULSE2   = 1,
+    apu_TRIANGLE = 2,
+    apu_NOISE    = 3,
+    apu_DMC      = 4,
+    apu_FRAMEIRQ = 6,
+    apu_DMCIRQ   = 7
+};
+
+void apu_init(APU_t* apu);
+void apu_set_sample_rate(APU_t* apu, uint32_t sample_rate);
+
+void apu_run(APU_t* apu, uint64_t target);
+void apu_sync(APU_t* apu);
+void apu_end_frame(APU_t* apu);
+
+// Register access, $4000-$4013, $4015 and $4017
+void apu_write(APU_t* apu, uint16_t address, uint8_t value);
+uint8_t* apu_read_status(APU_t* apu);
 
 #endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "audio.h"
+#include "pacing.h"
+
+static void* audio_thread(void* arg);
+
+static void audio_nap() {
+    struct timespec nap = {0, AUDIO_POLL_NS};
+    nanosleep(&nap, NULL);
+}
+
+AudioOut_t* audio_open(AudioSink_t sink, Pacer_t* pacer) {
+    AudioOut_t* audio = (AudioOut_t*) calloc(1, sizeof(AudioOut_t));
+
+    audio->sink = sink;
+    audio->pacer = pacer;
+    audio->ring = (int16_t*) malloc((AUDIO_RING_SIZE) * sizeof(int16_t));
+    audio->mask = (AUDIO_RING_SIZE) - 1;
+    audio->running = true;
+
+    if (pthread_create(&audio->thread, NULL, &audio_thread, (void*) audio) != 0) {
+        fprintf(stderr, "Unable to start audio thread\n");
+        sink.close(sink.context);
+        free(audio->ring);
+        free(audio);
+        return NULL;
+    }
+
+    return audio;
+}
+
+void audio_close(AudioOut_t* audio) {
+    // The sink thread drains the ring before it exits
+    __atomic_store_n(&audio->running, false, __ATOMIC_RELEASE);
+    pthread_join(audio->thread, NULL);
+
+    audio->sink.close(audio->sink.context);
+
+    if (audio->stalls > 0)
+        fprintf(stderr, "Audio output stalled emulation %lu times\n", (unsigned long) audio->stalls);
+    if (audio->dropped > 0)
+        fprintf(stderr, "Audio output dropped %lu samples\n", (unsigned long) audio->dropped);
+
+    free(audio->ring);
+    free(audio);
+}
+
+// Emulation thread only
+void audio_push(AudioOut_t* audio, const int16_t* samples, uint32_t count) {
+    uint64_t head = audio->head;
+
+    while (count > 0) {
+        if (__atomic_load_n(&audio->failed, __ATOMIC_ACQUIRE))
+            return;
+
+        uint64_t tail = __atomic_load_n(&audio->tail, __ATOMIC_ACQUIRE);
+        uint32_t space = (AUDIO_RING_SIZE) - (uint32_t) (head - tail);
+
+        if (space == 0) {
+            if (audio->sink.realtime) {
+                audio->dropped += count;
+                return;
+            }
+
+            audio->stalls++;
+            audio_nap();
+            continue;
+        }
+
+        // Copy up to the end of the ring, wrap on the next pass
+        uint32_t start = head & audio->mask;
+        uint32_t chunk = count < space ? count : space;
+        if (start + chunk > (AUDIO_RING_SIZE))
+            chunk = (AUDIO_RING_SIZE) - start;
+
+        memcpy(&audio->ring[start], samples, chunk * sizeof(int16_t));
+        head += chunk;
+        samples += chunk;
+        count -= chunk;
+
+        __atomic_store_n(&audio->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static void* audio_thread(void* arg) {
+    AudioOut_t* audio = (AudioOut_t*) arg;
+    uint64_t tail = audio->tail;
+
+    while (true) {
+        // Read `running` first so nothing pushed before close is missed
+        bool running = __atomic_load_n(&audio->running, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&audio->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            if (!running)
+                break;
+
+            audio_nap();
+            continue;
+        }
+
+        uint32_t start = tail & audio->mask;
+        uint32_t chunk = head - tail;
+        if (start + chunk > (AUDIO_RING_SIZE))
+            chunk = (AUDIO_RING_SIZE) - start;
+
+        if (!audio->sink.write(audio->sink.context, &audio->ring[start], chunk)) {
+            fprintf(stderr, "Error: Audio output failed, sound stopped\n");
+            __atomic_store_n(&audio->failed, true, __ATOMIC_RELEASE);
+            break;
+        }
+
+        tail += chunk;
+        __atomic_store_n(&audio->tail, tail, __ATOMIC_RELEASE);
+
+        if (audio->pacer != NULL)
+            pacer_audio_played(audio->pacer, tail);
+    }
+
+    return NULL;
+}
+
+// WAV FILE SINK
+
+static bool audio_wav_write(void* context, const int16_t* samples, uint32_t count) {
+    return wav_write((WavWriter_t*) context, samples, count);
+}
+
+static void audio_wav_close(void* context) {
+    wav_close((WavWriter_t*) context);
+}
+
+// For headless runs. Takes a file, "-" or "|command" like the capture.
+AudioOut_t* audio_open_wav(char* path, uint32_t sample_rate, Pacer_t* pacer) {
+    WavWriter_t* wav = wav_open(path, sample_rate, 1);
+
+    if (wav == NULL)
+        return NULL;
+
+    AudioSink_t sink = {
+        .context  = wav,
+        .realtime = false,
+        .write    = &audio_wav_write,
+        .close    = &audio_wav_close
+    };
+
+    return audio_open(sink, pacer);
+}
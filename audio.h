@@ -0,0 +1,47 @@
+#ifndef AUDIO_H__
+#define AUDIO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "console.h"
+#include "wav.h"
+
+#define AUDIO_RING_SIZE  1 << 15 // Samples, must be a power of two
+#define AUDIO_POLL_NS    1000000 // How long an idle side naps
+
+// Where samples end up. `realtime` sinks consume at a fixed rate and would
+// rather drop samples than hold emulation up; file sinks never drop.
+typedef struct {
+    void* context;
+    bool  realtime;
+    bool  (*write)(void* context, const int16_t* samples, uint32_t count);
+    void  (*close)(void* context);
+} AudioSink_t;
+
+// Single producer, single consumer ring between the emulation thread and a
+// sink thread. The two sides only share the head and tail counters, which
+// are each written by one side, so neither ever takes a lock.
+struct AudioOut_t {
+    AudioSink_t sink;
+    Pacer_t*    pacer;   // Told how much has actually been played
+
+    int16_t*    ring;
+    uint32_t    mask;
+    uint64_t    head;    // Written by the emulator
+    uint64_t    tail;    // Written by the sink thread
+
+    pthread_t   thread;
+    bool        running;
+    bool        failed;
+    uint64_t    stalls;
+    uint64_t    dropped;
+};
+
+AudioOut_t* audio_open(AudioSink_t sink, Pacer_t* pacer);
+AudioOut_t* audio_open_wav(char* path, uint32_t sample_rate, Pacer_t* pacer);
+void audio_close(AudioOut_t* audio);
+
+void audio_push(AudioOut_t* audio, const int16_t* samples, uint32_t count);
+
+#endif
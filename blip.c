@@ -0,0 +1,99 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "blip.h"
+
+#define BLIP_MAX_CUTOFF 0.45 // Fraction of the output rate kept at most
+
+static void blip_build_kernel(BlipBuffer_t* blip, double cutoff) {
+    // Blackman windowed sinc, one copy per sub-sample phase. The impulse for
+    // phase p sits at BLIP_TAPS / 2 + p / BLIP_PHASES samples.
+    for (int phase = 0; phase < BLIP_PHASES; ++phase) {
+        double sum = 0;
+
+        for (int tap = 0; tap < BLIP_TAPS; ++tap) {
+            double x = tap - BLIP_TAPS / 2 - (double) phase / BLIP_PHASES;
+            double sinc = x == 0 ? 1.0 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            double w = (x + BLIP_TAPS / 2) / BLIP_TAPS;
+            double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+
+            blip->kernel[phase][tap] = sinc * window;
+            sum += sinc * window;
+        }
+
+        // Each phase has to add up to exactly one step once integrated
+        for (int tap = 0; tap < BLIP_TAPS; ++tap)
+            blip->kernel[phase][tap] /= sum;
+    }
+}
+
+void blip_init(BlipBuffer_t* blip, double clock_rate, uint32_t sample_rate) {
+    memset(blip, 0, sizeof(BlipBuffer_t));
+
+    blip->factor = (uint64_t) ((double) sample_rate / clock_rate * (1ULL << BLIP_TIME_BITS) + 0.5);
+    blip->leak = exp(-2 * M_PI * BLIP_HIGHPASS_HZ / sample_rate);
+
+    double cutoff = BLIP_LOWPASS_HZ / sample_rate;
+    blip_build_kernel(blip, cutoff < BLIP_MAX_CUTOFF ? cutoff : BLIP_MAX_CUTOFF);
+}
+
+// `time` is in clocks since the start of the current frame
+void blip_add_delta(BlipBuffer_t* blip, uint32_t time, float delta) {
+    uint64_t fixed = blip->offset + time * blip->factor;
+    uint32_t pos = fixed >> BLIP_TIME_BITS;
+    uint32_t phase = (fixed >> (BLIP_TIME_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+    // The reader fell behind, dropping the change beats corrupting memory
+    if (pos >= BLIP_BUFFER_SIZE)
+        return;
+
+    float* out = &blip->buffer[pos];
+    const float* kernel = blip->kernel[phase];
+
+#ifdef __SSE__
+    __m128 scale = _mm_set1_ps(delta);
+    for (int tap = 0; tap < BLIP_TAPS; tap += 4) {
+        __m128 k = _mm_load_ps(&kernel[tap]);
+        __m128 o = _mm_loadu_ps(&out[tap]);
+        _mm_storeu_ps(&out[tap], _mm_add_ps(o, _mm_mul_ps(k, scale)));
+    }
+#else
+    for (int tap = 0; tap < BLIP_TAPS; ++tap)
+        out[tap] += kernel[tap] * delta;
+#endif
+}
+
+void blip_end_frame(BlipBuffer_t* blip, uint32_t duration) {
+    blip->offset += duration * blip->factor;
+}
+
+uint32_t blip_samples_avail(BlipBuffer_t* blip) {
+    uint32_t avail = blip->offset >> BLIP_TIME_BITS;
+    return avail < BLIP_BUFFER_SIZE ? avail : BLIP_BUFFER_SIZE;
+}
+
+uint32_t blip_read_samples(BlipBuffer_t* blip, int16_t* out, uint32_t count) {
+    uint32_t avail = blip_samples_avail(blip);
+    if (count > avail)
+        count = avail;
+
+    // A leaky integrator is the running sum and the high-pass in one
+    float integrator = blip->integrator;
+    for (uint32_t i = 0; i < count; ++i) {
+        integrator = integrator * blip->leak + blip->buffer[i];
+        out[i] = integrator > 32767 ? 32767 : integrator < -32768 ? -32768 : (int16_t) integrator;
+    }
+    blip->integrator = integrator;
+
+    // Keep the tails of impulses that reach past what was read
+    uint32_t remaining = BLIP_BUFFER_SIZE + BLIP_TAPS - count;
+    memmove(blip->buffer, &blip->buffer[count], remaining * sizeof(float));
+    memset(&blip->buffer[remaining], 0, count * sizeof(float));
+
+    blip->offset -= (uint64_t) count << BLIP_TIME_BITS;
+    return count;
+}
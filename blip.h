@@ -0,0 +1,43 @@
+#ifndef BLIP_H__
+#define BLIP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BLIP_PHASE_BITS   5
+#define BLIP_PHASES       (1 << BLIP_PHASE_BITS) // Sub-sample positions
+#define BLIP_TAPS         16                     // Kernel width in samples
+#define BLIP_BUFFER_SIZE  4096                   // Samples held between reads
+#define BLIP_TIME_BITS    32                     // Fraction bits of sample time
+#define BLIP_LOWPASS_HZ   14000.0
+#define BLIP_HIGHPASS_HZ  90.0
+
+// Band-limited step synthesis. Instead of generating a sample for every
+// clock and filtering, the channels only report amplitude changes and the
+// clock they happen on. Each change is stamped into a difference buffer as a
+// band-limited impulse picked from BLIP_PHASES sub-sample offsets, and the
+// buffer is integrated when samples are read out. Cost is proportional to
+// the number of transitions, not the clock rate.
+//
+// This doubles as the resampler down to the output rate, and the console's
+// own output filters are folded in: its ~14kHz low-pass sets the kernel's
+// cutoff and its 90Hz high-pass (DC blocking) is a leak in the integrator.
+typedef struct BlipBuffer_t {
+    uint64_t factor;  // Output samples per clock, BLIP_TIME_BITS fixed point
+    uint64_t offset;  // Start of the current frame in output samples
+    float    kernel[BLIP_PHASES][BLIP_TAPS] __attribute__((aligned(16)));
+
+    float    buffer[BLIP_BUFFER_SIZE + BLIP_TAPS] __attribute__((aligned(16)));
+    float    integrator;
+    float    leak;    // Integrator decay per sample, the high-pass
+} BlipBuffer_t;
+
+// Lives inside the Console_t, so this only (re)initializes it in place
+void blip_init(BlipBuffer_t* blip, double clock_rate, uint32_t sample_rate);
+
+void blip_add_delta(BlipBuffer_t* blip, uint32_t time, float delta);
+void blip_end_frame(BlipBuffer_t* blip, uint32_t duration);
+uint32_t blip_samples_avail(BlipBuffer_t* blip);
+uint32_t blip_read_samples(BlipBuffer_t* blip, int16_t* out, uint32_t count);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "capture.h"
+
+static void* capture_writer(void* arg);
+
+static FILE* capture_open_output(char* path, bool* is_pipe) {
+    *is_pipe = false;
+
+    // "-" is stdout, "|command" feeds an external encoder
+    if (strcmp(path, "-") == 0)
+        return stdout;
+
+    if (path[0] == '|') {
+        *is_pipe = true;
+        return popen(path + 1, "w");
+    }
+
+    return fopen(path, "wb");
+}
+
+static void capture_build_yuv(Capture_t* capture) {
+    // BT.601, limited range, which is what Y4M readers assume
+    for (int i = 0; i < PALLETTE_ENTRIES; ++i) {
+        double r = pallette_rgb24[i][0];
+        double g = pallette_rgb24[i][1];
+        double b = pallette_rgb24[i][2];
+
+        capture->yuv[i][0] = 16  + ( 65.481 * r + 128.553 * g +  24.966 * b) / 255 + 0.5;
+        capture->yuv[i][1] = 128 + (-37.797 * r -  74.203 * g + 112.000 * b) / 255 + 0.5;
+        capture->yuv[i][2] = 128 + (112.000 * r -  93.786 * g -  18.214 * b) / 255 + 0.5;
+    }
+}
+
+Capture_t* capture_open(char* video_path, uint8_t frameskip, ScaleFilter scale, uint8_t factor) {
+    Capture_t* capture = (Capture_t*) calloc(1, sizeof(Capture_t));
+
+    capture->scale = scale;
+    capture->scale_factor = scale_factor(scale, factor);
+    capture->width = FRAME_WIDTH * capture->scale_factor;
+    capture->height = FRAME_HEIGHT * capture->scale_factor;
+
+    // A dead encoder should surface as a write error, not kill the emulator
+    signal(SIGPIPE, SIG_IGN);
+
+    capture->video = capture_open_output(video_path, &capture->video_pipe);
+
+    if (capture->video == NULL) {
+        fprintf(stderr, "Error: Could not open capture output %s\n", video_path);
+        free(capture);
+        return NULL;
+    }
+
+    // 4:4:4 avoids chroma bleeding on pixel art
+    fprintf(capture->video, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+        capture->width, capture->height, FRAME_RATE_NUM, FRAME_RATE_DEN * frameskip);
+
+    // Everything the writer needs is allocated up front
+    capture->slots = (CaptureSlot_t*) malloc(CAPTURE_POOL_SIZE * sizeof(CaptureSlot_t));
+    capture->planes = (uint8_t*) malloc((size_t) capture->width * capture->height * 3);
+
+    for (uint8_t i = 0; i < CAPTURE_POOL_SIZE; ++i)
+        capture->free_slots[i] = i;
+    capture->free_count = CAPTURE_POOL_SIZE;
+
+    capture_build_yuv(capture);
+
+    if (capture->scale_factor > 1) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        capture->scale_bands = cores < 1 ? 1 : cores > SCALE_MAX_BANDS ? SCALE_MAX_BANDS : cores;
+        capture->scaled = (uint32_t*) malloc((size_t) capture->width * capture->height * sizeof(uint32_t));
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->work, NULL);
+    pthread_cond_init(&capture->space, NULL);
+    capture->running = true;
+
+    if (pthread_create(&capture->writer, NULL, &capture_writer, (void*) capture) != 0) {
+        fprintf(stderr, "Unable to start capture thread\n");
+        capture->running = false;
+        capture_close(capture);
+        return NULL;
+    }
+
+    return capture;
+}
+
+void capture_close(Capture_t* capture) {
+    pthread_mutex_lock(&capture->lock);
+    bool was_running = capture->running;
+    capture->running = false;
+    pthread_cond_signal(&capture->work);
+    pthread_mutex_unlock(&capture->lock);
+
+    // The writer drains whatever is still queued before exiting
+    if (was_running)
+        pthread_join(capture->writer, NULL);
+
+    if (capture->video_pipe)
+        pclose(capture->video);
+    else if (capture->video != stdout)
+        fclose(capture->video);
+    else
+        fflush(stdout);
+
+    if (capture->stalls > 0)
+        fprintf(stderr, "Capture stalled emulation %lu times\n", (unsigned long) capture->stalls);
+
+    pthread_mutex_destroy(&capture->lock);
+    pthread_cond_destroy(&capture->work);
+    pthread_cond_destroy(&capture->space);
+    free(capture->slots);
+    free(capture->planes);
+    free(capture->scaled);
+    free(capture);
+}
+
+void capture_push_frame(Capture_t* capture, uint16_t (*frame)[FRAME_WIDTH], uint64_t frame_number) {
+    pthread_mutex_lock(&capture->lock);
+
+    if (capture->free_count == 0)
+        capture->stalls++;
+    while (capture->free_count == 0 && !capture->failed)
+        pthread_cond_wait(&capture->space, &capture->lock);
+
+    if (capture->failed) {
+        pthread_mutex_unlock(&capture->lock);
+        return;
+    }
+
+    uint8_t slot = capture->free_slots[--capture->free_count];
+    pthread_mutex_unlock(&capture->lock);
+
+    // The copy happens outside the lock; the slot belongs to us until queued
+    memcpy(capture->slots[slot].frame, frame, sizeof(capture->slots[slot].frame));
+    capture->slots[slot].frame_number = frame_number;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->ready[(capture->ready_head + capture->ready_count) % CAPTURE_POOL_SIZE] = slot;
+    capture->ready_count++;
+    pthread_cond_signal(&capture->work);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+static bool capture_write_scaled(Capture_t* capture, CaptureSlot_t* slot) {
+    size_t pixels = (size_t) capture->width * capture->height;
+    uint8_t* y = capture->planes;
+    uint8_t* u = y + pixels;
+    uint8_t* v = u + pixels;
+
+    scale_frame(capture->scale, capture->scale_factor, slot->frame,
+        capture->scaled, capture->width, capture->scale_bands);
+
+    // Same BT.601 limited range as the table, in 8.8 fixed point since
+    // blending filters produce colours outside the pallette
+    for (size_t i = 0; i < pixels; ++i) {
+        int r = (capture->scaled[i] >> 16) & 0xFF;
+        int g = (capture->scaled[i] >> 8) & 0xFF;
+        int b = capture->scaled[i] & 0xFF;
+
+        y[i] = 16  + (( 66 * r + 129 * g +  25 * b + 128) >> 8);
+        u[i] = 128 + ((-38 * r -  74 * g + 112 * b + 128) >> 8);
+        v[i] = 128 + ((112 * r -  94 * g -  18 * b + 128) >> 8);
+    }
+
+    fputs("FRAME\n", capture->video);
+    return fwrite(capture->planes, pixels * 3, 1, capture->video) == 1;
+}
+
+static bool capture_write_frame(Capture_t* capture, CaptureSlot_t* slot) {
+    const uint16_t* pixels = &slot->frame[0][0];
+    uint8_t* y = capture->planes;
+    uint8_t* u = y + FRAME_WIDTH * FRAME_HEIGHT;
+    uint8_t* v = u + FRAME_WIDTH * FRAME_HEIGHT;
+
+    if (capture->scaled != NULL)
+        return capture_write_scaled(capture, slot);
+
+    for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i) {
+        const uint8_t* yuv = capture->yuv[pixels[i]];
+        y[i] = yuv[0];
+        u[i] = yuv[1];
+        v[i] = yuv[2];
+    }
+
+    fputs("FRAME\n", capture->video);
+    return fwrite(capture->planes, FRAME_WIDTH * FRAME_HEIGHT * 3, 1, capture->video) == 1;
+}
+
+static void* capture_writer(void* arg) {
+    Capture_t* capture = (Capture_t*) arg;
+
+    pthread_mutex_lock(&capture->lock);
+
+    while (true) {
+        while (capture->ready_count == 0 && capture->running)
+            pthread_cond_wait(&capture->work, &capture->lock);
+
+        if (capture->ready_count == 0)
+            break;
+
+        uint8_t slot = capture->ready[capture->ready_head];
+        pthread_mutex_unlock(&capture->lock);
+
+        bool ok = capture_write_frame(capture, &capture->slots[slot]);
+
+        pthread_mutex_lock(&capture->lock);
+
+        capture->ready_head = (capture->ready_head + 1) % CAPTURE_POOL_SIZE;
+        capture->ready_count--;
+        capture->free_slots[capture->free_count++] = slot;
+
+        if (!ok && !capture->failed) {
+            // Stop recording rather than block emulation forever
+            fprintf(stderr, "Error: Capture output failed, recording stopped\n");
+            capture->failed = true;
+        }
+
+        pthread_cond_broadcast(&capture->space);
+    }
+
+    pthread_mutex_unlock(&capture->lock);
+    return NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef CAPTURE_H__
+#define CAPTURE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "console.h"
+#include "pallette.h"
+#include "scale.h"
+
+#define CAPTURE_POOL_SIZE   8       // Frames queued before emulation stalls
+
+typedef struct {
+    uint16_t frame[FRAME_HEIGHT][FRAME_WIDTH];
+    uint64_t frame_number;
+} CaptureSlot_t;
+
+// Records frames as Y4M to a file or pipe (audio goes through audio.c). The
+// emulator only copies each frame into a pooled slot; colour conversion and
+// all I/O happen on the writer thread. Emulation waits only when every slot
+// is still queued.
+struct Capture_t {
+    FILE*        video;
+    bool         video_pipe;
+
+    // Frame pool: slots move from the free list to the ready queue and back
+    CaptureSlot_t* slots;
+    uint8_t  free_slots[CAPTURE_POOL_SIZE];
+    uint8_t  free_count;
+    uint8_t  ready[CAPTURE_POOL_SIZE];
+    uint8_t  ready_head;
+    uint8_t  ready_count;
+
+    // Writer state
+    uint8_t  yuv[PALLETTE_ENTRIES][3];
+    uint8_t* planes;
+    uint16_t width;
+    uint16_t height;
+
+    // Optional upscaling, done on the writer thread
+    ScaleFilter scale;
+    uint8_t   scale_factor;
+    uint8_t   scale_bands;
+    uint32_t* scaled;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  work;
+    pthread_cond_t  space;
+    bool     running;
+    bool     failed;
+    uint64_t stalls;
+};
+
+Capture_t* capture_open(char* video_path, uint8_t frameskip, ScaleFilter scale, uint8_t factor);
+void capture_close(Capture_t* capture);
+
+void capture_push_frame(Capture_t* capture, uint16_t (*frame)[FRAME_WIDTH], uint64_t frame_number);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "cheat.h"
+#include "cpu.h"
+#include "rom.h"
+
+static const char GAME_GENIE_LETTERS[] = "APZLGITYEOXUKSVN";
+
+static int cheat_hex(const char* text, int digits) {
+    int value = 0;
+
+    for (int i = 0; i < digits; ++i) {
+        if (!isxdigit((unsigned char) text[i]))
+            return -1;
+
+        char c = tolower((unsigned char) text[i]);
+        value = (value << 4) | (c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+
+    return value;
+}
+
+// Game Genie codes are 6 or 8 letters, each one a scrambled nibble of the
+// address, value and (for 8 letters) compare byte
+static bool cheat_decode_game_genie(const char* code, Cheat_t* cheat) {
+    uint8_t n[8];
+    size_t length = strlen(code);
+
+    if (length != 6 && length != 8)
+        return false;
+
+    for (size_t i = 0; i < length; ++i) {
+        const char* letter = strchr(GAME_GENIE_LETTERS, toupper((unsigned char) code[i]));
+
+        if (letter == NULL)
+            return false;
+
+        n[i] = letter - GAME_GENIE_LETTERS;
+    }
+
+    cheat->address = 0x8000 |
+        ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8) |
+        ((n[2] & 7) << 4)  | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8);
+    cheat->value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7);
+    cheat->has_compare = length == 8;
+
+    if (cheat->has_compare) {
+        cheat->value |= n[7] & 8;
+        cheat->compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+    } else {
+        cheat->value |= n[5] & 8;
+    }
+
+    return true;
+}
+
+// Raw codes are AAAA:VV, or AAAA?CC:VV to only patch over CC
+static bool cheat_decode_raw(const char* code, Cheat_t* cheat) {
+    int address = cheat_hex(code, 4);
+    int compare = -1;
+    int value;
+
+    if (address < 0)
+        return false;
+
+    code += 4;
+    if (*code == '?') {
+        compare = cheat_hex(code + 1, 2);
+        code += 3;
+
+        if (compare < 0)
+            return false;
+    }
+
+    if (*code != ':' || (value = cheat_hex(code + 1, 2)) < 0 || code[3] != '\0')
+        return false;
+
+    cheat->address = address;
+    cheat->value = value;
+    cheat->compare = compare < 0 ? 0 : compare;
+    cheat->has_compare = compare >= 0;
+
+    return true;
+}
+
+bool cheat_decode(const char* code, Cheat_t* cheat) {
+    if (strchr(code, ':') != NULL)
+        return cheat_decode_raw(code, cheat);
+
+    return cheat_decode_game_genie(code, cheat);
+}
+
+// Patches go into the cartridge's read pages, so reads never look at the
+// cheat list. Anything below $8000 gets rewritten once a frame instead.
+bool cheat_add(CPU_t* cpu, const char* code) {
+    Cheat_t cheat;
+
+    if (!cheat_decode(code, &cheat)) {
+        fprintf(stderr, "Warning: %s is not a Game Genie or AAAA[?CC]:VV code\n", code);
+        return false;
+    }
+
+    if (cheat.address >= 0x8000)
+        return rom_patch(cpu->cartridge, cheat);
+
+    if (cpu->freeze_count == CHEAT_MAX)
+        return false;
+
+    cpu->freezes[cpu->freeze_count++] = cheat;
+    return true;
+}
+
+void cheat_freeze(CPU_t* cpu) {
+    for (uint8_t i = 0; i < cpu->freeze_count; ++i) {
+        Cheat_t* cheat = &cpu->freezes[i];
+
+        if (cheat->address < 0x2000)
+            cpu->memory[cheat->address % (CPU_MEMORY_SIZE)] = cheat->value;
+        else if (cheat->address >= 0x6000 && cpu->cartridge->ram_page_count > 0)
+            cpu->cartridge->ram_data[cheat->address - 0x6000] = cheat->value;
+    }
+}
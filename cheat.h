@@ -0,0 +1,24 @@
+#ifndef CHEAT_H__
+#define CHEAT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CHEAT_MAX 32 // Of each kind, ROM patches and RAM freezes
+
+// A single byte override. At $8000 and up it patches PRG, optionally only
+// when the byte it replaces matches `compare`. Below that it's a RAM freeze.
+typedef struct {
+    uint16_t address;
+    uint8_t  value;
+    uint8_t  compare;
+    bool     has_compare;
+} Cheat_t;
+
+struct CPU_t;
+
+bool cheat_decode(const char* code, Cheat_t* cheat);
+bool cheat_add(struct CPU_t* cpu, const char* code);
+void cheat_freeze(struct CPU_t* cpu);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "console.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "triplebuf.h"
+
+pthread_mutex_t clock_lock;
+uint8_t ZERO = 0;
+
+// Points the chips at each other and at their bulk data. Everything in here
+// is inside the Console_t, so it has to be redone whenever one is copied.
+static void console_link(Console_t* console) {
+    CPU_t* cpu = &console->cpu;
+    PPU_t* ppu = &console->ppu;
+    APU_t* apu = &console->apu;
+
+    cpu->memory = console->cpu_memory;
+    cpu->ppu = ppu;
+    cpu->apu = apu;
+    cpu->input = &console->input;
+
+    ppu->cpu = cpu;
+    ppu->memory = console->ppu_memory;
+    ppu->oam = console->oam;
+    ppu->bg_line = console->bg_line;
+    ppu->sprite_line = console->sprite_line;
+    ppu->bg_planes = console->bg_planes;
+    ppu->bg_tile_dirty = console->bg_tile_dirty;
+    ppu->bg_chr_dirty = console->bg_chr_dirty;
+
+    apu->cpu = cpu;
+    apu->blip = &console->blip;
+
+    console->input.cpu = cpu;
+    console->input.ppu = ppu;
+}
+
+Console_t* console_init(ROM_t* cartridge) {
+    Console_t* console;
+
+    if (posix_memalign((void**) &console, CACHE_LINE, sizeof(Console_t)) != 0) {
+        fprintf(stderr, "Error: Could not allocate the console\n");
+        return NULL;
+    }
+
+    memset(console, 0, sizeof(Console_t));
+    console_link(console);
+
+    cpu_init(&console->cpu, cartridge);
+    ppu_init(&console->ppu, cartridge);
+    apu_init(&console->apu);
+    input_init(&console->input);
+
+    return console;
+}
+
+// A snapshot of the console, e.g. to run ahead and throw the result away.
+// The clone gets its own copy of the cartridge's state (see rom_clone()) and
+// its own frame buffers, but none of the original's outputs. The original
+// has to outlive it, the ROM image is still shared.
+Console_t* console_clone(Console_t* console) {
+    Console_t* clone;
+
+    if (posix_memalign((void**) &clone, CACHE_LINE, sizeof(Console_t)) != 0) {
+        fprintf(stderr, "Error: Could not allocate the console\n");
+        return NULL;
+    }
+
+    ROM_t* cartridge = rom_clone(console->cpu.cartridge);
+    TripleBuffer_t* output = triplebuf_init(TRIPLEBUF_MAX_CONSUMERS);
+
+    if (cartridge == NULL || output == NULL) {
+        fprintf(stderr, "Error: Could not allocate the console\n");
+
+        if (cartridge != NULL)
+            rom_free(cartridge);
+        if (output != NULL)
+            triplebuf_free(output);
+        free(clone);
+        return NULL;
+    }
+
+    memcpy(clone, console, sizeof(Console_t));
+    console_link(clone);
+
+    cartridge->cpu = &clone->cpu;
+    clone->cpu.cartridge = cartridge;
+    clone->ppu.cartridge = cartridge;
+    clone->owns_cartridge = true;
+
+    // The nametables in the page table still point at the original's VRAM
+    PPU_t* ppu = &clone->ppu;
+    ppu_map_rebuild(ppu);
+
+    ppu->output = output;
+    ppu->framebuffer = triplebuf_back(ppu->output);
+    ppu->capture = NULL;
+    ppu->shm = NULL;
+    ppu->pacer = NULL;
+    clone->apu.output = NULL;
+
+    // Host input keeps going to the original
+    Input_t* input = &clone->input;
+    input->queue = &input->own_queue;
+    input->replay = NULL;
+    input->record = NULL;
+    input->pending = false;
+
+    return clone;
+}
+
+void console_free(Console_t* console) {
+    triplebuf_free(console->ppu.output);
+
+    if (console->owns_cartridge)
+        rom_free(console->cpu.cartridge);
+
+    free(console);
+}
@@ -5,27 +5,45 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include "rom.h"
+#include "blip.h"
+#include "scheduler.h"
+#include "input.h"
 
 #define MASTER_CLOCK        236250000 / 11.0 // NTSC Clock Rate
 #define NS_PER_CLOCK        (1 / (MASTER_CLOCK)) * 1E9
+#define FRAME_RATE_NUM      39375000 // NTSC frame rate, ~60.0988Hz
+#define FRAME_RATE_DEN      655171
 #define FRAME_WIDTH         256
 #define FRAME_HEIGHT        240
+#define BG_PLANE_WIDTH      512 // Two nametables wide
+#define BG_PLANE_HEIGHT     480 // Two nametables tall
+#define NAMETABLE_TILES     960 // 32x30 tiles
 
 #define SPRITE_SIZE         1 << 2  // 4B
 #define OAM_SIZE            1 << 8  // 256B
 #define SECONDARY_OAM_SIZE  1 << 5  // 32B
-#define PPU_MEMORY_SIZE     1 << 11 // 2KiB
+#define PPU_MEMORY_SIZE     1 << 12 // 4KiB, room for four screen carts
 #define PALLETTE_IND_SIZE   1 << 5  // 32B
+#define PPU_PAGE_SIZE       1 << 10 // 1KiB
+#define PPU_PAGE_COUNT      16      // $0000 - $3FFF
 
 #define CPU_MEMORY_SIZE     1 << 11 // 2KiB
 #define PAGE_SIZE           1 << 8  // 256B
 
-pthread_mutex_t clock_lock;
-uint8_t ZERO = 0;
+#define CACHE_LINE          64
+
+extern pthread_mutex_t clock_lock;
+extern uint8_t ZERO;
 
 typedef struct CPU_t CPU_t;
 typedef struct PPU_t PPU_t;
 typedef struct APU_t APU_t;
+typedef struct Console_t Console_t;
+typedef struct TripleBuffer_t TripleBuffer_t;
+typedef struct Capture_t Capture_t;
+typedef struct ShmExport_t ShmExport_t;
+typedef struct Pacer_t Pacer_t;
+typedef struct AudioOut_t AudioOut_t;
 
 struct CPU_t {
     // REGISTERS
@@ -37,26 +55,41 @@ struct CPU_t {
     uint8_t  reg_P;  // Status register
 
     // SIGNALS
-    bool sig_IRQ;
-    bool sig_NMI;
+    bool    sig_IRQ;
+    bool    sig_NMI;
+    uint8_t irq_sources; // IRQSources holding the IRQ line low
+    bool    poll;        // An interrupt may be takeable, see cpu_poll()
+
+    // CLOCK
+    uint64_t    cycle; // How many cycles have passed
+    Scheduler_t sched; // Everything due at a later cycle, see cpu_run_events()
+    uint32_t    cycle_budget; // A whole idle loop's worth, see fuse_idle_loop()
+    bool        headless; // No PPU thread, so cycles are never handed over
+    uint8_t     dmc_stall;   // Cycles owed to DMC sample fetches
+    uint64_t    oam_dma_end; // Cycle the last OAM DMA finished on
+
+    // OTHER
+    bool powered_on;
 
     // MEMORY
-    uint8_t memory[CPU_MEMORY_SIZE];
+    uint8_t* memory; // CPU_MEMORY_SIZE, in the Console_t
 
     // OTHER HARDWARE
     ROM_t* cartridge;
     PPU_t* ppu;
     APU_t* apu;
+    Input_t* input; // Whatever is plugged into $4016/$4017
 
-    // CLOCK
-    uint64_t cycle; // How many cycles have passed
-    uint8_t  cycle_budget;
-
-    // OTHER
-    bool powered_on;
+    // CHEATS
+    Cheat_t freezes[CHEAT_MAX]; // Rewritten every frame
+    uint8_t freeze_count;
 };
 
 struct PPU_t {
+    // CLOCK
+    uint64_t cycle;
+    uint32_t cycle_budget; // Up to a frame and more at once, see cpu_stall()
+
     // REGISTERS
     uint8_t  reg_PPUCTRL;
     uint8_t  reg_PPUMASK;
@@ -68,42 +101,144 @@ struct PPU_t {
     uint8_t  reg_PPUDATA;
     uint8_t  reg_OAMDMA;
 
-    // RENDERING REGISTERS
-    uint16_t sreg_BG[2];
-    uint8_t  sreg_BGPALLETTE[2];
-    uint8_t  sreg_SPRITE[8][2];
-    uint8_t  sreg_SPRITEATTR[8];
-    uint8_t  ltch_SPRITE[8];
-    uint8_t  cntr_SPRITE[8];
-
     // FLAGS
     bool address_latch;
     bool clear_vsync;
 
+    // RENDERING
+    int16_t  scanline;
+    uint16_t scanline_cycle;
+    uint64_t framenumber;
+    bool     bg_exact_line;
+    uint8_t  sprite_count;
+    bool     sprite0_on_line;
+
+    // FAST-FORWARD
+    uint8_t  frameskip;    // Render 1 of every `frameskip` frames
+    bool     render_frame; // Whether the current frame produces pixels
+
+    // A12 EDGES
+    // Only followed when the cartridge can't predict them, see mapper.c
+    bool     a12_watch;
+    uint64_t a12_high; // Cycle of the last pattern fetch with A12 high
+
+    // NMI
+    uint64_t nmi_cycle; // Cycle the next vblank flag goes up, when NMIs are on
+
     // MEMORY
-    uint8_t oam[OAM_SIZE];
-    uint8_t secondary_oam[SECONDARY_OAM_SIZE];
-    uint8_t memory[PPU_MEMORY_SIZE];
-    uint8_t pallette_indices[PALLETTE_IND_SIZE];
+    // Pattern tables and nametables in 1KiB pages, with mirroring resolved
+    uint8_t* page_table[PPU_PAGE_COUNT];
+    uint8_t  secondary_oam[SECONDARY_OAM_SIZE];
+    uint8_t  pallette_indices[PALLETTE_IND_SIZE];
+    uint8_t* oam;    // OAM_SIZE, in the Console_t
+    uint8_t* memory; // PPU_MEMORY_SIZE, in the Console_t
 
     // OTHER HARDWARE
     CPU_t* cpu;
     ROM_t* cartridge; // The PPU reads the CHR pages from the ROM
 
-    // CLOCK
-    uint64_t cycle;
-    uint8_t  cycle_budget;
+    // RENDERING REGISTERS
+    uint16_t sreg_BG[2];
+    uint8_t  sreg_BGPALLETTE[2];
+    uint8_t  sreg_SPRITE[8][2];
+    uint8_t  sreg_SPRITEATTR[8];
+    uint8_t  ltch_SPRITE[8];
+    uint8_t  cntr_SPRITE[8];
 
-    // RENDERING
-    int16_t  scanline;
-    uint16_t scanline_cycle;
-    uint64_t framenumber;
-    uint8_t  framebuffer[FRAME_WIDTH][FRAME_HEIGHT][3];
+    // OUTPUT
+    TripleBuffer_t* output;  // Completed frames for display/encoders
+    Capture_t*      capture; // Every drawn frame, when recording
+    ShmExport_t*    shm;     // Shared memory ring for local readers
+    Pacer_t*        pacer;   // Real-time throttle, NULL when unthrottled
+    uint16_t (*framebuffer)[FRAME_WIDTH]; // 9-bit pallette indices
+    uint8_t*        bg_line;     // FRAME_WIDTH, in the Console_t
+    uint8_t*        sprite_line; // FRAME_WIDTH, in the Console_t
 
-    // OTHER
-    bool mirroring;
+    // BACKGROUND CACHE
+    // The four logical nametables pre-rendered as 4-bit pixel indices
+    // (attribute bits << 2 | pattern bits), laid out as they appear on the
+    // scrolling plane. The arrays themselves are in the Console_t.
+    bool     bg_any_dirty;
+    bool     bg_any_chr_dirty;
+    uint16_t bg_plane_ptable;
+    uint8_t  (*bg_planes)[BG_PLANE_WIDTH];
+    bool     (*bg_tile_dirty)[NAMETABLE_TILES];
+    bool*    bg_chr_dirty;
 };
 
+// Volume envelope shared by the pulse and noise channels
+typedef struct {
+    bool    start;
+    bool    loop;     // Also halts the length counter
+    bool    constant;
+    uint8_t volume;   // Constant volume, or the envelope's divider period
+    uint8_t divider;
+    uint8_t decay;
+} Envelope_t;
+
+typedef struct {
+    Envelope_t envelope;
+    bool     enabled;
+    uint8_t  length;
+    uint8_t  duty;
+    uint8_t  step;    // Position in the 8 step duty sequence
+    uint16_t period;  // 11-bit timer reload
+    uint16_t timer;   // CPU cycles until the next step
+
+    bool     sweep_enabled;
+    bool     sweep_negate;
+    bool     sweep_reload;
+    uint8_t  sweep_period;
+    uint8_t  sweep_shift;
+    uint8_t  sweep_divider;
+    bool     ones_complement; // Pulse 1 negates with one's complement
+
+    uint8_t  output;
+} Pulse_t;
+
+typedef struct {
+    bool     enabled;
+    bool     control; // Halts the length counter and reloads the linear counter
+    uint8_t  length;
+    uint8_t  linear_reload;
+    uint8_t  linear;
+    bool     linear_start;
+    uint8_t  step;    // Position in the 32 step triangle
+    uint16_t period;
+    uint16_t timer;
+    uint8_t  output;
+} Triangle_t;
+
+typedef struct {
+    Envelope_t envelope;
+    bool     enabled;
+    uint8_t  length;
+    bool     mode;    // Short, 93 step, sequence
+    uint16_t period;
+    uint16_t timer;
+    uint16_t shift;   // 15-bit LFSR
+    uint8_t  output;
+} Noise_t;
+
+typedef struct {
+    bool     irq_enabled;
+    bool     loop;
+    uint16_t period;
+    uint16_t timer;
+    uint8_t  output;  // 7-bit delta counter
+
+    uint16_t sample_address;
+    uint16_t sample_length;
+    uint16_t address;
+    uint16_t remaining;
+
+    uint8_t  buffer;
+    bool     buffer_full;
+    uint8_t  shift;
+    uint8_t  bits;
+    bool     silence;
+} DMC_t;
+
 struct APU_t {
     // PULSE 1
     uint8_t reg_P1DLCV;
@@ -136,6 +271,59 @@ struct APU_t {
     // OTHER
     uint8_t reg_APUSTATUS;
     uint8_t reg_FRAMECOUNTER;
+
+    // CHANNELS
+    Pulse_t    pulse[2];
+    Triangle_t triangle;
+    Noise_t    noise;
+    DMC_t      dmc;
+
+    // FRAME COUNTER
+    bool     five_step;
+    bool     irq_inhibit;
+    bool     frame_irq;
+    bool     dmc_irq;
+    uint16_t sequence_cycle;
+
+    // CLOCK
+    // The APU runs behind the CPU and only catches up when something could
+    // observe it, see apu_sync()
+    uint64_t cycle;       // CPU cycle the APU has been run up to
+
+    // OUTPUT
+    CPU_t*        cpu;
+    BlipBuffer_t* blip;
+    AudioOut_t*   output;      // Sample sink, when there is one
+    uint64_t      frame_start; // CPU cycle the current audio frame began on
+    float         amplitude;   // Last mixed level handed to the blip buffer
 };
 
+// A whole console in one allocation, see console_init(). The small state
+// touched on every cycle comes first, each chip on its own cache line, and
+// the bulk arrays they point into follow so they don't get in its way.
+// Copying one of these and relinking it is all it takes to clone a console.
+struct Console_t {
+    CPU_t cpu __attribute__((aligned(CACHE_LINE)));
+    PPU_t ppu __attribute__((aligned(CACHE_LINE)));
+    APU_t apu __attribute__((aligned(CACHE_LINE)));
+    Input_t input __attribute__((aligned(CACHE_LINE)));
+
+    // BULK DATA
+    uint8_t cpu_memory[CPU_MEMORY_SIZE] __attribute__((aligned(CACHE_LINE)));
+    uint8_t ppu_memory[PPU_MEMORY_SIZE] __attribute__((aligned(CACHE_LINE)));
+    uint8_t oam[OAM_SIZE] __attribute__((aligned(CACHE_LINE)));
+    uint8_t bg_line[FRAME_WIDTH] __attribute__((aligned(CACHE_LINE)));
+    uint8_t sprite_line[FRAME_WIDTH] __attribute__((aligned(CACHE_LINE)));
+    bool    bg_chr_dirty[256] __attribute__((aligned(CACHE_LINE)));
+    bool    bg_tile_dirty[4][NAMETABLE_TILES] __attribute__((aligned(CACHE_LINE)));
+    uint8_t bg_planes[BG_PLANE_HEIGHT][BG_PLANE_WIDTH] __attribute__((aligned(CACHE_LINE)));
+    BlipBuffer_t blip __attribute__((aligned(CACHE_LINE)));
+
+    bool owns_cartridge; // Clones free their copy of the cartridge
+};
+
+Console_t* console_init(ROM_t* cartridge);
+Console_t* console_clone(Console_t* console);
+void console_free(Console_t* console);
+
 #endif
@@ -6,11 +6,15 @@
 #include <string.h>
 #include "cpu.h"
 #include "apu.h"
+#include "fiber.h"
+#include "fuse.h"
+#include "input.h"
 #include "util.h"
 
-CPU_t* cpu_init(ROM_t* cartridge) {
-    CPU_t* cpu = (CPU_t*) malloc(sizeof(CPU_t));
+volatile sig_atomic_t cpu_stop_requested = 0;
 
+// Memory and the other chips are hooked up by console_init()
+void cpu_init(CPU_t* cpu, ROM_t* cartridge) {
     // Zero out system memory
     memset(cpu->memory, 0, CPU_MEMORY_SIZE);
 
@@ -23,27 +27,23 @@ CPU_t* cpu_init(ROM_t* cartridge) {
 
     cpu->sig_IRQ = true;
     cpu->sig_NMI = true;
+    cpu->irq_sources = 0;
+    cpu->poll = false;
 
     cpu->cycle = 0;
+    sched_init(&cpu->sched);
+    cpu->headless = false;
+    cpu->dmc_stall = 0;
+    cpu->oam_dma_end = 0;
+    cpu->freeze_count = 0;
     // On system startup, the PPU will be the source of the CPU's first
     // budgeted cycle.
     cpu->cycle_budget = 0;
 
-    // Connect hardware
-    cpu->ppu = ppu_init(cartridge);
-    cpu->ppu->cycle_budget = 0;
-    cpu->apu = apu_init();
     cpu->cartridge = cartridge;
+    cartridge->cpu = cpu;
 
     cpu->powered_on = true;
-
-    return cpu;
-}
-
-void cpu_free(CPU_t* cpu) {
-    free(cpu->ppu);
-    free(cpu->apu);
-    free(cpu);
 }
 
 uint16_t cpu_get_vector(CPU_t* cpu, uint16_t vec_start) {
@@ -53,7 +53,6 @@ uint16_t cpu_get_vector(CPU_t* cpu, uint16_t vec_start) {
 }
 
 void cpu_start(CPU_t* cpu) {
-    pthread_mutex_lock(&clock_lock);
     cpu->reg_PC = cpu_get_vector(cpu, RST_VECTOR);
 
     while (cpu->powered_on) {
@@ -63,10 +62,11 @@ void cpu_start(CPU_t* cpu) {
 
         cpu_perform_next_op(cpu);
 
-        if (!cpu->sig_IRQ && !get_bit(cpu->reg_P, stat_INT))
-            cpu_irq(cpu);
-        if (!cpu->sig_NMI)
-            cpu_nmi(cpu);
+        if (cpu->poll)
+            cpu_poll(cpu);
+
+        if (cpu_stop_requested)
+            cpu->powered_on = false;
 
 #ifdef DEBUG
         cpu_print_regs(cpu);
@@ -75,25 +75,97 @@ void cpu_start(CPU_t* cpu) {
 #endif
     }
 
-    pthread_mutex_unlock(&clock_lock);
+    // A PPU thread waiting on its budget would never see that we're off,
+    // let it run to the end of its scanline
+    cpu->ppu->cycle_budget = UINT32_MAX;
+
     printf("CPU shutting down\n");
 }
 
 void cpu_tick(CPU_t* cpu) {
     cpu->cycle++;
 
+    // Interrupts, APU catch-ups and mapper IRQs are all worked out ahead of
+    // time, so nothing else needs looking at between events
+    if (cpu->cycle >= cpu->sched.next)
+        cpu_run_events(cpu);
+
+    // Without a PPU thread there is nobody to hand the clock to
+    if (cpu->headless)
+        return;
+
     // Give the PPU 3 cycles per CPU cycle executed because it runs at 3x the
     // clock speed of the CPU
     cpu->ppu->cycle_budget += 3;
 
-    while (cpu->cycle_budget == 0) {
-        pthread_mutex_unlock(&clock_lock);
-        pthread_mutex_lock(&clock_lock);
-    }
+    while (cpu->cycle_budget == 0)
+        fiber_yield();
 
     cpu->cycle_budget--;
 }
 
+// Lets `cycles` go by at once while the CPU is halted. The PPU gets its whole
+// share in one handover instead of one cycle at a time, and anything that
+// came due meanwhile runs at the end.
+void cpu_stall(CPU_t* cpu, uint32_t cycles) {
+    cpu->cycle += cycles;
+
+    if (!cpu->headless) {
+        cpu->ppu->cycle_budget += 3 * cycles;
+
+        while (cpu->cycle_budget < cycles)
+            fiber_yield();
+
+        cpu->cycle_budget -= cycles;
+    }
+
+    if (cpu->cycle >= cpu->sched.next)
+        cpu_run_events(cpu);
+}
+
+// The DMC reads a sample byte at `cycle`, and the CPU is halted for it from
+// the next tick. That's 3 cycles, 4 when the read has to wait for a get
+// cycle, and only 2 inside an OAM DMA, which already halted and aligned.
+void cpu_dmc_fetch(CPU_t* cpu, uint64_t cycle) {
+    if (cycle < cpu->oam_dma_end)
+        cpu->dmc_stall += 2;
+    else
+        cpu->dmc_stall += 3 + (cycle % 2 == 1);
+
+    sched_set(&cpu->sched, SCHED_DMC, cpu->cycle);
+}
+
+// Runs everything due by now. An event that puts itself back on the schedule
+// for a cycle that's already passed runs again on the next tick.
+void cpu_run_events(CPU_t* cpu) {
+    uint8_t due[SCHED_EVENTS];
+    uint8_t count = 0;
+
+    while (cpu->sched.next <= cpu->cycle)
+        due[count++] = sched_pop(&cpu->sched);
+
+    for (uint8_t i = 0; i < count; ++i) {
+        switch (due[i]) {
+            case SCHED_APU:
+                apu_sync(cpu->apu);
+                break;
+            case SCHED_MAPPER:
+                cpu->cartridge->mapper->event(cpu->cartridge);
+                break;
+            case SCHED_NMI:
+                ppu_nmi_event(cpu->ppu);
+                break;
+            case SCHED_DMC: {
+                uint8_t cycles = cpu->dmc_stall;
+
+                cpu->dmc_stall = 0;
+                cpu_stall(cpu, cycles);
+                break;
+            }
+        }
+    }
+}
+
 void cpu_perform_next_op(CPU_t* cpu) {
     uint16_t orig_pc = cpu->reg_PC;
     uint8_t opcode = *cpu_map_read(cpu, cpu->reg_PC++);
@@ -135,7 +207,7 @@ void cpu_perform_next_op(CPU_t* cpu) {
         case 0xF0: op_beq(cpu, RELATIVE);    break;
         // BIT
         case 0x24: op_bit(cpu, ZERO_PAGE);   break;
-        case 0x2C: op_bit(cpu, ABSOLUTE);    break;
+        case 0x2C: fuse_bit_abs(cpu);        break;
         // BMI
         case 0x30: op_bmi(cpu, RELATIVE);    break;
         // BNE
@@ -179,9 +251,9 @@ void cpu_perform_next_op(CPU_t* cpu) {
         case 0xCE: op_dec(cpu, ABSOLUTE);    break;
         case 0xDE: op_dec(cpu, ABSOLUTE_X);  break;
         // DEX
-        case 0xCA: op_dex(cpu, IMPLICIT);    break;
+        case 0xCA: fuse_dex(cpu);            break;
         // DEY
-        case 0x88: op_dey(cpu, IMPLICIT);    break;
+        case 0x88: fuse_dey(cpu);            break;
         // EOR
         case 0x49: op_eor(cpu, IMMEDIATE);   break;
         case 0x45: op_eor(cpu, ZERO_PAGE);   break;
@@ -192,7 +264,7 @@ void cpu_perform_next_op(CPU_t* cpu) {
         case 0x41: op_eor(cpu, INDX_IND);    break;
         case 0x51: op_eor(cpu, IND_INDX);    break;
         // INC
-        case 0xE6: op_inc(cpu, ZERO_PAGE);   break;
+        case 0xE6: fuse_inc_zp(cpu);         break;
         case 0xF6: op_inc(cpu, ZERO_PAGE_X); break;
         case 0xEE: op_inc(cpu, ABSOLUTE);    break;
         case 0xFE: op_inc(cpu, ABSOLUTE_X);  break;
@@ -206,11 +278,11 @@ void cpu_perform_next_op(CPU_t* cpu) {
         // JSR
         case 0x20: op_jsr(cpu, ABSOLUTE);    break;
         // LDA
-        case 0xA9: op_lda(cpu, IMMEDIATE);   break;
-        case 0xA5: op_lda(cpu, ZERO_PAGE);   break;
+        case 0xA9: fuse_lda(cpu, IMMEDIATE); break;
+        case 0xA5: fuse_lda(cpu, ZERO_PAGE); break;
         case 0xB5: op_lda(cpu, ZERO_PAGE_X); break;
-        case 0xAD: op_lda(cpu, ABSOLUTE);    break;
-        case 0xBD: op_lda(cpu, ABSOLUTE_X);  break;
+        case 0xAD: fuse_lda(cpu, ABSOLUTE);  break;
+        case 0xBD: fuse_lda(cpu, ABSOLUTE_X); break;
         case 0xB9: op_lda(cpu, ABSOLUTE_Y);  break;
         case 0xA1: op_lda(cpu, INDX_IND);    break;
         case 0xB1: op_lda(cpu, IND_INDX);    break;
@@ -286,7 +358,7 @@ void cpu_perform_next_op(CPU_t* cpu) {
         case 0x85: op_sta(cpu, ZERO_PAGE);   break;
         case 0x95: op_sta(cpu, ZERO_PAGE_X); break;
         case 0x8D: op_sta(cpu, ABSOLUTE);    break;
-        case 0x9D: op_sta(cpu, ABSOLUTE_X);  break;
+        case 0x9D: fuse_sta_abs_x(cpu);      break;
         case 0x99: op_sta(cpu, ABSOLUTE_Y);  break;
         case 0x81: op_sta(cpu, INDX_IND);    break;
         case 0x91: op_sta(cpu, IND_INDX);    break;
@@ -323,8 +395,9 @@ void op_adc(CPU_t* cpu, AddrMode mode) {
     uint8_t rhs = *cpu_get_op_target(cpu, mode, true);
     uint16_t result = cpu->reg_A + rhs + get_bit(cpu->reg_P, stat_CARRY);
 
-    cpu->reg_A = result;
+    // Both inputs had the same sign and the result doesn't
     overflow = !((cpu->reg_A ^ rhs) & 0x80) && ((cpu->reg_A ^ result) & 0x80);
+    cpu->reg_A = result;
 
     cpu->reg_P = set_bit(cpu->reg_P, stat_CARRY, result > 255);
     cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
@@ -350,53 +423,64 @@ void op_asl(CPU_t* cpu, AddrMode mode) {
 }
 
 void op_bcc(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (!get_bit(cpu->reg_P, stat_CARRY)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
 void op_bcs(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (get_bit(cpu->reg_P, stat_CARRY)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
 void op_beq(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (get_bit(cpu->reg_P, stat_ZERO)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
 void op_bit(CPU_t* cpu, AddrMode mode) {
     uint8_t value = *cpu_get_op_target(cpu, mode, false);
-    value = cpu->reg_A & value;
 
-    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, (cpu->reg_A & value) == 0);
     cpu->reg_P = set_bit(cpu->reg_P, stat_OVERFLOW, get_bit(value, 6));
     cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(value, 7));
 }
 
 void op_bmi(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (get_bit(cpu->reg_P, stat_NEGATIVE)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
 void op_bne(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (!get_bit(cpu->reg_P, stat_ZERO)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
 void op_bpl(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (!get_bit(cpu->reg_P, stat_NEGATIVE)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
@@ -405,7 +489,7 @@ void op_brk(CPU_t* cpu, AddrMode mode) {
 
     uint8_t upper_PC = cpu->reg_PC >> 8;
     uint8_t lower_PC = cpu->reg_PC;
-    uint8_t status = cpu->reg_P | 0b0011000; // Set bits 4 and 5
+    uint8_t status = cpu->reg_P | 0b00110000; // Set bits 4 and 5
     cpu_stack_push(cpu, upper_PC);
     cpu_stack_push(cpu, lower_PC);
     cpu_stack_push(cpu, status);
@@ -415,16 +499,20 @@ void op_brk(CPU_t* cpu, AddrMode mode) {
 }
 
 void op_bvc(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (!get_bit(cpu->reg_P, stat_OVERFLOW)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
 void op_bvs(CPU_t* cpu, AddrMode mode) {
+    uint16_t address = cpu_address_from_mode(cpu, mode, true);
+
     if (get_bit(cpu->reg_P, stat_OVERFLOW)) {
         cpu_tick(cpu);
-        cpu->reg_PC = cpu_address_from_mode(cpu, mode, true);
+        cpu->reg_PC = address;
     }
 }
 
@@ -441,6 +529,7 @@ void op_cld(CPU_t* cpu, AddrMode mode) {
 void op_cli(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu->reg_P = set_bit(cpu->reg_P, stat_INT, false);
+    cpu->poll = true;
 }
 
 void op_clv(CPU_t* cpu, AddrMode mode) {
@@ -591,7 +680,7 @@ void op_lsr(CPU_t* cpu, AddrMode mode) {
 }
 
 void op_ora(CPU_t* cpu, AddrMode mode) {
-    uint8_t value = *cpu_get_op_target(cpu, mode, false);
+    uint8_t value = *cpu_get_op_target(cpu, mode, true);
     cpu->reg_A = cpu->reg_A | value;
 
     cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
@@ -609,12 +698,13 @@ void op_php(CPU_t* cpu, AddrMode mode) {
 void op_pla(CPU_t* cpu, AddrMode mode) {
     cpu->reg_A = cpu_stack_pull(cpu);
 
-    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_P, 7));
-    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_P == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_A, 7));
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
 }
 
 void op_plp(CPU_t* cpu, AddrMode mode) {
     cpu->reg_P = cpu_stack_pull(cpu) & 0b11001111;
+    cpu->poll = true;
 }
 
 void op_rol(CPU_t* cpu, AddrMode mode) {
@@ -643,10 +733,11 @@ void op_rti(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu_tick(cpu);
 
-    cpu->reg_P = cpu_stack_pull(cpu);
+    cpu->reg_P = cpu_stack_pull(cpu) & 0b11001111;
     uint8_t PC_LOW = cpu_stack_pull(cpu);
     uint16_t PC_HIGH = cpu_stack_pull(cpu);
     cpu->reg_PC = (PC_HIGH << 8) | PC_LOW;
+    cpu->poll = true;
 }
 
 void op_rts(CPU_t* cpu, AddrMode mode) {
@@ -667,12 +758,13 @@ void op_sbc(CPU_t* cpu, AddrMode mode) {
     uint16_t result;
 
     result = cpu->reg_A - value - !get_bit(cpu->reg_P, stat_CARRY);
-    cpu->reg_A = result;
+    // The inputs had different signs and the result took the subtrahend's
     overflow = ((cpu->reg_A ^ result) & 0x80) && ((cpu->reg_A ^ value) & 0x80);
+    cpu->reg_A = result;
 
     cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
     cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_A, 7));
-    cpu->reg_P = set_bit(cpu->reg_P, stat_CARRY, result < 0x100);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_CARRY, result < 0x100); // No borrow
     cpu->reg_P = set_bit(cpu->reg_P, stat_OVERFLOW, overflow);
 }
 
@@ -713,32 +805,32 @@ void op_tax(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu->reg_X = cpu->reg_A;
 
-    cpu->reg_P = set_bit(cpu->reg_P, 7, cpu->reg_X == 0);
-    cpu->reg_P = set_bit(cpu->reg_P, 7, get_bit(cpu->reg_X, 7));
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_X == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_X, 7));
 }
 
 void op_tay(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu->reg_Y = cpu->reg_A;
 
-    cpu->reg_P = set_bit(cpu->reg_P, 7, cpu->reg_Y == 0);
-    cpu->reg_P = set_bit(cpu->reg_P, 7, get_bit(cpu->reg_Y, 7));
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_Y == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_Y, 7));
 }
 
 void op_tsx(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu->reg_X = cpu->reg_S;
 
-    cpu->reg_P = set_bit(cpu->reg_P, 7, cpu->reg_X == 0);
-    cpu->reg_P = set_bit(cpu->reg_P, 7, get_bit(cpu->reg_X, 7));
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_X == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_X, 7));
 }
 
 void op_txa(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu->reg_A = cpu->reg_X;
 
-    cpu->reg_P = set_bit(cpu->reg_P, 7, cpu->reg_A == 0);
-    cpu->reg_P = set_bit(cpu->reg_P, 7, get_bit(cpu->reg_A, 7));
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_A, 7));
 }
 
 void op_txs(CPU_t* cpu, AddrMode mode) {
@@ -750,11 +842,35 @@ void op_tya(CPU_t* cpu, AddrMode mode) {
     cpu_tick(cpu);
     cpu->reg_A = cpu->reg_Y;
 
-    cpu->reg_P = set_bit(cpu->reg_P, 7, cpu->reg_A == 0);
-    cpu->reg_P = set_bit(cpu->reg_P, 7, get_bit(cpu->reg_A, 7));
+    cpu->reg_P = set_bit(cpu->reg_P, stat_ZERO, cpu->reg_A == 0);
+    cpu->reg_P = set_bit(cpu->reg_P, stat_NEGATIVE, get_bit(cpu->reg_A, 7));
 }
 
 // Signal handlers
+// IRQ is level triggered, the line stays low until the handler acknowledges
+// whatever raised it
+void cpu_set_irq(CPU_t* cpu, uint8_t source, bool active) {
+    if (active)
+        cpu->irq_sources |= source;
+    else
+        cpu->irq_sources &= ~source;
+
+    cpu->sig_IRQ = cpu->irq_sources == 0;
+    cpu->poll |= active;
+}
+
+// Only called when something set `poll`: an event raising NMI or IRQ, or an
+// instruction that can clear the interrupt disable flag. An IRQ that's still
+// masked leaves `poll` clear and waits for the flag to come down.
+void cpu_poll(CPU_t* cpu) {
+    cpu->poll = false;
+
+    if (!cpu->sig_IRQ && !get_bit(cpu->reg_P, stat_INT))
+        cpu_irq(cpu);
+    if (!cpu->sig_NMI)
+        cpu_nmi(cpu);
+}
+
 void cpu_irq(CPU_t* cpu) {
     cpu_tick(cpu);
     cpu_tick(cpu);
@@ -768,7 +884,6 @@ void cpu_irq(CPU_t* cpu) {
 
     cpu->reg_PC = cpu_get_vector(cpu, BRK_VECTOR);
     cpu->reg_P = set_bit(cpu->reg_P, stat_INT, true);
-    cpu->sig_IRQ = true;
 }
 
 void cpu_nmi(CPU_t* cpu) {
@@ -795,9 +910,8 @@ void cpu_stack_push(CPU_t* cpu, uint8_t value) {
 
 uint8_t cpu_stack_pull(CPU_t* cpu) {
     cpu_tick(cpu);
-    uint8_t value = *cpu_map_read(cpu, STACK_OFFSET + cpu->reg_S);
     cpu->reg_S++;
-    return value;
+    return *cpu_map_read(cpu, STACK_OFFSET + cpu->reg_S);
 }
 
 // For multi-byte instructions
@@ -851,16 +965,21 @@ uint16_t cpu_address_from_mode(CPU_t* cpu, AddrMode mode, bool page_cross_cost)
         case INDIRECT:
             arg1 = *cpu_map_read(cpu, cpu->reg_PC++);
             arg2 = *cpu_map_read(cpu, cpu->reg_PC++);
-            indirect_addr = (((uint16_t) arg1) << 8) | arg2;
+            indirect_addr = (((uint16_t) arg2) << 8) | arg1;
             ind_arg1 = *cpu_map_read(cpu, indirect_addr);
-            ind_arg2 = *cpu_map_read(cpu, indirect_addr + 1);
+            // The high byte is fetched without carrying into the page
+            ind_arg2 = *cpu_map_read(cpu, (indirect_addr & 0xFF00) | (uint8_t) (arg1 + 1));
             return (((uint16_t) ind_arg2) << 8) | ind_arg1;
         case INDX_IND:
-            arg1 = *cpu_map_read(cpu, cpu->reg_PC++);
-            return *cpu_map_read(cpu, (uint8_t) (arg1 + cpu->reg_X)); // Wrap
+            arg1 = *cpu_map_read(cpu, cpu->reg_PC++) + cpu->reg_X;
+            ind_arg1 = *cpu_map_read(cpu, arg1);
+            ind_arg2 = *cpu_map_read(cpu, (uint8_t) (arg1 + 1)); // Wrap
+            return (((uint16_t) ind_arg2) << 8) | ind_arg1;
         case IND_INDX:
             arg1 = *cpu_map_read(cpu, cpu->reg_PC++);
-            return *cpu_map_read(cpu, arg1) + cpu->reg_Y;
+            ind_arg1 = *cpu_map_read(cpu, arg1);
+            ind_arg2 = *cpu_map_read(cpu, (uint8_t) (arg1 + 1)); // Wrap
+            return ((((uint16_t) ind_arg2) << 8) | ind_arg1) + cpu->reg_Y;
         default:
             return 0xBABE;
     }
@@ -876,7 +995,7 @@ uint8_t* cpu_map_read(CPU_t* cpu, uint16_t address) {
     // The 2KiB of system memory is mapped from $0000-$07FF, but it's also
     // mirrored to $0800-$1FFF 3 times
     if (address < 0x2000) {
-        return &cpu->memory[address % CPU_MEMORY_SIZE];
+        return &cpu->memory[address % (CPU_MEMORY_SIZE)];
     }
 
     // The PPU's 8 registers are mapped onto $2000-$2007, and mirrored through
@@ -897,7 +1016,12 @@ uint8_t* cpu_map_read(CPU_t* cpu, uint16_t address) {
     }
 
     // NES APU and I/O registers
-    if (address >= 0x4000 && address < 0x4017) {
+    if (address >= 0x4000 && address <= 0x4017) {
+        if (address == 0x4015)
+            return apu_read_status(cpu->apu);
+        if (address >= 0x4016)
+            return input_read(cpu->input, address - 0x4016);
+
         return &ZERO;
     }
 
@@ -912,7 +1036,7 @@ uint8_t* cpu_map_read(CPU_t* cpu, uint16_t address) {
     }
 
     // Cartridge
-    if (address >= 0x6000 && address < 0xFFFF) {
+    if (address >= 0x6000) {
         return rom_map_read(cpu->cartridge, address);
     }
 
@@ -922,7 +1046,9 @@ uint8_t* cpu_map_read(CPU_t* cpu, uint16_t address) {
 void cpu_write_back(CPU_t* cpu, uint8_t* address, uint8_t value) {
     // TODO: Make considerations for 0x2004 and 0x2007 ?
     cpu_tick(cpu);
-    if (address != &ZERO)
+
+    // RMW instructions on ROM only do a dummy write, it's mapped read-only
+    if (address != &ZERO && !rom_in_image(cpu->cartridge, address))
         *address = value;
 }
 
@@ -934,7 +1060,7 @@ void cpu_map_write(CPU_t* cpu, uint16_t address, uint8_t value) {
 #endif
 
     if (address < 0x2000) {
-        cpu->memory[address % CPU_MEMORY_SIZE] = value;
+        cpu->memory[address % (CPU_MEMORY_SIZE)] = value;
         return;
     }
 
@@ -944,9 +1070,14 @@ void cpu_map_write(CPU_t* cpu, uint16_t address, uint8_t value) {
         switch(address % 8) {
             case 0:
                 ppu->reg_PPUCTRL = value;
+                ppu_register_written(ppu);
+                ppu_schedule_nmi(ppu);
+                rom_ppu_changed(cpu->cartridge);
                 return;
             case 1:
                 ppu->reg_PPUMASK = value;
+                ppu_register_written(ppu);
+                rom_ppu_changed(cpu->cartridge);
                 return;
             case 3:
                 if (ppu->address_latch)
@@ -961,53 +1092,98 @@ void cpu_map_write(CPU_t* cpu, uint16_t address, uint8_t value) {
                 ppu_write_oam_from_reg(ppu);
                 return;
             case 5:
+                // First write is the X scroll, second write is the Y scroll
                 if (ppu->address_latch)
-                    ppu->reg_PPUSCROLL |= ((uint16_t) value) << 8;
+                    ppu->reg_PPUSCROLL = (ppu->reg_PPUSCROLL & 0x00FF) | (((uint16_t) value) << 8);
                 else
-                    ppu->reg_PPUSCROLL |= value;
+                    ppu->reg_PPUSCROLL = (ppu->reg_PPUSCROLL & 0xFF00) | value;
 
-                ppu->address_latch = true;
+                ppu->address_latch = !ppu->address_latch;
+                ppu_register_written(ppu);
                 return;
             case 6:
-                ppu->reg_PPUADDR = value;
+                // High byte first, then low byte
+                if (ppu->address_latch)
+                    ppu->reg_PPUADDR = (ppu->reg_PPUADDR & 0xFF00) | value;
+                else
+                    ppu->reg_PPUADDR = (((uint16_t) value & 0x3F) << 8) | (ppu->reg_PPUADDR & 0x00FF);
+
+                ppu->address_latch = !ppu->address_latch;
+                ppu_register_written(ppu);
                 return;
             case 7:
                 ppu->reg_PPUDATA = value;
                 ppu_memory_map_write_inc(ppu, ppu->reg_PPUADDR, ppu->reg_PPUDATA);
+                ppu_register_written(ppu);
                 return;
         }
     }
 
     // NES APU and I/O registers
-    if (address >= 0x4000 && address < 0x4017) {
+    if (address >= 0x4000 && address <= 0x4017) {
         switch(address) {
             case 0x4014:
                 cpu->ppu->reg_OAMDMA = value;
                 cpu_oam_transfer(cpu);
                 return;
+            case 0x4016:
+                input_write(cpu->input, value);
+                return;
+            default:
+                apu_write(cpu->apu, address, value);
+                return;
         }
     }
 
-    // Expansion RAM
-    if (address >= 0x4020 && address < 0x5FFF) {
+    // Expansion area, cartridge SRAM and mapper registers
+    if (address >= 0x4020) {
+        if (rom_map_write(cpu->cartridge, address, value))
+            ppu_map_rebuild(cpu->ppu);
         return;
     }
+}
 
-    // Cartridge SRAM
-    if (address >= 0x6000 && address < 0x7FFF) {
-        return;
+// Where an OAM DMA can copy its page straight from, or NULL when reading it
+// has side effects (or reads nothing) and it has to go through the bus
+static uint8_t* cpu_dma_source(CPU_t* cpu, uint8_t page) {
+    if (page < 0x20)
+        return &cpu->memory[(page << 8) % (CPU_MEMORY_SIZE)];
+
+    if (page >= 0x60) {
+        uint8_t* source = rom_map_read(cpu->cartridge, page << 8);
+        return source == &ZERO ? NULL : source;
     }
+
+    return NULL;
 }
 
 void cpu_oam_transfer(CPU_t* cpu) {
-    uint16_t base_address = 0x100 * cpu->ppu->reg_OAMDMA;
+    PPU_t* ppu = cpu->ppu;
+    uint16_t base_address = 0x100 * ppu->reg_OAMDMA;
+    uint8_t* source = cpu_dma_source(cpu, ppu->reg_OAMDMA);
+
+    // 256 reads and writes after one idle cycle, plus another when that
+    // lands on an odd cycle
+    uint16_t cycles = 513 + (cpu->cycle % 2 == 0);
+    cpu->oam_dma_end = cpu->cycle + cycles;
+
+    if (source != NULL) {
+        cpu_stall(cpu, cycles);
+
+        // OAMADDR goes all the way around and ends up where it started
+        uint16_t split = (OAM_SIZE) - ppu->reg_OAMADDR;
+        memcpy(&ppu->oam[ppu->reg_OAMADDR], source, split);
+        memcpy(ppu->oam, source + split, (OAM_SIZE) - split);
+        ppu->reg_OAMDATA = source[255];
+        return;
+    }
 
     // Idle ticks before transfer
     cpu_tick(cpu);
     if (cpu->cycle % 2 == 1)
         cpu_tick(cpu);
 
-    for (uint8_t i = 0; i < 256; ++i)
+    for (uint16_t i = 0; i < 256; ++i)
         cpu_map_write(cpu, 0x2004, *cpu_map_read(cpu, base_address + i));
 }
 
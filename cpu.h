@@ -3,12 +3,11 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <signal.h>
 #include "console.h"
 #include "rom.h"
 #include "ppu.h"
 
-#define DEBUG
-
 #define CPU_CLOCK    (MASTER_CLOCK) / 12.0
 #define STACK_OFFSET 0x0100
 
@@ -32,6 +31,13 @@ typedef enum {
     IND_INDX
 } AddrMode;
 
+// Anything that can pull the IRQ line low. It stays low until every source
+// has let go.
+enum IRQSources {
+    IRQ_APU    = 1 << 0,
+    IRQ_MAPPER = 1 << 1
+};
+
 enum CPUStatusBits {
     stat_NEGATIVE = 7,
     stat_OVERFLOW = 6,
@@ -43,15 +49,23 @@ enum CPUStatusBits {
     stat_CARRY    = 0
 };
 
-CPU_t* cpu_init(ROM_t* cartridge);
-void cpu_free(CPU_t* cpu);
+// Set from the ^C handler, every running console powers off at its next
+// instruction so the outputs get closed properly
+extern volatile sig_atomic_t cpu_stop_requested;
+
+void cpu_init(CPU_t* cpu, ROM_t* cartridge);
 
 void cpu_perform_next_op(CPU_t* cpu);
 void cpu_start(CPU_t* cpu);
 void cpu_tick(CPU_t* cpu);
+void cpu_stall(CPU_t* cpu, uint32_t cycles);
+void cpu_dmc_fetch(CPU_t* cpu, uint64_t cycle);
+void cpu_run_events(CPU_t* cpu);
 uint16_t cpu_get_vector(CPU_t* cpu, uint16_t vec_start);
 
 // Signal handlers
+void cpu_set_irq(CPU_t* cpu, uint8_t source, bool active);
+void cpu_poll(CPU_t* cpu);
 void cpu_irq(CPU_t* cpu);
 void cpu_nmi(CPU_t* cpu);
 
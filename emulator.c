@@ -4,16 +4,19 @@
 #include "emulator.h"
 #include "console.h"
 #include "cpu.h"
+#include "apu.h"
+#include "capture.h"
+#include "audio.h"
+#include "shmexport.h"
 #include "rom.h"
+#include "cheat.h"
+#include "input.h"
+#include "fiber.h"
 
-void system_bootstrap(ROM_t* cartridge) {
-    if (pthread_mutex_init(&clock_lock, NULL) != 0) {
-        fprintf(stderr, "Unable to create mutex lock\n");
-        return;
-    }
-
-    CPU_t* cpu = cpu_init(cartridge);
+pthread_t tids[NUM_THREADS];
 
+// Starts the CPU and PPU threads and waits for them to finish
+static void system_run_threads(CPU_t* cpu) {
     int cpuErr = pthread_create(&(tids[CPU_THREAD]), NULL, &cpu_thread, (void*) cpu);
     int ppuErr = pthread_create(&(tids[PPU_THREAD]), NULL, &ppu_thread, (void*) cpu->ppu);
 
@@ -34,14 +37,92 @@ void system_bootstrap(ROM_t* cartridge) {
 
     pthread_join(tids[CPU_THREAD], NULL);
     pthread_join(tids[PPU_THREAD], NULL);
+}
+
+void system_bootstrap(ROM_t* cartridge, EmulatorOptions_t* options) {
+    if (pthread_mutex_init(&clock_lock, NULL) != 0) {
+        fprintf(stderr, "Unable to create mutex lock\n");
+        return;
+    }
+
+    Pacer_t* pacer = NULL;
+    Capture_t* capture = NULL;
+    AudioOut_t* audio = NULL;
+    ShmExport_t* shm = NULL;
+    bool ok = true;
+
+    if (options->pace != PACE_UNTHROTTLED)
+        pacer = pacer_init(options->pace, options->sample_rate);
+
+    if (options->capture_path != NULL) {
+        capture = capture_open(options->capture_path, options->frameskip,
+            options->scale, options->scale_factor);
+        ok = capture != NULL;
+    }
+
+    if (ok && options->audio_path != NULL) {
+        audio = audio_open_wav(options->audio_path, options->sample_rate, pacer);
+        ok = audio != NULL;
+    }
+
+    if (ok && options->shm_name != NULL) {
+        shm = shmexport_open(options->shm_name, options->sample_rate);
+        ok = shm != NULL;
+    }
+
+    Console_t* console = NULL;
+    if (ok)
+        console = console_init(cartridge);
+
+    if (console != NULL) {
+        CPU_t* cpu = &console->cpu;
+        apu_set_sample_rate(cpu->apu, options->sample_rate);
+        cpu->apu->output = audio;
+        cpu->ppu->frameskip = options->frameskip;
+        cpu->ppu->capture = capture;
+        cpu->ppu->shm = shm;
+        cpu->ppu->pacer = pacer;
+
+        for (uint8_t i = 0; i < options->cheat_count; ++i)
+            cheat_add(cpu, options->cheats[i]);
+
+        // Tools reading the export can also play the game through it
+        cpu->input->device = options->input;
+        if (shm != NULL)
+            cpu->input->queue = &shm->region->input;
+
+        if (options->replay_path != NULL)
+            ok = input_replay(cpu->input, options->replay_path);
+        if (ok && options->record_path != NULL)
+            ok = input_record(cpu->input, options->record_path);
+
+        if (ok && options->threads)
+            system_run_threads(cpu);
+        else if (ok)
+            fiber_run(cpu);
+
+        input_close(cpu->input);
+        console_free(console);
+    }
+
     pthread_mutex_destroy(&clock_lock);
+
+    if (capture != NULL)
+        capture_close(capture);
+    if (audio != NULL)
+        audio_close(audio);
+    if (shm != NULL)
+        shmexport_close(shm);
+    if (pacer != NULL)
+        pacer_free(pacer);
 }
 
 void* cpu_thread(void* arg) {
     CPU_t* cpu = (CPU_t*) arg;
 
+    pthread_mutex_lock(&clock_lock);
     cpu_start(cpu);
-    cpu_free(cpu);
+    pthread_mutex_unlock(&clock_lock);
 
     return NULL;
 }
@@ -49,8 +130,9 @@ void* cpu_thread(void* arg) {
 void* ppu_thread(void* arg) {
     PPU_t* ppu = (PPU_t*) arg;
 
+    pthread_mutex_lock(&clock_lock);
     ppu_start(ppu);
-    ppu_free(ppu);
+    pthread_mutex_unlock(&clock_lock);
 
     return NULL;
 }
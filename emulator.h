@@ -1,8 +1,14 @@
 #ifndef EMULATOR_H__
 #define EMULATOR_H__
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <pthread.h>
 #include "rom.h"
+#include "scale.h"
+#include "pacing.h"
+#include "cheat.h"
+#include "input.h"
 
 enum ThreadNames {
   CPU_THREAD,
@@ -11,9 +17,26 @@ enum ThreadNames {
   NUM_THREADS
 };
 
-pthread_t tids[NUM_THREADS];
+typedef struct {
+    uint8_t frameskip;     // Render 1 of every N frames
+    char*   capture_path;  // Y4M output: file, "-" or "|command"
+    char*   audio_path;    // WAV output: file, "-" or "|command"
+    uint32_t sample_rate;  // Audio output rate in Hz
+    char*   shm_name;      // Shared memory export: /name or "memfd"
+    ScaleFilter scale;     // Upscaler applied to captured video
+    uint8_t scale_factor;  // Only used by SCALE_NEAREST
+    PaceMode pace;         // How emulation is throttled to real time
+    char*   cheats[CHEAT_MAX]; // Game Genie or raw codes
+    uint8_t cheat_count;
+    bool    threads;       // CPU and PPU on a thread each instead of fibers
+    InputDevice input;     // What's plugged into the controller ports
+    char*   replay_path;   // Input recorded with record_path
+    char*   record_path;
+} EmulatorOptions_t;
 
-void system_bootstrap(ROM_t* cartridge);
+extern pthread_t tids[NUM_THREADS];
+
+void system_bootstrap(ROM_t* cartridge, EmulatorOptions_t* options);
 
 void* cpu_thread(void* arg);
 void* ppu_thread(void* arg);
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include "fiber.h"
+#include "cpu.h"
+#include "ppu.h"
+
+// The fiber running on this thread, NULL when the CPU and PPU have a thread
+// each. NSF workers run headless and never yield, so they don't care.
+static __thread Fiber_t* fiber_current = NULL;
+static __thread Fiber_t  fiber_main;
+
+__thread bool fiber_in_cpu = false;
+
+static void fiber_cpu(void* arg);
+
+#ifdef __x86_64__
+// Saves the callee-saved registers on the current stack, stores the stack
+// pointer in `*save` and picks up wherever `load` left off. A new fiber's
+// stack is set up so it "returns" into fiber_entry().
+void fiber_switch(void** save, void* load);
+
+__asm__(
+    ".text\n"
+    ".globl fiber_switch\n"
+    ".type fiber_switch, @function\n"
+    "fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size fiber_switch, .-fiber_switch\n"
+);
+#endif
+
+static void fiber_swap(Fiber_t* from, Fiber_t* to) {
+    fiber_current = to;
+    fiber_in_cpu = to->body == &fiber_cpu;
+
+#ifdef __x86_64__
+    fiber_switch(&from->sp, to->sp);
+#else
+    swapcontext(&from->context, &to->context);
+#endif
+}
+
+// Whichever side finishes first ends the run, the other is just dropped
+static void fiber_entry(void) {
+    Fiber_t* fiber = fiber_current;
+
+    fiber->body(fiber->arg);
+    fiber_swap(fiber, &fiber_main);
+}
+
+static void fiber_init(Fiber_t* fiber, void (*body)(void* arg), void* arg) {
+    fiber->stack = (uint8_t*) malloc(FIBER_STACK_SIZE);
+    fiber->body = body;
+    fiber->arg = arg;
+
+#ifdef __x86_64__
+    // Six zeroed registers for fiber_switch() to pop, then fiber_entry() as
+    // the return address, leaving the stack aligned as if it had been called
+    uintptr_t top = ((uintptr_t) fiber->stack + (FIBER_STACK_SIZE)) & ~(uintptr_t) 15;
+    void** sp = (void**) top - 8;
+
+    for (int i = 0; i < 6; ++i)
+        sp[i] = NULL;
+    sp[6] = (void*) &fiber_entry;
+    sp[7] = NULL;
+    fiber->sp = sp;
+#else
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack;
+    fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+    fiber->context.uc_link = NULL;
+    makecontext(&fiber->context, &fiber_entry, 0);
+#endif
+}
+
+static void fiber_cpu(void* arg) {
+    cpu_start((CPU_t*) arg);
+}
+
+static void fiber_ppu(void* arg) {
+    ppu_start((PPU_t*) arg);
+}
+
+// Runs the CPU and PPU until the console is switched off
+void fiber_run(CPU_t* cpu) {
+    Fiber_t fibers[2];
+
+    fiber_init(&fibers[0], &fiber_cpu, cpu);
+    fiber_init(&fibers[1], &fiber_ppu, cpu->ppu);
+    fibers[0].next = &fibers[1];
+    fibers[1].next = &fibers[0];
+
+    fiber_swap(&fiber_main, &fibers[0]);
+    fiber_current = NULL;
+    fiber_in_cpu = false;
+
+    free(fibers[0].stack);
+    free(fibers[1].stack);
+}
+
+// Hands the clock over to the other side
+void fiber_yield(void) {
+    if (fiber_current == NULL) {
+        pthread_mutex_unlock(&clock_lock);
+        pthread_mutex_lock(&clock_lock);
+        return;
+    }
+
+    fiber_swap(fiber_current, fiber_current->next);
+}
@@ -0,0 +1,30 @@
+#ifndef FIBER_H__
+#define FIBER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ucontext.h>
+#include "console.h"
+
+#define FIBER_STACK_SIZE 1 << 20 // 1MiB, frame output and scaling run on the PPU's
+
+// The CPU and PPU hand the clock back and forth every few cycles. Run as
+// fibers on one thread that's a handful of register saves and a stack
+// switch, instead of a trip through the kernel's scheduler.
+typedef struct Fiber_t {
+    void*           sp;      // Saved stack pointer while switched out
+    ucontext_t      context; // Used instead of `sp` off x86-64
+    uint8_t*        stack;
+    void          (*body)(void* arg);
+    void*           arg;
+    struct Fiber_t* next;    // Who fiber_yield() hands over to
+} Fiber_t;
+
+// True while the CPU's fiber is running. The PPU only ever ticks on its own
+// fiber, from the CPU it would wait on a budget nobody is going to hand over.
+extern __thread bool fiber_in_cpu;
+
+void fiber_run(CPU_t* cpu);
+void fiber_yield(void);
+
+#endif
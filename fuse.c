@@ -0,0 +1,251 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "fuse.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "rom.h"
+
+// Opcodes the fused handlers look for
+#define OP_BPL      0x10
+#define OP_BEQ      0xF0
+#define OP_BNE      0xD0
+#define OP_INX      0xE8
+#define OP_DEX      0xCA
+#define OP_STA_ZP   0x85
+#define OP_STA_ABS  0x8D
+#define OP_STA_ABSX 0x9D
+
+// Cycles per pass of each loop, as cpu.c counts them
+#define COST_COUNT  5  // DEX, BNE
+#define COST_CLEAR  10 // STA abs,X, INX, BNE
+#define COST_COPY   14 // LDA abs,X, STA abs,X, INX, BNE
+#define COST_IDLE   6  // LDA zp, BEQ (one more for LDA abs)
+
+// Reads a byte without a bus cycle, or NULL when reading it has side effects
+static uint8_t* fuse_peek(CPU_t* cpu, uint16_t address) {
+    if (address < 0x2000)
+        return &cpu->memory[address % (CPU_MEMORY_SIZE)];
+
+    if (address >= 0x6000)
+        return rom_map_read(cpu->cartridge, address);
+
+    return NULL;
+}
+
+static bool fuse_code(CPU_t* cpu, uint16_t address, uint8_t* code, uint8_t length) {
+    for (uint8_t i = 0; i < length; ++i) {
+        uint8_t* byte = fuse_peek(cpu, address + i);
+
+        if (byte == NULL)
+            return false;
+
+        code[i] = *byte;
+    }
+
+    return true;
+}
+
+// Fetches the next opcode if it's `opcode`, exactly as cpu_start would have.
+// Not when an interrupt is waiting to be taken in between.
+static bool fuse_next(CPU_t* cpu, uint8_t opcode) {
+    uint8_t* next = fuse_peek(cpu, cpu->reg_PC);
+
+    if (cpu->poll || next == NULL || *next != opcode)
+        return false;
+
+    cpu_map_read(cpu, cpu->reg_PC++);
+    return true;
+}
+
+// How many passes of a `cost` cycle loop can go by before anything else
+// wants the clock. Skipping ahead hands the PPU a run of cycles in one go,
+// so not while it might pull the IRQ line itself or cheats rewrite RAM
+// behind the loop's back.
+static uint16_t fuse_room(CPU_t* cpu, uint8_t cost) {
+    if (cpu->poll || cpu->ppu->a12_watch || cpu->freeze_count > 0)
+        return 0;
+
+    if (cpu->sched.next <= cpu->cycle + cost)
+        return 0;
+
+    uint64_t room = (cpu->sched.next - cpu->cycle - 1) / cost;
+    return room > UINT16_MAX ? UINT16_MAX : room;
+}
+
+static uint16_t fuse_min(uint16_t a, uint16_t b) {
+    return a < b ? a : b;
+}
+
+// Taken branches left in a loop counting `index` by `step` until it hits 0
+static uint8_t fuse_passes(uint8_t index, int8_t step) {
+    return step > 0 ? (uint8_t) ~index : (uint8_t) (index - 1);
+}
+
+// `DEX; BNE` back onto the DEX. Everything but the last pass is skipped,
+// which leaves the CPU just after the DEX's opcode fetch again.
+static void fuse_count_loop(CPU_t* cpu, uint8_t* index) {
+    uint8_t code[2];
+
+    if (!fuse_code(cpu, cpu->reg_PC, code, 2) || code[0] != OP_BNE || code[1] != 0xFD)
+        return;
+
+    uint16_t passes = fuse_min(fuse_passes(*index, -1), fuse_room(cpu, COST_COUNT));
+    if (passes == 0)
+        return;
+
+    *index -= passes;
+    cpu_stall(cpu, passes * (COST_COUNT));
+}
+
+void fuse_dex(CPU_t* cpu) {
+    fuse_count_loop(cpu, &cpu->reg_X);
+    op_dex(cpu, IMPLICIT);
+
+    if (fuse_next(cpu, OP_BNE))
+        op_bne(cpu, RELATIVE);
+}
+
+void fuse_dey(CPU_t* cpu) {
+    fuse_count_loop(cpu, &cpu->reg_Y);
+    op_dey(cpu, IMPLICIT);
+
+    if (fuse_next(cpu, OP_BNE))
+        op_bne(cpu, RELATIVE);
+}
+
+// Block moves only ever write to RAM. Their loops have to run from the
+// cartridge, so they can't overwrite themselves.
+static bool fuse_ram_range(uint16_t base, uint8_t high) {
+    return (uint32_t) base + high < 0x2000;
+}
+
+// `STA abs,X; INX/DEX; BNE` back onto the STA, as used to clear memory
+static void fuse_clear_loop(CPU_t* cpu) {
+    uint8_t code[5];
+    uint16_t start = cpu->reg_PC - 1;
+
+    if (start < 0x6000 || !fuse_code(cpu, cpu->reg_PC, code, 5))
+        return;
+    if ((code[2] != OP_INX && code[2] != OP_DEX) || code[3] != OP_BNE || code[4] != 0xFA)
+        return;
+
+    int8_t step = code[2] == OP_INX ? 1 : -1;
+    uint16_t base = code[0] | (code[1] << 8);
+    uint16_t passes = fuse_min(fuse_passes(cpu->reg_X, step), fuse_room(cpu, COST_CLEAR));
+
+    if (passes == 0)
+        return;
+
+    uint8_t last = cpu->reg_X + step * (passes - 1);
+    if (!fuse_ram_range(base, step > 0 ? last : cpu->reg_X))
+        return;
+
+    for (uint16_t i = 0; i < passes; ++i) {
+        cpu->memory[(base + cpu->reg_X) % (CPU_MEMORY_SIZE)] = cpu->reg_A;
+        cpu->reg_X += step;
+    }
+
+    cpu_stall(cpu, passes * (COST_CLEAR));
+}
+
+// `LDA abs,X; STA abs,X; INX/DEX; BNE` back onto the LDA. The source can be
+// RAM or cartridge space, as long as none of it is I/O.
+static void fuse_copy_loop(CPU_t* cpu) {
+    uint8_t code[8];
+    uint16_t start = cpu->reg_PC - 1;
+
+    if (start < 0x6000 || !fuse_code(cpu, cpu->reg_PC, code, 8))
+        return;
+    if (code[2] != OP_STA_ABSX || (code[5] != OP_INX && code[5] != OP_DEX) ||
+        code[6] != OP_BNE || code[7] != 0xF7)
+        return;
+
+    int8_t step = code[5] == OP_INX ? 1 : -1;
+    uint16_t source = code[0] | (code[1] << 8);
+    uint16_t dest = code[3] | (code[4] << 8);
+    uint16_t passes = fuse_min(fuse_passes(cpu->reg_X, step), fuse_room(cpu, COST_COPY));
+
+    if (passes == 0)
+        return;
+
+    uint8_t last = cpu->reg_X + step * (passes - 1);
+    uint8_t low = step > 0 ? cpu->reg_X : last;
+    uint8_t high = step > 0 ? last : cpu->reg_X;
+
+    if (!fuse_ram_range(dest, high) || (uint32_t) source + high > 0xFFFF)
+        return;
+    if (source + high >= 0x2000 && source + low < 0x6000)
+        return;
+
+    for (uint16_t i = 0; i < passes; ++i) {
+        cpu->reg_A = *fuse_peek(cpu, source + cpu->reg_X);
+        cpu->memory[(dest + cpu->reg_X) % (CPU_MEMORY_SIZE)] = cpu->reg_A;
+        cpu->reg_X += step;
+    }
+
+    cpu_stall(cpu, passes * (COST_COPY));
+}
+
+// `LDA flag; BEQ/BNE` back onto the LDA, polling RAM for something only an
+// interrupt handler will change. Nothing happens until the next event.
+static void fuse_idle_loop(CPU_t* cpu, AddrMode mode) {
+    uint8_t code[4];
+    uint8_t length = mode == ZERO_PAGE ? 3 : 4;
+    uint8_t cost = (COST_IDLE) + (mode == ABSOLUTE);
+
+    if (!fuse_code(cpu, cpu->reg_PC, code, length))
+        return;
+
+    uint16_t address = mode == ZERO_PAGE ? code[0] : code[0] | (code[1] << 8);
+    uint8_t branch = code[length - 2];
+
+    if ((branch != OP_BEQ && branch != OP_BNE) || (int8_t) code[length - 1] != -(length + 1))
+        return;
+    if (address >= 0x2000)
+        return;
+
+    uint8_t value = cpu->memory[address % (CPU_MEMORY_SIZE)];
+    if ((value == 0) != (branch == OP_BEQ))
+        return;
+
+    uint16_t passes = fuse_room(cpu, cost);
+    if (passes > 0)
+        cpu_stall(cpu, passes * cost);
+}
+
+void fuse_lda(CPU_t* cpu, AddrMode mode) {
+    if (mode == ABSOLUTE_X)
+        fuse_copy_loop(cpu);
+    else if (mode == ZERO_PAGE || mode == ABSOLUTE)
+        fuse_idle_loop(cpu, mode);
+
+    op_lda(cpu, mode);
+
+    if (fuse_next(cpu, OP_STA_ZP))
+        op_sta(cpu, ZERO_PAGE);
+    else if (fuse_next(cpu, OP_STA_ABS))
+        op_sta(cpu, ABSOLUTE);
+    else if (fuse_next(cpu, OP_STA_ABSX))
+        op_sta(cpu, ABSOLUTE_X);
+}
+
+void fuse_sta_abs_x(CPU_t* cpu) {
+    fuse_clear_loop(cpu);
+    op_sta(cpu, ABSOLUTE_X);
+}
+
+void fuse_inc_zp(CPU_t* cpu) {
+    op_inc(cpu, ZERO_PAGE);
+
+    if (fuse_next(cpu, OP_BNE))
+        op_bne(cpu, RELATIVE);
+}
+
+// Usually `BIT $2002; BPL` waiting for vblank. The register read has side
+// effects, so this only saves the dispatch and keeps every bus cycle.
+void fuse_bit_abs(CPU_t* cpu) {
+    op_bit(cpu, ABSOLUTE);
+
+    if (fuse_next(cpu, OP_BPL))
+        op_bpl(cpu, RELATIVE);
+}
@@ -0,0 +1,20 @@
+#ifndef FUSE_H__
+#define FUSE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "console.h"
+#include "cpu.h"
+
+// Handlers for opcodes that usually start a common idiom. Each runs its own
+// instruction and then carries straight on into the next one when it's the
+// expected partner, without going back through dispatch. Loops that only
+// touch RAM or ROM are run in bulk, up to the next scheduled event.
+void fuse_dex(CPU_t* cpu);
+void fuse_dey(CPU_t* cpu);
+void fuse_lda(CPU_t* cpu, AddrMode mode);
+void fuse_sta_abs_x(CPU_t* cpu);
+void fuse_inc_zp(CPU_t* cpu);
+void fuse_bit_abs(CPU_t* cpu);
+
+#endif
@@ -0,0 +1,321 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASH_X86
+#endif
+#include "hash.h"
+
+#define CRC32_POLY      0xEDB88320 // Reflected 0x04C11DB7
+#define CRC32_FOLD_MIN  64         // Bytes the PCLMUL kernel needs to start
+#define SHA1_BLOCK_SIZE 64
+
+static uint32_t crc32_table[256];
+static bool has_pclmul = false;
+static bool has_sha = false;
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+
+static void hash_init() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32_POLY : 0);
+
+        crc32_table[i] = crc;
+    }
+
+#ifdef HASH_X86
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        has_pclmul = (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+        has_sha = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_SHA))
+        has_sha = false;
+#endif
+}
+
+const char* hash_kernels() {
+    pthread_once(&hash_once, &hash_init);
+
+    if (has_pclmul && has_sha)
+        return "pclmul, sha-ni";
+    if (has_pclmul)
+        return "pclmul";
+    if (has_sha)
+        return "sha-ni";
+
+    return "portable";
+}
+
+// CRC32
+
+// Works on the inverted running CRC
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        crc = (crc >> 8) ^ crc32_table[(crc ^ data[i]) & 0xFF];
+
+    return crc;
+}
+
+#ifdef HASH_X86
+// Folds 64 bytes at a time with carry-less multiplies, then reduces down to
+// 32 bits. Constants are from Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ", in the bit reflected domain. `size` has to be
+// at least 64 and a multiple of 16.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* data, size_t size) {
+    static const uint64_t k1k2[] __attribute__((aligned(16))) = {0x0154442bd4, 0x01c6e41596};
+    static const uint64_t k3k4[] __attribute__((aligned(16))) = {0x01751997d0, 0x00ccaa009e};
+    static const uint64_t k5k0[] __attribute__((aligned(16))) = {0x0163cd6124, 0x0000000000};
+    static const uint64_t poly[] __attribute__((aligned(16))) = {0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i*) k1k2);
+
+    data += 64;
+    size -= 64;
+
+    // Four lanes of 128 bits at once
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*) (data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*) (data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*) (data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*) (data + 0x30)));
+
+        data += 64;
+        size -= 64;
+    }
+
+    // Fold the lanes into one, then whatever 16 byte blocks are left
+    x0 = _mm_load_si128((const __m128i*) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (size >= 16) {
+        x2 = _mm_loadu_si128((const __m128i*) data);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*) k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32
+    x0 = _mm_load_si128((const __m128i*) poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+uint32_t hash_crc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    pthread_once(&hash_once, &hash_init);
+
+#ifdef HASH_X86
+    if (has_pclmul && size >= CRC32_FOLD_MIN) {
+        size_t folded = size & ~((size_t) 15);
+
+        crc = crc32_pclmul(crc, data, folded);
+        data += folded;
+        size -= folded;
+    }
+#endif
+
+    return ~crc32_bytes(crc, data, size);
+}
+
+// SHA-1
+
+static uint32_t sha1_rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_blocks_portable(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    for (; blocks > 0; --blocks, data += SHA1_BLOCK_SIZE) {
+        uint32_t w[80];
+
+        for (int i = 0; i < 16; ++i)
+            w[i] = ((uint32_t) data[i * 4] << 24) | ((uint32_t) data[i * 4 + 1] << 16) |
+                   ((uint32_t) data[i * 4 + 2] << 8) | data[i * 4 + 3];
+        for (int i = 16; i < 80; ++i)
+            w[i] = sha1_rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            uint32_t t = sha1_rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = sha1_rotl(b, 30);
+            b = a;
+            a = t;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef HASH_X86
+// The round function has to be an immediate
+#define SHA1_RNDS4(abcd, e, f) \
+    ((f) == 0 ? _mm_sha1rnds4_epu32(abcd, e, 0) : \
+     (f) == 1 ? _mm_sha1rnds4_epu32(abcd, e, 1) : \
+     (f) == 2 ? _mm_sha1rnds4_epu32(abcd, e, 2) : \
+                _mm_sha1rnds4_epu32(abcd, e, 3))
+
+// Four rounds per step. Step i works on message block m[i % 4] while the
+// message schedule for the steps after it is computed.
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha1_blocks_shani(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    const __m128i byteswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    for (; blocks > 0; --blocks, data += SHA1_BLOCK_SIZE) {
+        __m128i abcd_save = abcd;
+        __m128i e_save = e0;
+        __m128i m[4];
+        __m128i e[2] = {e0, e0};
+
+        for (int i = 0; i < 4; ++i)
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + i * 16)), byteswap);
+
+        for (int i = 0; i < 20; ++i) {
+            __m128i next = i == 0 ? _mm_add_epi32(e[0], m[0])
+                                  : _mm_sha1nexte_epu32(e[i % 2], m[i % 4]);
+
+            e[(i + 1) % 2] = abcd;
+            abcd = SHA1_RNDS4(abcd, next, i / 5);
+
+            if (i >= 3 && i <= 18)
+                m[(i + 1) % 4] = _mm_sha1msg2_epu32(m[(i + 1) % 4], m[i % 4]);
+            if (i >= 2 && i <= 17)
+                m[(i + 2) % 4] = _mm_xor_si128(m[(i + 2) % 4], m[i % 4]);
+            if (i >= 1 && i <= 16)
+                m[(i + 3) % 4] = _mm_sha1msg1_epu32(m[(i + 3) % 4], m[i % 4]);
+        }
+
+        e0 = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+static void sha1_blocks(uint32_t state[5], const uint8_t* data, size_t blocks) {
+#ifdef HASH_X86
+    if (has_sha) {
+        sha1_blocks_shani(state, data, blocks);
+        return;
+    }
+#endif
+
+    sha1_blocks_portable(state, data, blocks);
+}
+
+void hash_sha1(const uint8_t* data, size_t size, uint8_t digest[SHA1_SIZE]) {
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t tail[SHA1_BLOCK_SIZE * 2] = {0};
+    size_t whole = size / SHA1_BLOCK_SIZE;
+    size_t left = size % SHA1_BLOCK_SIZE;
+
+    pthread_once(&hash_once, &hash_init);
+    sha1_blocks(state, data, whole);
+
+    // Padding: a 1 bit, zeros, then the length in bits, big endian
+    memcpy(tail, data + whole * SHA1_BLOCK_SIZE, left);
+    tail[left] = 0x80;
+
+    size_t tail_size = left + 9 <= SHA1_BLOCK_SIZE ? SHA1_BLOCK_SIZE : SHA1_BLOCK_SIZE * 2;
+    uint64_t bits = (uint64_t) size * 8;
+
+    for (int i = 0; i < 8; ++i)
+        tail[tail_size - 1 - i] = bits >> (i * 8);
+
+    sha1_blocks(state, tail, tail_size / SHA1_BLOCK_SIZE);
+
+    for (int i = 0; i < 5; ++i) {
+        digest[i * 4 + 0] = state[i] >> 24;
+        digest[i * 4 + 1] = state[i] >> 16;
+        digest[i * 4 + 2] = state[i] >> 8;
+        digest[i * 4 + 3] = state[i];
+    }
+}
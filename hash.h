@@ -0,0 +1,15 @@
+#ifndef HASH_H__
+#define HASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA1_SIZE 20
+
+// Checksums for identifying ROM dumps. Both pick a PCLMUL/SHA-NI kernel at
+// runtime when the CPU has one, and are safe to call from any thread.
+uint32_t hash_crc32(const uint8_t* data, size_t size);
+void hash_sha1(const uint8_t* data, size_t size, uint8_t digest[SHA1_SIZE]);
+const char* hash_kernels();
+
+#endif
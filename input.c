@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "input.h"
+#include "console.h"
+#include "pallette.h"
+
+// The Four Score answers its third byte with a signature, a single bit that
+// comes up on the 20th read of $4016 and the 19th of $4017
+static const uint8_t FOUR_SCORE_SIGNATURE[2] = {1 << 3, 1 << 2};
+
+static const char* INPUT_DEVICE_NAMES[] = {"standard", "fourscore", "zapper"};
+
+void input_init(Input_t* input) {
+    input->device = INPUT_STANDARD;
+    input->strobe = false;
+    input->shift[0] = input->shift[1] = UINT32_MAX;
+    input->queue = &input->own_queue;
+    input->replay = NULL;
+    input->record = NULL;
+    input->pending = false;
+}
+
+bool input_parse(char* name, InputDevice* device) {
+    for (uint8_t i = 0; i < sizeof(INPUT_DEVICE_NAMES) / sizeof(INPUT_DEVICE_NAMES[0]); ++i) {
+        if (strcmp(name, INPUT_DEVICE_NAMES[i]) == 0) {
+            *device = (InputDevice) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Recordings are one event per line: cycle, type, pad, buttons (hex) and the
+// Zapper's x and y
+static bool input_read_event(FILE* file, InputEvent_t* event) {
+    uint64_t cycle;
+    unsigned int type, pad, buttons, x, y;
+
+    if (fscanf(file, "%" SCNu64 " %u %u %x %u %u", &cycle, &type, &pad, &buttons, &x, &y) != 6)
+        return false;
+
+    event->cycle = cycle;
+    event->type = type;
+    event->pad = pad;
+    event->buttons = buttons;
+    event->x = x;
+    event->y = y;
+
+    return true;
+}
+
+bool input_replay(Input_t* input, char* path) {
+    input->replay = fopen(path, "r");
+
+    if (input->replay == NULL) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return false;
+    }
+
+    input->pending = input_read_event(input->replay, &input->next);
+    return true;
+}
+
+bool input_record(Input_t* input, char* path) {
+    input->record = fopen(path, "w");
+
+    if (input->record == NULL) {
+        fprintf(stderr, "Error: Could not create %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+void input_close(Input_t* input) {
+    if (input->replay != NULL)
+        fclose(input->replay);
+    if (input->record != NULL)
+        fclose(input->record);
+
+    input->replay = NULL;
+    input->record = NULL;
+}
+
+static void input_apply(Input_t* input, InputEvent_t* event) {
+    if (event->type == INPUT_EVENT_PAD) {
+        input->pads[event->pad % INPUT_PADS] = event->buttons;
+    } else if (event->type == INPUT_EVENT_ZAPPER) {
+        input->zapper_x = event->x;
+        input->zapper_y = event->y;
+        input->zapper_trigger = event->buttons != 0;
+    }
+
+    if (input->record != NULL) {
+        fprintf(input->record, "%" PRIu64 " %u %u %02x %u %u\n", input->cpu->cycle,
+            event->type, event->pad, event->buttons, event->x, event->y);
+    }
+}
+
+// Brings the host state up to the current cycle. Only called on strobes, so
+// the game sees exactly what was pressed at the moment it asked.
+static void input_poll(Input_t* input) {
+    uint64_t cycle = input->cpu->cycle;
+
+    while (input->pending && input->next.cycle <= cycle) {
+        input_apply(input, &input->next);
+        input->pending = input_read_event(input->replay, &input->next);
+    }
+
+    InputQueue_t* queue = input->queue;
+    uint64_t tail = queue->tail;
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    for (; tail != head; ++tail) {
+        InputEvent_t* event = &queue->events[tail % INPUT_QUEUE_SIZE];
+
+        if (event->cycle > cycle)
+            break;
+
+        input_apply(input, event);
+    }
+
+    __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void input_latch(Input_t* input) {
+    uint8_t* pads = input->pads;
+
+    switch (input->device) {
+        case INPUT_STANDARD:
+            input->shift[0] = 0xFFFFFF00 | pads[0];
+            input->shift[1] = 0xFFFFFF00 | pads[1];
+            break;
+        case INPUT_FOUR_SCORE:
+            for (uint8_t port = 0; port < 2; ++port) {
+                input->shift[port] = 0xFF000000 | (FOUR_SCORE_SIGNATURE[port] << 16) |
+                    (pads[port + 2] << 8) | pads[port];
+            }
+            break;
+        case INPUT_ZAPPER:
+            input->shift[0] = 0xFFFFFF00 | pads[0];
+            break;
+    }
+}
+
+// The photodiode only sees the CRT for a little while after the beam has
+// drawn the spot the Zapper points at
+static bool input_zapper_light(Input_t* input) {
+    PPU_t* ppu = input->ppu;
+    int16_t y = input->zapper_y;
+    int16_t x = input->zapper_x;
+
+    if (!ppu->render_frame || y >= FRAME_HEIGHT)
+        return false;
+
+    bool passed = ppu->scanline > y || (ppu->scanline == y && ppu->scanline_cycle > x);
+    if (!passed || ppu->scanline >= y + (ZAPPER_LIGHT_LINES))
+        return false;
+
+    // A few pixels around the aim, it's not a very precise sensor
+    for (int16_t row = y - 1; row <= y + 1; ++row) {
+        for (int16_t col = x - 1; col <= x + 1; ++col) {
+            if (row < 0 || row >= ppu->scanline || col < 0 || col >= FRAME_WIDTH)
+                continue;
+
+            uint32_t rgb = pallette_xrgb8888[ppu->framebuffer[row][col]];
+            uint16_t sum = ((rgb >> 16) & 0xFF) + ((rgb >> 8) & 0xFF) + (rgb & 0xFF);
+
+            if (sum >= 3 * (ZAPPER_BRIGHTNESS))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// $4016 bit 0 is the strobe. While it's high the pads keep reloading, and
+// they hold whatever was latched when it drops.
+void input_write(Input_t* input, uint8_t value) {
+    bool strobe = value & 1;
+
+    if (strobe || input->strobe) {
+        input_poll(input);
+        input_latch(input);
+    }
+
+    input->strobe = strobe;
+}
+
+uint8_t* input_read(Input_t* input, uint8_t port) {
+    uint8_t value = INPUT_OPEN_BUS;
+
+    if (input->device == INPUT_ZAPPER && port == 1) {
+        value |= (!input_zapper_light(input)) << 3;
+        value |= input->zapper_trigger << 4;
+    } else {
+        if (input->strobe)
+            input_latch(input);
+
+        value |= input->shift[port] & 1;
+        input->shift[port] = (input->shift[port] >> 1) | 0x80000000;
+    }
+
+    input->ports[port] = value;
+    return &input->ports[port];
+}
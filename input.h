@@ -0,0 +1,110 @@
+#ifndef INPUT_H__
+#define INPUT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define INPUT_PADS          4   // Four with the Four Score plugged in
+#define INPUT_QUEUE_SIZE    256 // Events, has to be a power of two
+#define INPUT_OPEN_BUS      0x40 // Upper bits of $4016/$4017, left over from the address
+#define ZAPPER_LIGHT_LINES  20  // How long the photodiode stays lit after the beam passes
+#define ZAPPER_BRIGHTNESS   0xC0 // Average of R, G and B that counts as light
+
+enum InputButtons {
+    BUTTON_A      = 1 << 0,
+    BUTTON_B      = 1 << 1,
+    BUTTON_SELECT = 1 << 2,
+    BUTTON_START  = 1 << 3,
+    BUTTON_UP     = 1 << 4,
+    BUTTON_DOWN   = 1 << 5,
+    BUTTON_LEFT   = 1 << 6,
+    BUTTON_RIGHT  = 1 << 7
+};
+
+// What's plugged into the two ports
+typedef enum {
+    INPUT_STANDARD,   // A pad in each port
+    INPUT_FOUR_SCORE, // Pads 1 and 3 on $4016, 2 and 4 on $4017
+    INPUT_ZAPPER      // A pad on $4016, the Zapper on $4017
+} InputDevice;
+
+enum InputEventTypes {
+    INPUT_EVENT_PAD,    // `pad` now holds `buttons`
+    INPUT_EVENT_ZAPPER  // Aimed at x, y with the trigger in `buttons`
+};
+
+// A change of host input. It's applied the first time the game strobes the
+// pads at or after `cycle`, so 0 means "as soon as possible" and anything
+// recorded with input_record() plays back on the exact same strobe.
+typedef struct {
+    uint64_t cycle;
+    uint8_t  type;
+    uint8_t  pad;
+    uint8_t  buttons;
+    uint8_t  x;
+    uint8_t  y;
+} InputEvent_t;
+
+// Single producer, single consumer ring. The host side only ever writes
+// `head`, the emulator only ever writes `tail`, so neither needs a lock.
+// Also lives in the shared memory export for tools driving the emulator.
+typedef struct {
+    uint64_t     head __attribute__((aligned(64)));
+    uint64_t     tail __attribute__((aligned(64)));
+    InputEvent_t events[INPUT_QUEUE_SIZE] __attribute__((aligned(64)));
+} InputQueue_t;
+
+typedef struct Input_t {
+    InputDevice device;
+    bool        strobe;
+
+    // HOST STATE
+    // As of the last strobe, the game never sees anything newer
+    uint8_t pads[INPUT_PADS];
+    uint8_t zapper_x;
+    uint8_t zapper_y;
+    bool    zapper_trigger;
+
+    // SHIFT REGISTERS
+    uint32_t shift[2];  // Next bit to read at the bottom, ones shifted in above
+    uint8_t  ports[2];  // Last value read from $4016/$4017
+
+    // SOURCES
+    InputQueue_t* queue;   // Live input, see input_push()
+    FILE*         replay;  // Recorded events, applied ahead of the queue
+    InputEvent_t  next;    // Next event from `replay`
+    bool          pending; // Whether `next` is waiting for its cycle
+    FILE*         record;  // Everything applied, with the cycle it landed on
+
+    // OTHER HARDWARE
+    struct CPU_t* cpu;
+    struct PPU_t* ppu;     // Where the Zapper looks for light
+
+    InputQueue_t own_queue;
+} Input_t;
+
+void input_init(Input_t* input);
+bool input_parse(char* name, InputDevice* device);
+bool input_replay(Input_t* input, char* path);
+bool input_record(Input_t* input, char* path);
+void input_close(Input_t* input);
+
+void input_write(Input_t* input, uint8_t value);
+uint8_t* input_read(Input_t* input, uint8_t port);
+
+// Producer side, safe from any one thread or process at a time. False when
+// the ring is full and the event was dropped.
+static inline bool input_push(InputQueue_t* queue, InputEvent_t event) {
+    uint64_t head = queue->head;
+
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == INPUT_QUEUE_SIZE)
+        return false;
+
+    queue->events[head % INPUT_QUEUE_SIZE] = event;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "library.h"
+#include "rom.h"
+#include "mapper.h"
+#include "util.h"
+
+#define LIBRARY_FD_LIMIT 64 // Directories nftw() may hold open at once
+
+// A file found by the scan, waiting for its entry to be filled in
+typedef struct {
+    char*          path; // Relative to the scanned directory
+    char*          name;
+    uint64_t       mtime;
+    uint64_t       size;
+    bool           hashed;
+    LibraryEntry_t entry;
+} LibraryScan_t;
+
+// Shared between the index workers, each one takes the next file in line
+typedef struct {
+    char*          dir;
+    Library_t*     old;
+    LibraryScan_t* files;
+    size_t         count;
+    size_t         next;
+} LibraryQueue_t;
+
+// nftw() has no way to pass state to its callback
+static LibraryScan_t* scan_files = NULL;
+static size_t scan_count = 0;
+static size_t scan_capacity = 0;
+static size_t scan_root = 0;
+
+Library_t* library_open(char* path) {
+    struct stat info;
+    int index_file = open(path, O_RDONLY);
+
+    if (index_file < 0)
+        return NULL;
+
+    if (fstat(index_file, &info) != 0 || info.st_size < (off_t) sizeof(LibraryHeader_t)) {
+        close(index_file);
+        return NULL;
+    }
+
+    uint8_t* map = (uint8_t*) mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, index_file, 0);
+    close(index_file);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    LibraryHeader_t* header = (LibraryHeader_t*) map;
+    size_t expected = sizeof(LibraryHeader_t) +
+        (size_t) header->count * sizeof(LibraryEntry_t) + header->strings_size;
+
+    // Anything that doesn't line up is treated like there was no index
+    if (memcmp(header->magic, LIBRARY_MAGIC, 4) != 0 ||
+        header->version != LIBRARY_VERSION ||
+        expected != (size_t) info.st_size ||
+        header->strings_size == 0 ||
+        map[info.st_size - 1] != '\0') {
+        munmap(map, info.st_size);
+        return NULL;
+    }
+
+    Library_t* library = (Library_t*) malloc(sizeof(Library_t));
+    library->map = map;
+    library->map_size = info.st_size;
+    library->header = header;
+    library->entries = (LibraryEntry_t*) (map + sizeof(LibraryHeader_t));
+    library->strings = (const char*) (library->entries + header->count);
+
+    return library;
+}
+
+void library_close(Library_t* library) {
+    munmap(library->map, library->map_size);
+    free(library);
+}
+
+const char* library_string(Library_t* library, uint32_t offset) {
+    if (offset >= library->header->strings_size)
+        return "";
+
+    return &library->strings[offset];
+}
+
+// Binary search, entries are sorted by path
+const LibraryEntry_t* library_find(Library_t* library, const char* path) {
+    size_t low = 0;
+    size_t high = library->header->count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = strcmp(path, library_string(library, library->entries[mid].path));
+
+        if (order == 0)
+            return &library->entries[mid];
+
+        if (order < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return NULL;
+}
+
+static int library_scan_file(const char* path, const struct stat* info, int type, struct FTW* ftw) {
+    const char* extension = strrchr(path + ftw->base, '.');
+
+    if (type != FTW_F || !S_ISREG(info->st_mode) ||
+        extension == NULL || strcasecmp(extension, ".nes") != 0)
+        return 0;
+
+    if (scan_count == scan_capacity) {
+        scan_capacity = scan_capacity == 0 ? 1024 : scan_capacity * 2;
+        scan_files = (LibraryScan_t*) realloc(scan_files, scan_capacity * sizeof(LibraryScan_t));
+    }
+
+    LibraryScan_t* file = &scan_files[scan_count++];
+    memset(file, 0, sizeof(LibraryScan_t));
+
+    file->path = strdup(path + scan_root);
+    file->name = strndup(path + ftw->base, extension - (path + ftw->base));
+    file->mtime = (uint64_t) info->st_mtim.tv_sec * 1000000000 + info->st_mtim.tv_nsec;
+    file->size = info->st_size;
+
+    return 0;
+}
+
+static int library_scan_order(const void* a, const void* b) {
+    return strcmp(((const LibraryScan_t*) a)->path, ((const LibraryScan_t*) b)->path);
+}
+
+// Reads the header the same way rom_from_file() does and hashes PRG+CHR
+// straight out of the page cache
+static void library_hash(char* dir, LibraryScan_t* file) {
+    char path[PATH_MAX];
+    LibraryEntry_t* entry = &file->entry;
+
+    file->hashed = true;
+    snprintf(path, sizeof(path), "%s/%s", dir, file->path);
+
+    int rom_file = open(path, O_RDONLY);
+    if (rom_file < 0)
+        return;
+
+    uint8_t* image = NULL;
+    if (file->size >= (HEADER_SIZE))
+        image = (uint8_t*) mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, rom_file, 0);
+    close(rom_file);
+
+    if (image == NULL || image == MAP_FAILED)
+        return;
+
+    if (memcmp(image, "NES\x1A", 4) != 0) {
+        munmap(image, file->size);
+        return;
+    }
+
+    ROM_t rom = {0};
+    rom.prg_page_count = image[4];
+    rom.chr_page_count = image[5];
+    rom.flags6 = image[6];
+    rom.flags7 = image[7];
+
+    // Old dumping tools signed the unused end of the header, which garbles
+    // the upper mapper bits
+    if (!rom_nes2(&rom)) {
+        for (int i = LIBRARY_DIRTY_TAG; i < (HEADER_SIZE); ++i) {
+            if (image[i] != 0) {
+                rom.flags7 = 0;
+                entry->flags |= LIB_FIXED;
+                break;
+            }
+        }
+    }
+
+    entry->prg_page_count = rom.prg_page_count;
+    entry->chr_page_count = rom.chr_page_count;
+    entry->flags6 = rom.flags6;
+    entry->flags7 = rom.flags7;
+    entry->mapper = rom_mapper(&rom);
+
+    if (rom_nes2(&rom))
+        entry->flags |= LIB_NES2;
+    if (mapper_find(entry->mapper) != NULL)
+        entry->flags |= LIB_MAPPED;
+
+    if (rom_file_valid(&rom, file->size)) {
+        size_t offset = (HEADER_SIZE) + (get_bit(rom.flags6, TRAINER) ? (TRAINER_SIZE) : 0);
+        size_t size = rom.prg_page_count * (PRG_PAGE_SIZE) + rom.chr_page_count * (CHR_PAGE_SIZE);
+
+        madvise(image, file->size, MADV_SEQUENTIAL);
+        entry->crc32 = hash_crc32(image + offset, size);
+        hash_sha1(image + offset, size, entry->sha1);
+        entry->flags |= LIB_VALID;
+    }
+
+    munmap(image, file->size);
+}
+
+static void* library_worker(void* arg) {
+    LibraryQueue_t* queue = (LibraryQueue_t*) arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) < queue->count) {
+        LibraryScan_t* file = &queue->files[i];
+        const LibraryEntry_t* known = queue->old == NULL ? NULL : library_find(queue->old, file->path);
+
+        // Unchanged since the last run, the old entry still holds
+        if (known != NULL && known->mtime == file->mtime && known->size == file->size) {
+            file->entry = *known;
+            continue;
+        }
+
+        library_hash(queue->dir, file);
+    }
+
+    return NULL;
+}
+
+static uint32_t library_add_string(char** strings, uint32_t* size, uint32_t* capacity, const char* string) {
+    uint32_t offset = *size;
+    uint32_t length = strlen(string) + 1;
+
+    while (*size + length > *capacity) {
+        *capacity = *capacity == 0 ? 1 << 16 : *capacity * 2;
+        *strings = (char*) realloc(*strings, *capacity);
+    }
+
+    memcpy(*strings + offset, string, length);
+    *size += length;
+
+    return offset;
+}
+
+// Writes the index next to the old one and swaps it in, so anybody with the
+// old file mapped keeps a consistent view
+static bool library_write(char* dir, LibraryScan_t* files, size_t count) {
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    char* strings = NULL;
+    uint32_t strings_size = 0;
+    uint32_t strings_capacity = 0;
+    bool ok = true;
+
+    // A cut off temp name would get renamed over the wrong file
+    if (snprintf(path, sizeof(path), "%s/%s", dir, LIBRARY_FILE) >= (int) sizeof(path) ||
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int) sizeof(temp_path)) {
+        fprintf(stderr, "Error: %s is too long a path for the index\n", dir);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        files[i].entry.mtime = files[i].mtime;
+        files[i].entry.size = files[i].size;
+        files[i].entry.path = library_add_string(&strings, &strings_size, &strings_capacity, files[i].path);
+        files[i].entry.name = library_add_string(&strings, &strings_size, &strings_capacity, files[i].name);
+    }
+
+    // Keeps the string table from ever being empty
+    if (count == 0)
+        library_add_string(&strings, &strings_size, &strings_capacity, "");
+
+    LibraryHeader_t header = {
+        .version      = LIBRARY_VERSION,
+        .count        = count,
+        .strings_size = strings_size
+    };
+    memcpy(header.magic, LIBRARY_MAGIC, 4);
+
+    FILE* index_file = fopen(temp_path, "wb");
+    if (index_file == NULL) {
+        fprintf(stderr, "Error: Could not write %s\n", temp_path);
+        free(strings);
+        return false;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, index_file) == 1;
+    for (size_t i = 0; ok && i < count; ++i)
+        ok = fwrite(&files[i].entry, sizeof(LibraryEntry_t), 1, index_file) == 1;
+    ok = ok && fwrite(strings, strings_size, 1, index_file) == 1;
+    ok = fclose(index_file) == 0 && ok;
+
+    if (ok)
+        ok = rename(temp_path, path) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "Error: Could not write %s\n", path);
+        unlink(temp_path);
+    }
+
+    free(strings);
+    return ok;
+}
+
+// `nts index DIR`: finds every .nes file under `dir` and records its header
+// details and hashes in DIR/.nts-index. Files whose size and mtime haven't
+// changed since the last run are taken from the old index without being read.
+bool library_index(char* root, uint8_t jobs) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    pthread_t workers[UINT8_MAX];
+    uint8_t started = 0;
+    size_t hashed = 0;
+
+    // Paths in the index are relative to here
+    snprintf(dir, sizeof(dir), "%s", root);
+    for (size_t end = strlen(dir); end > 1 && dir[end - 1] == '/'; --end)
+        dir[end - 1] = '\0';
+
+    scan_files = NULL;
+    scan_count = 0;
+    scan_capacity = 0;
+    scan_root = strlen(dir) + 1;
+
+    if (nftw(dir, &library_scan_file, LIBRARY_FD_LIMIT, FTW_PHYS) != 0) {
+        fprintf(stderr, "Error: Could not scan %s\n", dir);
+        return false;
+    }
+
+    qsort(scan_files, scan_count, sizeof(LibraryScan_t), &library_scan_order);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, LIBRARY_FILE);
+    LibraryQueue_t queue = {
+        .dir   = dir,
+        .old   = library_open(path),
+        .files = scan_files,
+        .count = scan_count,
+        .next  = 0
+    };
+
+    for (uint8_t i = 0; i < jobs && i < scan_count; ++i) {
+        if (pthread_create(&workers[started], NULL, &library_worker, &queue) == 0)
+            started++;
+    }
+
+    // Fall back to indexing everything on this thread
+    if (started == 0)
+        library_worker(&queue);
+
+    for (uint8_t i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    if (queue.old != NULL)
+        library_close(queue.old);
+
+    for (size_t i = 0; i < scan_count; ++i) {
+        LibraryEntry_t* entry = &scan_files[i].entry;
+        const Mapper_t* mapper = mapper_find(entry->mapper);
+
+        hashed += scan_files[i].hashed;
+
+        if (!(entry->flags & LIB_VALID)) {
+            fprintf(stderr, "Warning: %s is not a valid ROM\n", scan_files[i].path);
+            continue;
+        }
+
+        printf("%08x  ", entry->crc32);
+        for (int j = 0; j < (SHA1_SIZE); ++j)
+            printf("%02x", entry->sha1[j]);
+        printf("  %3d %-6s%s  %s\n", entry->mapper, mapper != NULL ? mapper->name : "-",
+            entry->flags & LIB_FIXED ? "*" : " ", scan_files[i].path);
+    }
+
+    bool ok = library_write(dir, scan_files, scan_count);
+
+    fprintf(stderr, "Indexed %zu ROMs, %zu read and %zu unchanged (%s)\n",
+        scan_count, hashed, scan_count - hashed, hash_kernels());
+
+    for (size_t i = 0; i < scan_count; ++i) {
+        free(scan_files[i].path);
+        free(scan_files[i].name);
+    }
+    free(scan_files);
+    scan_files = NULL;
+
+    return ok;
+}
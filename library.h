@@ -0,0 +1,62 @@
+#ifndef LIBRARY_H__
+#define LIBRARY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "hash.h"
+
+#define LIBRARY_MAGIC     "NTSI"
+#define LIBRARY_VERSION   1
+#define LIBRARY_FILE      ".nts-index" // Kept at the top of the scanned tree
+#define LIBRARY_DIRTY_TAG 12           // Header bytes 12-15 are zero in clean iNES 1.0 dumps
+
+enum LibraryFlags {
+    LIB_VALID   = 1 << 0, // Header passed rom_file_valid()
+    LIB_NES2    = 1 << 1,
+    LIB_MAPPED  = 1 << 2, // The mapper is emulated
+    LIB_FIXED   = 1 << 3  // Junk in the header ("DiskDude!"), flags7 was cleared
+};
+
+// The index file is a LibraryHeader_t, `count` entries sorted by path and
+// then the string table. Everything is fixed size and offset based so the
+// file can be mapped and searched in place.
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t strings_size;
+} LibraryHeader_t;
+
+typedef struct {
+    uint64_t mtime;          // Nanoseconds, with size used to spot changed files
+    uint64_t size;
+    uint32_t path;           // String table offset, relative to the scanned directory
+    uint32_t name;           // String table offset
+    uint32_t crc32;          // Of PRG+CHR, which is how dumps are catalogued
+    uint8_t  sha1[SHA1_SIZE];
+    uint16_t mapper;
+    uint8_t  prg_page_count;
+    uint8_t  chr_page_count;
+    uint8_t  flags6;
+    uint8_t  flags7;         // After any header fix
+    uint8_t  flags;          // LibraryFlags
+    uint8_t  reserved[9];    // Pads entries out to 64 bytes
+} LibraryEntry_t;
+
+typedef struct {
+    uint8_t*         map;
+    size_t           map_size;
+    LibraryHeader_t* header;
+    LibraryEntry_t*  entries;
+    const char*      strings;
+} Library_t;
+
+Library_t* library_open(char* path);
+void library_close(Library_t* library);
+const LibraryEntry_t* library_find(Library_t* library, const char* path);
+const char* library_string(Library_t* library, uint32_t offset);
+
+bool library_index(char* dir, uint8_t jobs);
+
+#endif
@@ -1,40 +1,277 @@
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include "emulator.h"
+#include "pallette.h"
+#include "scale.h"
+#include "apu.h"
 #include "rom.h"
+#include "nsf.h"
+#include "library.h"
+#include "input.h"
+#include "cpu.h"
 
 void INThandler(int sig);
 void print_help();
+int render_nsf(char* path, EmulatorOptions_t* options, NSFRender_t* render);
+
+static struct option long_options[] = {
+    {"palette",   required_argument, NULL, 'p'},
+    {"frameskip", required_argument, NULL, 'f'},
+    {"capture",   required_argument, NULL, 'c'},
+    {"audio",     required_argument, NULL, 'a'},
+    {"shm",       required_argument, NULL, 's'},
+    {"scale",     required_argument, NULL, 'x'},
+    {"pace",      required_argument, NULL, 'r'},
+    {"rate",      required_argument, NULL, 'R'},
+    {"track",     required_argument, NULL, 't'},
+    {"length",    required_argument, NULL, 'l'},
+    {"jobs",      required_argument, NULL, 'j'},
+    {"cheat",     required_argument, NULL, 'g'},
+    {"threads",   no_argument,       NULL, 'T'},
+    {"input",     required_argument, NULL, 'i'},
+    {"replay",    required_argument, NULL, 'P'},
+    {"record",    required_argument, NULL, 'w'},
+    {NULL, 0, NULL, 0}
+};
 
 int main(int argc, char* argv[]) {
     signal(SIGINT, INThandler);
+    pallette_init();
+
+    EmulatorOptions_t options = {
+        .frameskip    = 1,
+        .capture_path = NULL,
+        .audio_path   = NULL,
+        .sample_rate  = AUDIO_SAMPLE_RATE,
+        .shm_name     = NULL,
+        .scale        = SCALE_NEAREST,
+        .scale_factor = 1,
+        .pace         = PACE_REALTIME,
+        .cheat_count  = 0,
+        .threads      = false,
+        .input        = INPUT_STANDARD,
+        .replay_path  = NULL,
+        .record_path  = NULL
+    };
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    NSFRender_t render = {
+        .track  = 0,
+        .length = 120,
+        .jobs   = cores < 1 ? 1 : cores > UINT8_MAX ? UINT8_MAX : cores
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:f:c:a:s:x:r:R:t:l:j:g:Ti:P:w:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                if (!pallette_load_file(optarg))
+                    return 1;
+                break;
+            case 'f': {
+                long frameskip = strtol(optarg, NULL, 10);
+                if (frameskip < 1 || frameskip > UINT8_MAX) {
+                    fprintf(stderr, "Error: frameskip must be between 1 and 255\n");
+                    return 1;
+                }
+                options.frameskip = frameskip;
+                break;
+            }
+            case 'c':
+                options.capture_path = optarg;
+                break;
+            case 'a':
+                options.audio_path = optarg;
+                break;
+            case 's':
+                options.shm_name = optarg;
+                break;
+            case 'x':
+                if (!scale_parse(optarg, &options.scale, &options.scale_factor)) {
+                    fprintf(stderr, "Error: unknown scaler %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                if (!pace_parse(optarg, &options.pace)) {
+                    fprintf(stderr, "Error: pacing must be realtime, audio or off\n");
+                    return 1;
+                }
+                break;
+            case 'R':
+                options.sample_rate = atoi(optarg);
+                if (options.sample_rate < 8000 || options.sample_rate > 192000) {
+                    fprintf(stderr, "Error: sample rate must be between 8000 and 192000\n");
+                    return 1;
+                }
+                break;
+            case 't': {
+                long track = strtol(optarg, NULL, 10);
+                if (track < 1 || track > UINT8_MAX) {
+                    fprintf(stderr, "Error: track must be between 1 and 255\n");
+                    return 1;
+                }
+                render.track = track;
+                break;
+            }
+            case 'l': {
+                long length = strtol(optarg, NULL, 10);
+                if (length < 1 || length > NSF_MAX_LENGTH) {
+                    fprintf(stderr, "Error: length must be between 1 and %d seconds\n", NSF_MAX_LENGTH);
+                    return 1;
+                }
+                render.length = length;
+                break;
+            }
+            case 'j': {
+                long jobs = strtol(optarg, NULL, 10);
+                if (jobs < 1 || jobs > UINT8_MAX) {
+                    fprintf(stderr, "Error: jobs must be between 1 and 255\n");
+                    return 1;
+                }
+                render.jobs = jobs;
+                break;
+            }
+            case 'g':
+                if (options.cheat_count == CHEAT_MAX) {
+                    fprintf(stderr, "Error: at most %d cheats\n", CHEAT_MAX);
+                    return 1;
+                }
+                options.cheats[options.cheat_count++] = optarg;
+                break;
+            case 'T':
+                options.threads = true;
+                break;
+            case 'i':
+                if (!input_parse(optarg, &options.input)) {
+                    fprintf(stderr, "Error: input must be standard, fourscore or zapper\n");
+                    return 1;
+                }
+                break;
+            case 'P':
+                options.replay_path = optarg;
+                break;
+            case 'w':
+                options.record_path = optarg;
+                break;
+            default:
+                print_help();
+                return 1;
+        }
+    }
 
-    if (argc <= 1) {
+    if (optind >= argc) {
         print_help();
         return 1;
     }
 
-    printf("Reading in %s\n", argv[1]);
-    ROM_t* rom = rom_from_file(argv[1]);
+    // nts index DIR
+    if (strcmp(argv[optind], "index") == 0 && optind + 1 < argc)
+        return library_index(argv[optind + 1], render.jobs) ? 0 : 1;
+
+    char* rom_path = argv[optind];
+
+    // Music rips only need the CPU and APU
+    if (nsf_probe(rom_path))
+        return render_nsf(rom_path, &options, &render);
+
+    printf("Reading in %s\n", rom_path);
+    ROM_t* rom = rom_from_file(rom_path);
 
     if (rom == NULL) {
         fprintf(stderr, "Could not read ROM file\n");
         return 1;
     }
 
-    system_bootstrap(rom);
+    system_bootstrap(rom, &options);
     rom_free(rom);
 
     return 0;
 }
 
+int render_nsf(char* path, EmulatorOptions_t* options, NSFRender_t* render) {
+    if (options->audio_path == NULL) {
+        fprintf(stderr, "Error: NSF files are rendered to WAV, pass --audio\n");
+        return 1;
+    }
+
+    NSF_t* nsf = nsf_from_file(path);
+
+    if (nsf == NULL) {
+        fprintf(stderr, "Could not read NSF file\n");
+        return 1;
+    }
+
+    nsf_print_details(nsf);
+
+    if (render->track > nsf->total_songs) {
+        fprintf(stderr, "Error: track must be between 1 and %d\n", nsf->total_songs);
+        nsf_free(nsf);
+        return 1;
+    }
+
+    char first[PATH_MAX];
+    if (!nsf_track_path(first, sizeof(first), options->audio_path, 1)) {
+        fprintf(stderr, "Error: the audio path may only have one %%d or %%0Nd in it\n");
+        nsf_free(nsf);
+        return 1;
+    }
+
+    if ((render->track == 0 && nsf->total_songs > 1) && strchr(options->audio_path, '%') == NULL) {
+        fprintf(stderr, "Error: use %%d in the audio path to render every track\n");
+        nsf_free(nsf);
+        return 1;
+    }
+
+    render->sample_rate = options->sample_rate;
+    render->audio_path = options->audio_path;
+
+    bool ok = nsf_render(nsf, render);
+    nsf_free(nsf);
+
+    return ok ? 0 : 1;
+}
+
+// Only asks the consoles to power off, so the normal teardown still drains
+// the capture, patches the WAV header and writes back battery RAM. A second
+// ^C kills it outright.
 void INThandler(int sig) {
-    signal(sig, SIG_IGN);
-    printf("Recieved ^C, shutting down\n");
-    exit(0);
+    static const char message[] = "Recieved ^C, shutting down\n";
+
+    signal(sig, SIG_DFL);
+    cpu_stop_requested = 1;
+    write(STDOUT_FILENO, message, sizeof(message) - 1);
 }
 
 void print_help() {
-    fprintf(stderr, "Syntax: nts rompath\n");
+    fprintf(stderr, "Syntax: nts [options] rompath\n");
+    fprintf(stderr, "        nts [-j N] index DIR\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-p, --palette FILE\tLoad a 64 or 512 colour .pal file\n");
+    fprintf(stderr, "\t-f, --frameskip N\tOnly draw 1 of every N frames\n");
+    fprintf(stderr, "\t-c, --capture OUT\tRecord video as Y4M to a file, - or |command\n");
+    fprintf(stderr, "\t-a, --audio OUT\t\tRecord audio as WAV to a file, - or |command\n");
+    fprintf(stderr, "\t-s, --shm NAME\t\tExport frames to shared memory /NAME or memfd\n");
+    fprintf(stderr, "\t-x, --scale FILTER\tUpscale captured video: nearestN, scale2x, scale3x, xbr2x\n");
+    fprintf(stderr, "\t-r, --pace MODE\t\tThrottle to realtime (default), audio or off\n");
+    fprintf(stderr, "\t-R, --rate HZ\t\tAudio sample rate, 48000 by default\n");
+    fprintf(stderr, "\t-g, --cheat CODE\tGame Genie or AAAA[?CC]:VV code, may be repeated\n");
+    fprintf(stderr, "\t-T, --threads\t\tRun the CPU and PPU on a thread each, much slower\n");
+    fprintf(stderr, "\t-i, --input DEVICE\tstandard (default), fourscore or zapper\n");
+    fprintf(stderr, "\t-P, --replay FILE\tPlay back input recorded with --record\n");
+    fprintf(stderr, "\t-w, --record FILE\tRecord input with the cycle each change was read\n");
+    fprintf(stderr, "NSF rendering:\n");
+    fprintf(stderr, "\t-t, --track N\t\tOnly render track N, every track by default\n");
+    fprintf(stderr, "\t-l, --length SECONDS\tLength of each track, 120 by default\n");
+    fprintf(stderr, "\t-j, --jobs N\t\tTracks rendered at once, one per core by default\n");
+    fprintf(stderr, "\t--audio is required and may contain %%d or %%0Nd for the track\n");
+    fprintf(stderr, "ROM library:\n");
+    fprintf(stderr, "\tindex DIR\t\tHash every .nes file under DIR into DIR/%s,\n", LIBRARY_FILE);
+    fprintf(stderr, "\t\t\t\tonly reading files that changed since the last run.\n");
+    fprintf(stderr, "\t\t\t\t-j sets how many files are read at once\n");
 }
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include "mapper.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "util.h"
+
+static const Mapper_t* MAPPERS[] = {
+    &MAPPER_NROM,
+    &MAPPER_MMC1,
+    &MAPPER_UXROM,
+    &MAPPER_CNROM,
+    &MAPPER_MMC3,
+    &MAPPER_AXROM
+};
+
+const Mapper_t* mapper_find(uint16_t number) {
+    for (size_t i = 0; i < sizeof(MAPPERS) / sizeof(MAPPERS[0]); ++i) {
+        if (MAPPERS[i]->number == number)
+            return MAPPERS[i];
+    }
+
+    return NULL;
+}
+
+// Offsets wrap around the data, so small ROMs are mirrored into big windows
+static void mapper_switch(uint8_t** windows, uint8_t* data, uint32_t data_size,
+                          uint32_t window_size, uint8_t window, uint32_t size, int32_t bank) {
+    if (bank < 0)
+        bank += data_size / size > 0 ? data_size / size : 1;
+
+    uint32_t offset = (uint32_t) bank * size;
+
+    for (uint32_t i = 0; i < size / window_size; ++i)
+        windows[window + i] = &data[(offset + i * window_size) % data_size];
+}
+
+void mapper_prg(ROM_t* rom, uint8_t window, uint32_t size, int32_t bank) {
+    mapper_switch(rom->prg_banks, rom->prg_data, rom->prg_size, PRG_WINDOW_SIZE,
+                  window, size, bank);
+    rom_refresh_prg(rom, window, size / (PRG_WINDOW_SIZE));
+}
+
+void mapper_chr(ROM_t* rom, uint8_t window, uint32_t size, int32_t bank) {
+    mapper_switch(rom->chr_banks, rom->chr_data, rom->chr_size, CHR_WINDOW_SIZE,
+                  window, size, bank);
+}
+
+// NROM (0): no bank switching at all
+
+static void nrom_reset(ROM_t* rom) {
+    mapper_prg(rom, 0, 1 << 15, 0); // NROM-128 mirrors its 16KiB
+    mapper_chr(rom, 0, 1 << 13, 0);
+}
+
+const Mapper_t MAPPER_NROM = {
+    .number = 0,
+    .name   = "NROM",
+    .reset  = &nrom_reset
+};
+
+// MMC1 (1): registers are loaded one bit at a time through a shift register
+
+static void mmc1_apply(ROM_t* rom) {
+    MMC1_t* mmc1 = &rom->state.mmc1;
+
+    static const Mirroring MIRRORING[4] = {
+        MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL
+    };
+    rom->mirroring = MIRRORING[mmc1->control & 0x03];
+
+    // SUROM and friends use a CHR bit to pick which 256KiB of PRG is visible
+    uint8_t outer = rom->prg_size > (1 << 18) ? mmc1->chr0 & 0x10 : 0;
+
+    switch ((mmc1->control >> 2) & 0x03) {
+        case 0:
+        case 1:
+            mapper_prg(rom, 0, 1 << 15, (outer | (mmc1->prg & 0x0E)) >> 1);
+            break;
+        case 2:
+            mapper_prg(rom, 0, 1 << 14, outer);
+            mapper_prg(rom, 4, 1 << 14, outer | (mmc1->prg & 0x0F));
+            break;
+        case 3:
+            mapper_prg(rom, 0, 1 << 14, outer | (mmc1->prg & 0x0F));
+            mapper_prg(rom, 4, 1 << 14, outer | 0x0F);
+            break;
+    }
+
+    if (mmc1->control & 0x10) {
+        mapper_chr(rom, 0, 1 << 12, mmc1->chr0);
+        mapper_chr(rom, 4, 1 << 12, mmc1->chr1);
+    } else {
+        mapper_chr(rom, 0, 1 << 13, mmc1->chr0 >> 1);
+    }
+}
+
+static void mmc1_reset(ROM_t* rom) {
+    rom->state.mmc1 = (MMC1_t) {.control = 0x0C};
+    mmc1_apply(rom);
+}
+
+static bool mmc1_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    MMC1_t* mmc1 = &rom->state.mmc1;
+
+    if (address < 0x8000)
+        return false;
+
+    if (value & 0x80) {
+        mmc1->shift = 0;
+        mmc1->count = 0;
+        mmc1->control |= 0x0C;
+        mmc1_apply(rom);
+        return false;
+    }
+
+    mmc1->shift |= (value & 1) << mmc1->count;
+    if (++mmc1->count < 5)
+        return false;
+
+    switch ((address >> 13) & 0x03) {
+        case 0: mmc1->control = mmc1->shift; break;
+        case 1: mmc1->chr0 = mmc1->shift;    break;
+        case 2: mmc1->chr1 = mmc1->shift;    break;
+        case 3: mmc1->prg = mmc1->shift;     break;
+    }
+
+    mmc1->shift = 0;
+    mmc1->count = 0;
+    mmc1_apply(rom);
+
+    return true;
+}
+
+const Mapper_t MAPPER_MMC1 = {
+    .number = 1,
+    .name   = "MMC1",
+    .reset  = &mmc1_reset,
+    .write  = &mmc1_write
+};
+
+// UxROM (2): 16KiB switchable at $8000, last bank fixed at $C000
+
+static void uxrom_reset(ROM_t* rom) {
+    mapper_prg(rom, 0, 1 << 14, 0);
+    mapper_prg(rom, 4, 1 << 14, -1);
+    mapper_chr(rom, 0, 1 << 13, 0);
+}
+
+static bool uxrom_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    if (address >= 0x8000)
+        mapper_prg(rom, 0, 1 << 14, value);
+
+    return false;
+}
+
+const Mapper_t MAPPER_UXROM = {
+    .number = 2,
+    .name   = "UxROM",
+    .reset  = &uxrom_reset,
+    .write  = &uxrom_write
+};
+
+// CNROM (3): fixed PRG, 8KiB switchable CHR
+
+static bool cnrom_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    if (address < 0x8000)
+        return false;
+
+    mapper_chr(rom, 0, 1 << 13, value);
+    return true;
+}
+
+const Mapper_t MAPPER_CNROM = {
+    .number = 3,
+    .name   = "CNROM",
+    .reset  = &nrom_reset,
+    .write  = &cnrom_write
+};
+
+// MMC3 (4): 8KiB PRG and 1-2KiB CHR banks through eight bank registers
+
+static void mmc3_apply(ROM_t* rom) {
+    MMC3_t* mmc3 = &rom->state.mmc3;
+
+    // Bit 6 swaps which of $8000 and $C000 is fixed to the second last bank
+    uint8_t swap = mmc3->select & 0x40 ? 4 : 0;
+    mapper_prg(rom, swap, 1 << 13, mmc3->regs[6] & 0x3F);
+    mapper_prg(rom, 2, 1 << 13, mmc3->regs[7] & 0x3F);
+    mapper_prg(rom, 4 - swap, 1 << 13, -2);
+    mapper_prg(rom, 6, 1 << 13, -1);
+
+    // Bit 7 swaps the 2KiB and 1KiB halves of CHR
+    uint8_t invert = mmc3->select & 0x80 ? 4 : 0;
+    mapper_chr(rom, invert + 0, 1 << 11, mmc3->regs[0] >> 1);
+    mapper_chr(rom, invert + 2, 1 << 11, mmc3->regs[1] >> 1);
+    for (uint8_t i = 0; i < 4; ++i)
+        mapper_chr(rom, (4 - invert) + i, 1 << 10, mmc3->regs[2 + i]);
+}
+
+// The IRQ counter is clocked by A12 rising on the PPU bus. With 8x8 sprites
+// and the background and sprites on different pattern tables that happens
+// once per rendered line at a fixed dot, so the counter is only brought up to
+// date when something could change it, and the IRQ is posted as an event for
+// the cycle it fires on. 8x16 sprites pick their table per sprite, and with
+// both on the same table there's no single rise to predict, so for those the
+// PPU reports every rise instead.
+
+static bool mmc3_irq_predictable(PPU_t* ppu) {
+    bool bg = ppu_base_patterntable(ppu) != 0;
+    bool sprites = get_bit(ppu->reg_PPUCTRL, ctrl_SPRITETABLE);
+
+    return !get_bit(ppu->reg_PPUCTRL, ctrl_SPRITESIZE) && bg != sprites;
+}
+
+static uint16_t mmc3_irq_dot(PPU_t* ppu) {
+    if (!ppu_rendering_enabled(ppu))
+        return 0;
+
+    return get_bit(ppu->reg_PPUCTRL, ctrl_SPRITETABLE) ? A12_SPRITE_DOT : A12_BG_DOT;
+}
+
+static void mmc3_raise(ROM_t* rom) {
+    rom->state.mmc3.irq_pending = true;
+    cpu_set_irq(rom->cpu, IRQ_MAPPER, true);
+}
+
+// Clocks until the counter next hits 0
+static uint16_t mmc3_clocks_left(MMC3_t* mmc3) {
+    if (mmc3->irq_counter == 0 || mmc3->irq_reload)
+        return mmc3->irq_latch + 1;
+
+    return mmc3->irq_counter;
+}
+
+static void mmc3_advance(MMC3_t* mmc3, uint64_t clocks) {
+    if (clocks == 0)
+        return;
+
+    if (mmc3->irq_counter == 0 || mmc3->irq_reload) {
+        mmc3->irq_counter = mmc3->irq_latch;
+        mmc3->irq_reload = false;
+        clocks--;
+    }
+
+    if (clocks <= mmc3->irq_counter) {
+        mmc3->irq_counter -= clocks;
+        return;
+    }
+
+    // Down to 0, then round and round from the latch
+    clocks -= mmc3->irq_counter + 1;
+    mmc3->irq_counter = mmc3->irq_latch - clocks % (mmc3->irq_latch + 1);
+}
+
+// Runs the counter up to wherever the PPU is now
+static void mmc3_sync(ROM_t* rom) {
+    MMC3_t* mmc3 = &rom->state.mmc3;
+    PPU_t* ppu = rom->cpu->ppu;
+
+    if (!mmc3->irq_tracking && mmc3->irq_dot != 0) {
+        int64_t clocks = ppu_dot_count(ppu, mmc3->irq_dot, ppu->cycle) -
+                         ppu_dot_count(ppu, mmc3->irq_dot, mmc3->irq_synced);
+
+        if (clocks > 0) {
+            bool fired = mmc3->irq_enabled && clocks >= mmc3_clocks_left(mmc3);
+
+            mmc3_advance(mmc3, clocks);
+            if (fired)
+                mmc3_raise(rom);
+        }
+    }
+
+    mmc3->irq_synced = ppu->cycle;
+}
+
+// Works out when the IRQ will fire, or hands the job to the PPU
+static void mmc3_schedule(ROM_t* rom) {
+    MMC3_t* mmc3 = &rom->state.mmc3;
+    CPU_t* cpu = rom->cpu;
+    PPU_t* ppu = cpu->ppu;
+
+    mmc3->irq_tracking = ppu_rendering_enabled(ppu) && !mmc3_irq_predictable(ppu);
+    mmc3->irq_dot = mmc3->irq_tracking ? 0 : mmc3_irq_dot(ppu);
+    ppu->a12_watch = mmc3->irq_tracking;
+    rom_schedule(rom, SCHED_NEVER);
+
+    if (mmc3->irq_dot == 0 || !mmc3->irq_enabled || mmc3->irq_pending)
+        return;
+
+    int64_t n = ppu_dot_count(ppu, mmc3->irq_dot, ppu->cycle) + mmc3_clocks_left(mmc3);
+    uint64_t fire = ppu_dot_cycle(ppu, mmc3->irq_dot, n);
+
+    // If the PPU turns out to be a little behind by then, the event just
+    // runs again on the next cycle
+    rom_schedule(rom, cpu->cycle + (fire - ppu->cycle + 2) / 3);
+}
+
+static void mmc3_ppu_changed(ROM_t* rom) {
+    mmc3_sync(rom);
+    mmc3_schedule(rom);
+}
+
+static void mmc3_a12_rise(ROM_t* rom) {
+    MMC3_t* mmc3 = &rom->state.mmc3;
+
+    if (mmc3->irq_counter == 0 || mmc3->irq_reload) {
+        mmc3->irq_counter = mmc3->irq_latch;
+        mmc3->irq_reload = false;
+    } else {
+        mmc3->irq_counter--;
+    }
+
+    if (mmc3->irq_counter == 0 && mmc3->irq_enabled)
+        mmc3_raise(rom);
+}
+
+static void mmc3_reset(ROM_t* rom) {
+    rom->state.mmc3 = (MMC3_t) {.regs = {0, 2, 4, 5, 6, 7, 0, 1}};
+    rom_schedule(rom, SCHED_NEVER);
+    mmc3_apply(rom);
+}
+
+static bool mmc3_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    MMC3_t* mmc3 = &rom->state.mmc3;
+    bool odd = address & 1;
+
+    if (address < 0x8000)
+        return false;
+
+    switch (address & 0xE000) {
+        case 0x8000:
+            if (odd)
+                mmc3->regs[mmc3->select & 0x07] = value;
+            else
+                mmc3->select = value;
+
+            mmc3_apply(rom);
+            return true;
+        case 0xA000:
+            // Odd writes protect PRG RAM, which nothing relies on
+            if (odd || rom->mirroring == MIRROR_FOUR)
+                return false;
+
+            rom->mirroring = value & 1 ? MIRROR_HORIZONTAL : MIRROR_VERTICAL;
+            return true;
+    }
+
+    // Everything from here on touches the IRQ, so the counter has to be
+    // current before anything changes
+    mmc3_sync(rom);
+
+    if ((address & 0xE000) == 0xC000) {
+        if (odd)
+            mmc3->irq_reload = true;
+        else
+            mmc3->irq_latch = value;
+    } else {
+        // Disabling also acknowledges
+        mmc3->irq_enabled = odd;
+        if (!odd) {
+            mmc3->irq_pending = false;
+            cpu_set_irq(rom->cpu, IRQ_MAPPER, false);
+        }
+    }
+
+    mmc3_schedule(rom);
+    return false;
+}
+
+const Mapper_t MAPPER_MMC3 = {
+    .number      = 4,
+    .name        = "MMC3",
+    .reset       = &mmc3_reset,
+    .write       = &mmc3_write,
+    .ppu_changed = &mmc3_ppu_changed,
+    .event       = &mmc3_ppu_changed,
+    .a12_rise    = &mmc3_a12_rise
+};
+
+// AxROM (7): 32KiB PRG banks and single screen mirroring
+
+static void axrom_reset(ROM_t* rom) {
+    mapper_prg(rom, 0, 1 << 15, 0);
+    mapper_chr(rom, 0, 1 << 13, 0);
+    rom->mirroring = MIRROR_SINGLE_LOW;
+}
+
+static bool axrom_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    if (address < 0x8000)
+        return false;
+
+    mapper_prg(rom, 0, 1 << 15, value & 0x07);
+    rom->mirroring = value & 0x10 ? MIRROR_SINGLE_HIGH : MIRROR_SINGLE_LOW;
+    return true;
+}
+
+const Mapper_t MAPPER_AXROM = {
+    .number = 7,
+    .name   = "AxROM",
+    .reset  = &axrom_reset,
+    .write  = &axrom_write
+};
+
+// NSF players swap 4KiB banks in through $5FF8-$5FFF. The initial banks come
+// from the NSF header, so there is nothing to reset.
+
+static bool nsf_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    if (address >= 0x5FF8 && address <= 0x5FFF)
+        mapper_prg(rom, address - 0x5FF8, PRG_WINDOW_SIZE, value);
+
+    return false;
+}
+
+const Mapper_t MAPPER_NSF = {
+    .number = 0xFFFF,
+    .name   = "NSF",
+    .write  = &nsf_write
+};
@@ -0,0 +1,23 @@
+#ifndef MAPPER_H__
+#define MAPPER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rom.h"
+
+extern const Mapper_t MAPPER_NROM;
+extern const Mapper_t MAPPER_MMC1;
+extern const Mapper_t MAPPER_UXROM;
+extern const Mapper_t MAPPER_CNROM;
+extern const Mapper_t MAPPER_MMC3;
+extern const Mapper_t MAPPER_AXROM;
+extern const Mapper_t MAPPER_NSF;
+
+const Mapper_t* mapper_find(uint16_t number);
+
+// Switch `size` bytes of PRG or CHR in at `window`. Banks are counted in
+// units of `size` and negative banks count back from the end.
+void mapper_prg(ROM_t* rom, uint8_t window, uint32_t size, int32_t bank);
+void mapper_chr(ROM_t* rom, uint8_t window, uint32_t size, int32_t bank);
+
+#endif
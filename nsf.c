@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "nsf.h"
+#include "cpu.h"
+#include "apu.h"
+#include "ppu.h"
+#include "audio.h"
+#include "mapper.h"
+
+// Shared between the render workers, each one takes the next track in line
+typedef struct {
+    NSF_t*       nsf;
+    NSFRender_t* render;
+    uint16_t     next;
+    uint16_t     last;
+    bool         failed;
+} NSFQueue_t;
+
+static uint16_t nsf_word(uint8_t* buffer) {
+    return (((uint16_t) buffer[1]) << 8) | buffer[0];
+}
+
+bool nsf_probe(char* path) {
+    uint8_t magic[5] = {0};
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+        return false;
+
+    size_t read = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    return read == sizeof(magic) && memcmp(magic, "NESM\x1A", sizeof(magic)) == 0;
+}
+
+NSF_t* nsf_from_file(char* path) {
+    NSF_t* nsf = NULL;
+    uint8_t* buffer = NULL;
+    uint32_t file_size = 0;
+    FILE* nsf_file = fopen(path, "rb");
+
+    if (nsf_file == NULL) {
+        fprintf(stderr, "Error: Could not open file %s\n", path);
+        return NULL;
+    }
+
+    fseek(nsf_file, 0, SEEK_END);
+    file_size = ftell(nsf_file);
+
+    if (file_size <= NSF_HEADER_SIZE) {
+        fprintf(stderr, "Error: File too small, only %d bytes\n", file_size);
+        goto cleanup_fhandler;
+    }
+
+    rewind(nsf_file);
+    buffer = (uint8_t*) malloc(file_size);
+    if (fread(buffer, file_size, 1, nsf_file) != 1) {
+        fprintf(stderr, "Error: Could not read %s\n", path);
+        goto cleanup_filebuffer;
+    }
+
+    if (memcmp(buffer, "NESM\x1A", 5) != 0) {
+        fprintf(stderr, "Error: No magic bytes\n");
+        goto cleanup_filebuffer;
+    }
+
+    nsf = (NSF_t*) calloc(1, sizeof(NSF_t));
+
+    nsf->version       = buffer[0x05];
+    nsf->total_songs   = buffer[0x06];
+    nsf->starting_song = buffer[0x07];
+    nsf->load_addr     = nsf_word(&buffer[0x08]);
+    nsf->init_addr     = nsf_word(&buffer[0x0A]);
+    nsf->play_addr     = nsf_word(&buffer[0x0C]);
+    memcpy(nsf->name, &buffer[0x0E], NSF_TEXT_SIZE);
+    memcpy(nsf->artist, &buffer[0x2E], NSF_TEXT_SIZE);
+    memcpy(nsf->copyright, &buffer[0x4E], NSF_TEXT_SIZE);
+    nsf->ntsc_speed    = nsf_word(&buffer[0x6E]);
+    memcpy(nsf->bankswitch, &buffer[0x70], NSF_BANKS);
+    nsf->chips         = buffer[0x7B];
+
+    for (int i = 0; i < NSF_BANKS; ++i)
+        nsf->bankswitched |= nsf->bankswitch[i] != 0;
+
+    uint8_t* data = buffer + NSF_HEADER_SIZE;
+    uint32_t data_size = file_size - NSF_HEADER_SIZE;
+
+    if (nsf->bankswitched) {
+        // Banks are counted from the 4KiB boundary just below the load address
+        uint32_t padding = nsf->load_addr & ((NSF_BANK_SIZE) - 1);
+        uint32_t bank_count = (padding + data_size + (NSF_BANK_SIZE) - 1) / (NSF_BANK_SIZE);
+
+        if (bank_count > 256)
+            bank_count = 256;
+
+        uint32_t room = bank_count * (NSF_BANK_SIZE) - padding;
+
+        nsf->bank_count = bank_count;
+        nsf->prg_data = (uint8_t*) calloc(bank_count, NSF_BANK_SIZE);
+        memcpy(&nsf->prg_data[padding], data, data_size < room ? data_size : room);
+    } else {
+        if (nsf->load_addr < 0x8000) {
+            fprintf(stderr, "Error: Load address $%04x is below $8000\n", nsf->load_addr);
+            goto cleanup_nsf;
+        }
+
+        // Lay the data out over all of $8000-$FFFF and map it in order
+        uint32_t room = 0x10000 - nsf->load_addr;
+
+        nsf->bank_count = NSF_BANKS;
+        nsf->prg_data = (uint8_t*) calloc(NSF_BANKS, NSF_BANK_SIZE);
+        memcpy(&nsf->prg_data[nsf->load_addr - 0x8000], data, data_size < room ? data_size : room);
+
+        for (int i = 0; i < NSF_BANKS; ++i)
+            nsf->bankswitch[i] = i;
+    }
+
+    if (nsf->total_songs == 0 || nsf->ntsc_speed == 0) {
+        fprintf(stderr, "Error: File is not valid\n");
+        goto cleanup_nsf;
+    }
+
+    if (nsf->chips != 0)
+        fprintf(stderr, "Warning: Expansion audio (%02x) is not emulated\n", nsf->chips);
+
+    goto cleanup_filebuffer;
+
+cleanup_nsf:
+    nsf_free(nsf);
+    nsf = NULL;
+cleanup_filebuffer:
+    free(buffer);
+cleanup_fhandler:
+    fclose(nsf_file);
+
+    return nsf;
+}
+
+void nsf_free(NSF_t* nsf) {
+    free(nsf->prg_data);
+    free(nsf);
+}
+
+void nsf_print_details(NSF_t* nsf) {
+    fprintf(stderr, "nsf\n");
+    fprintf(stderr, "\t->name       %s\n", nsf->name);
+    fprintf(stderr, "\t->artist     %s\n", nsf->artist);
+    fprintf(stderr, "\t->copyright  %s\n", nsf->copyright);
+    fprintf(stderr, "\t->songs      %d (starting at %d)\n", nsf->total_songs, nsf->starting_song);
+    fprintf(stderr, "\t->load/init/play $%04x $%04x $%04x\n",
+        nsf->load_addr, nsf->init_addr, nsf->play_addr);
+    fprintf(stderr, "\t->ntsc_speed %dus\n", nsf->ntsc_speed);
+    fprintf(stderr, "\t->banks      %d%s\n", nsf->bank_count, nsf->bankswitched ? " (switched)" : "");
+}
+
+// Every track gets its own cartridge RAM and bank registers on top of the
+// shared PRG
+static ROM_t* nsf_rom_init(NSF_t* nsf) {
+    ROM_t* rom = (ROM_t*) calloc(1, sizeof(ROM_t));
+
+    // The NSF's PRG stands in for the file image, so it's never written to
+    // or freed through here
+    rom->image = nsf->prg_data;
+    rom->image_size = nsf->bank_count * (NSF_BANK_SIZE);
+    rom->owned = ROM_OWNS_RAM;
+
+    rom->prg_data = nsf->prg_data;
+    rom->prg_size = rom->image_size;
+    rom->ram_page_count = 1;
+    rom->ram_data = (uint8_t*) calloc(1, RAM_PAGE_SIZE);
+
+    rom->mapper = &MAPPER_NSF;
+    for (int i = 0; i < NSF_BANKS; ++i)
+        rom_map_write(rom, 0x5FF8 + i, nsf->bankswitch[i]);
+
+    return rom;
+}
+
+// Runs a routine as if it had been called with JSR from NSF_RETURN_ADDR, and
+// stops once it returns there
+static bool nsf_call(CPU_t* cpu, uint16_t address) {
+    uint16_t return_address = NSF_RETURN_ADDR - 1;
+    uint64_t limit = cpu->cycle + NSF_CALL_LIMIT;
+
+    cpu_stack_push(cpu, return_address >> 8);
+    cpu_stack_push(cpu, return_address);
+    cpu->reg_PC = address;
+
+    while (cpu->reg_PC != NSF_RETURN_ADDR) {
+        if (!cpu->powered_on || cpu->cycle > limit || cpu_stop_requested)
+            return false;
+
+        cpu_perform_next_op(cpu);
+    }
+
+    return true;
+}
+
+// The CPU has nothing to do between play calls, so time jumps straight to
+// the next scheduled event
+static void nsf_idle(CPU_t* cpu, uint64_t until) {
+    while (cpu->cycle < until) {
+        uint64_t next = cpu->sched.next < until ? cpu->sched.next : until;
+
+        if (next > cpu->cycle)
+            cpu->cycle = next;
+        if (cpu->cycle >= cpu->sched.next)
+            cpu_run_events(cpu);
+    }
+}
+
+static bool nsf_init_track(CPU_t* cpu, NSF_t* nsf, uint8_t track) {
+    // RAM starts out cleared, the APU has to be silenced and the frame IRQ
+    // turned off by hand
+    for (uint16_t address = 0x4000; address <= 0x4013; ++address)
+        cpu_map_write(cpu, address, 0);
+
+    cpu_map_write(cpu, 0x4015, 0x0F);
+    cpu_map_write(cpu, 0x4017, 0x40);
+
+    cpu->reg_A = track - 1;
+    cpu->reg_X = 0; // NTSC
+
+    return nsf_call(cpu, nsf->init_addr);
+}
+
+// Swaps the %d or %0Nd in `pattern` for the track number. The path is never
+// used as a format string, so anything else with a % in it is turned down,
+// as is a result that doesn't fit in `size`.
+bool nsf_track_path(char* path, size_t size, char* pattern, uint8_t track) {
+    char* token = strchr(pattern, '%');
+    int written;
+
+    if (token == NULL) {
+        written = snprintf(path, size, "%s", pattern);
+    } else {
+        char* end = token + 1;
+        int width = 0;
+
+        if (*end == '0') {
+            for (++end; *end >= '0' && *end <= '9' && width < 100; ++end)
+                width = width * 10 + (*end - '0');
+        }
+
+        if (*end != 'd' || strchr(end, '%') != NULL)
+            return false;
+
+        written = snprintf(path, size, "%.*s%0*d%s", (int) (token - pattern), pattern,
+            width, track, end + 1);
+    }
+
+    return written >= 0 && written < (int) size;
+}
+
+bool nsf_render_track(NSF_t* nsf, NSFRender_t* render, uint8_t track) {
+    char path[PATH_MAX];
+
+    if (!nsf_track_path(path, sizeof(path), render->audio_path, track)) {
+        fprintf(stderr, "Error: Bad audio path %s\n", render->audio_path);
+        return false;
+    }
+
+    AudioOut_t* audio = audio_open_wav(path, render->sample_rate, NULL);
+    if (audio == NULL)
+        return false;
+
+    ROM_t* rom = nsf_rom_init(nsf);
+    Console_t* console = console_init(rom);
+    if (console == NULL) {
+        audio_close(audio);
+        rom_free(rom);
+        return false;
+    }
+
+    CPU_t* cpu = &console->cpu;
+    cpu->headless = true;
+    apu_set_sample_rate(cpu->apu, render->sample_rate);
+    cpu->apu->output = audio;
+
+    // There's no vblank to hang play calls off, so they're timed off the
+    // CPU's own cycle count instead
+    double period = nsf->ntsc_speed * (CPU_CLOCK) / 1E6;
+    double next_play = 0;
+    uint64_t end = render->length * (CPU_CLOCK);
+    bool ok = nsf_init_track(cpu, nsf, track);
+
+    while (ok && cpu->cycle < end && !cpu_stop_requested) {
+        if (cpu->cycle >= next_play) {
+            ok = nsf_call(cpu, nsf->play_addr);
+            next_play += period;
+        } else {
+            uint64_t wake = (uint64_t) next_play + 1;
+            nsf_idle(cpu, wake < end ? wake : end);
+        }
+    }
+
+    if (!ok && !cpu_stop_requested)
+        fprintf(stderr, "Error: Track %d got stuck at $%04x\n", track, cpu->reg_PC);
+
+    // Flush whatever is left of the last audio frame
+    apu_run(cpu->apu, cpu->cycle);
+    apu_end_frame(cpu->apu);
+
+    audio_close(audio);
+    console_free(console);
+    rom_free(rom);
+
+    fprintf(stderr, "Track %d -> %s\n", track, path);
+
+    return ok;
+}
+
+static void* nsf_worker(void* arg) {
+    NSFQueue_t* queue = (NSFQueue_t*) arg;
+    uint16_t track;
+
+    while ((track = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED)) <= queue->last) {
+        if (!nsf_render_track(queue->nsf, queue->render, track))
+            __atomic_store_n(&queue->failed, true, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+// Renders the requested tracks, with up to render->jobs of them running at
+// once on separate machines
+bool nsf_render(NSF_t* nsf, NSFRender_t* render) {
+    pthread_t workers[UINT8_MAX];
+    uint8_t started = 0;
+
+    NSFQueue_t queue = {
+        .nsf    = nsf,
+        .render = render,
+        .next   = render->track == 0 ? 1 : render->track,
+        .last   = render->track == 0 ? nsf->total_songs : render->track,
+        .failed = false
+    };
+
+    uint16_t count = queue.last - queue.next + 1;
+    uint8_t jobs = render->jobs < count ? render->jobs : count;
+
+    for (uint8_t i = 0; i < jobs; ++i) {
+        if (pthread_create(&workers[started], NULL, &nsf_worker, &queue) == 0)
+            started++;
+    }
+
+    // Fall back to rendering everything on this thread
+    if (started == 0)
+        nsf_worker(&queue);
+
+    for (uint8_t i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+
+    return !queue.failed;
+}
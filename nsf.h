@@ -0,0 +1,66 @@
+#ifndef NSF_H__
+#define NSF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "console.h"
+#include "rom.h"
+
+#define NSF_HEADER_SIZE 0x80
+#define NSF_TEXT_SIZE   32
+#define NSF_BANK_SIZE   1 << 12 // 4KiB, the size of a PRG window
+#define NSF_BANKS       8       // $8000-$FFFF
+#define NSF_RETURN_ADDR 0x4100 // Unmapped, so no tune will ever run code here
+#define NSF_CALL_LIMIT  1000000 // Cycles before a routine is considered hung
+#define NSF_MAX_LENGTH  86400   // A day per track is plenty
+
+enum NSFChips {
+    NSF_VRC6  = 0,
+    NSF_VRC7  = 1,
+    NSF_FDS   = 2,
+    NSF_MMC5  = 3,
+    NSF_N163  = 4,
+    NSF_S5B   = 5
+};
+
+// A parsed NSF file. Only the header and PRG image live here, every track
+// being rendered gets its own ROM_t on top of the shared PRG.
+typedef struct {
+    uint8_t  version;
+    uint8_t  total_songs;
+    uint8_t  starting_song; // 1 based
+    uint16_t load_addr;
+    uint16_t init_addr;
+    uint16_t play_addr;
+    char     name[NSF_TEXT_SIZE + 1];
+    char     artist[NSF_TEXT_SIZE + 1];
+    char     copyright[NSF_TEXT_SIZE + 1];
+    uint16_t ntsc_speed;    // Microseconds between play calls
+    uint8_t  bankswitch[NSF_BANKS];
+    bool     bankswitched;
+    uint8_t  chips;
+
+    uint8_t* prg_data;
+    uint16_t bank_count;
+} NSF_t;
+
+// What to render. A track of 0 renders every track in the file.
+typedef struct {
+    uint8_t  track;
+    uint32_t length;        // Seconds per track
+    uint8_t  jobs;          // Tracks rendered at once
+    uint32_t sample_rate;
+    char*    audio_path;    // May contain one %d or %0Nd for the track
+} NSFRender_t;
+
+bool nsf_probe(char* path);
+NSF_t* nsf_from_file(char* path);
+void nsf_free(NSF_t* nsf);
+void nsf_print_details(NSF_t* nsf);
+
+bool nsf_track_path(char* path, size_t size, char* pattern, uint8_t track);
+bool nsf_render(NSF_t* nsf, NSFRender_t* render);
+bool nsf_render_track(NSF_t* nsf, NSFRender_t* render, uint8_t track);
+
+#endif
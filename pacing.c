@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "pacing.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+static uint64_t timespec_ns(struct timespec* ts) {
+    return (uint64_t) ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+static void timespec_add_ns(struct timespec* ts, uint64_t ns) {
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / NS_PER_SEC;
+    ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+static void pacer_sleep_until(struct timespec* deadline) {
+    // Restart after signals, the deadline is absolute so nothing drifts
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR);
+}
+
+bool pace_parse(char* name, PaceMode* mode) {
+    if (strcmp(name, "realtime") == 0)
+        *mode = PACE_REALTIME;
+    else if (strcmp(name, "audio") == 0)
+        *mode = PACE_AUDIO;
+    else if (strcmp(name, "off") == 0)
+        *mode = PACE_UNTHROTTLED;
+    else
+        return false;
+
+    return true;
+}
+
+Pacer_t* pacer_init(PaceMode mode, uint32_t sample_rate) {
+    Pacer_t* pacer = (Pacer_t*) calloc(1, sizeof(Pacer_t));
+
+    pacer->mode = mode;
+    pacer->sample_rate = sample_rate;
+
+    // One frame is FRAME_RATE_DEN / FRAME_RATE_NUM seconds, ~16.639ms
+    uint64_t period = (uint64_t) FRAME_RATE_DEN * NS_PER_SEC;
+    pacer->period_ns = period / FRAME_RATE_NUM;
+    pacer->period_frac = period % FRAME_RATE_NUM;
+
+    clock_gettime(CLOCK_MONOTONIC, &pacer->deadline);
+    pacer->last_wake = pacer->deadline;
+
+    return pacer;
+}
+
+void pacer_free(Pacer_t* pacer) {
+    uint64_t total = pacer->busy_ns + pacer->slept_ns;
+
+    if (pacer->mode != PACE_UNTHROTTLED && total > 0) {
+        fprintf(stderr, "Pacing: %lu frames, %.1f%% busy, %lu resyncs\n",
+            (unsigned long) pacer->frames, 100.0 * pacer->busy_ns / total,
+            (unsigned long) pacer->resyncs);
+    }
+
+    free(pacer);
+}
+
+static void pacer_advance(Pacer_t* pacer) {
+    timespec_add_ns(&pacer->deadline, pacer->period_ns);
+
+    pacer->frac_accum += pacer->period_frac;
+    if (pacer->frac_accum >= FRAME_RATE_NUM) {
+        pacer->frac_accum -= FRAME_RATE_NUM;
+        timespec_add_ns(&pacer->deadline, 1);
+    }
+}
+
+// How long until the audio sink drains down to the target latency
+static uint64_t pacer_audio_wait(Pacer_t* pacer) {
+    uint64_t played = __atomic_load_n(&pacer->samples_played, __ATOMIC_ACQUIRE);
+    uint64_t target = (uint64_t) pacer->sample_rate * PACE_AUDIO_LATENCY / 1000;
+
+    if (pacer->samples_queued <= played + target)
+        return 0;
+
+    uint64_t wait = (pacer->samples_queued - played - target) * NS_PER_SEC / pacer->sample_rate;
+
+    // Never stall longer than a couple of frames on a stuck sink
+    return wait < 2ULL * pacer->period_ns ? wait : 2ULL * pacer->period_ns;
+}
+
+// Called by the emulation thread once per displayed frame
+void pacer_frame(Pacer_t* pacer) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pacer->frames++;
+    pacer->busy_ns += timespec_ns(&now) - timespec_ns(&pacer->last_wake);
+
+    switch (pacer->mode) {
+        case PACE_UNTHROTTLED:
+            pacer->last_wake = now;
+            return;
+
+        case PACE_AUDIO:
+            // Until a sink reports in there is no audio clock to follow
+            if (__atomic_load_n(&pacer->samples_played, __ATOMIC_ACQUIRE) > 0) {
+                pacer->deadline = now;
+                timespec_add_ns(&pacer->deadline, pacer_audio_wait(pacer));
+                break;
+            }
+            // Fall through
+
+        case PACE_REALTIME:
+            pacer_advance(pacer);
+
+            // After a long stall (debugger, suspended host) start over from
+            // now instead of running flat out to catch up
+            if (timespec_ns(&now) > timespec_ns(&pacer->deadline) + PACE_MAX_LAG_FRAMES * (uint64_t) pacer->period_ns) {
+                pacer->deadline = now;
+                pacer->resyncs++;
+            }
+            break;
+    }
+
+    pacer_sleep_until(&pacer->deadline);
+
+    clock_gettime(CLOCK_MONOTONIC, &pacer->last_wake);
+    pacer->slept_ns += timespec_ns(&pacer->last_wake) - timespec_ns(&now);
+}
+
+void pacer_audio_queued(Pacer_t* pacer, uint32_t samples) {
+    pacer->samples_queued += samples;
+}
+
+// Called from the audio sink's thread with its running total
+void pacer_audio_played(Pacer_t* pacer, uint64_t samples_played) {
+    __atomic_store_n(&pacer->samples_played, samples_played, __ATOMIC_RELEASE);
+}
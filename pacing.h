@@ -0,0 +1,53 @@
+#ifndef PACING_H__
+#define PACING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "console.h"
+
+#define PACE_MAX_LAG_FRAMES  4  // Further behind than this and we stop catching up
+#define PACE_AUDIO_LATENCY   50 // Target milliseconds of queued audio
+
+typedef enum {
+    PACE_REALTIME,   // Sleep to the NTSC frame rate
+    PACE_AUDIO,      // Sleep to keep the audio queue at a fixed depth
+    PACE_UNTHROTTLED // Never sleep
+} PaceMode;
+
+// Throttles emulation to real time. A frame is emulated at full speed and
+// then the emulation thread sleeps until that frame's absolute deadline, so
+// the host only spends the actual emulation cost. Deadlines are advanced by
+// an exact integer period (with the fractional nanoseconds carried over)
+// rather than measured from wakeups, so sleep overshoot never accumulates.
+struct Pacer_t {
+    PaceMode mode;
+
+    struct timespec deadline;
+    uint32_t period_ns;
+    uint32_t period_frac;  // Remainder of the period, in 1/FRAME_RATE_NUM ns
+    uint32_t frac_accum;
+
+    // Audio clock, PACE_AUDIO only
+    uint32_t sample_rate;
+    uint64_t samples_queued;
+    uint64_t samples_played; // Written by the audio sink, atomically
+
+    // Stats
+    uint64_t frames;
+    uint64_t resyncs;
+    uint64_t busy_ns;
+    uint64_t slept_ns;
+    struct timespec last_wake;
+};
+
+bool pace_parse(char* name, PaceMode* mode);
+
+Pacer_t* pacer_init(PaceMode mode, uint32_t sample_rate);
+void pacer_free(Pacer_t* pacer);
+
+void pacer_frame(Pacer_t* pacer);
+void pacer_audio_queued(Pacer_t* pacer, uint32_t samples);
+void pacer_audio_played(Pacer_t* pacer, uint64_t samples_played);
+
+#endif
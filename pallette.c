@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+#include "pallette.h"
+
+// The fraction of its level that a colour channel keeps when one of the
+// other channels is emphasised.
+#define EMPHASIS_ATTENUATION 0.816328
+
+// NES reference pallette in 24-bit RGB
+static const uint8_t REF_PALLETTE_MAP[PALLETTE_COLORS][3] = {
+    {0x7C, 0x7C, 0x7C}, // #7C7C7C
+    {0x00, 0x00, 0xFC}, // #0000FC
+    {0x00, 0x00, 0xBC}, // #0000BC
+    {0x44, 0x28, 0xBC}, // #4428BC
+    {0x94, 0x00, 0x84}, // #940084
+    {0xA8, 0x00, 0x20}, // #A80020
+    {0xA8, 0x10, 0x00}, // #A81000
+    {0x88, 0x14, 0x00}, // #881400
+    {0x50, 0x30, 0x00}, // #503000
+    {0x00, 0x78, 0x00}, // #007800
+    {0x00, 0x68, 0x00}, // #006800
+    {0x00, 0x58, 0x00}, // #005800
+    {0x00, 0x40, 0x58}, // #004058
+    {0x00, 0x00, 0x00}, // #000000
+    {0x00, 0x00, 0x00}, // #000000
+    {0x00, 0x00, 0x00}, // #000000
+    {0xBC, 0xBC, 0xBC}, // #BCBCBC
+    {0x00, 0x78, 0xF8}, // #0078F8
+    {0x00, 0x58, 0xF8}, // #0058F8
+    {0x68, 0x44, 0xFC}, // #6844FC
+    {0xD8, 0x00, 0xCC}, // #D800CC
+    {0xE4, 0x00, 0x58}, // #E40058
+    {0xF8, 0x38, 0x00}, // #F83800
+    {0xE4, 0x5C, 0x10}, // #E45C10
+    {0xAC, 0x7C, 0x00}, // #AC7C00
+    {0x00, 0xB8, 0x00}, // #00B800
+    {0x00, 0xA8, 0x00}, // #00A800
+    {0x00, 0xA8, 0x44}, // #00A844
+    {0x00, 0x88, 0x88}, // #008888
+    {0x00, 0x00, 0x00}, // #000000
+    {0x00, 0x00, 0x00}, // #000000
+    {0x00, 0x00, 0x00}, // #000000
+    {0xF8, 0xF8, 0xF8}, // #F8F8F8
+    {0x3C, 0xBC, 0xFC}, // #3CBCFC
+    {0x68, 0x88, 0xFC}, // #6888FC
+    {0x98, 0x78, 0xF8}, // #9878F8
+    {0xF8, 0x78, 0xF8}, // #F878F8
+    {0xF8, 0x58, 0x98}, // #F85898
+    {0xF8, 0x78, 0x58}, // #F87858
+    {0xFC, 0xA0, 0x44}, // #FCA044
+    {0xF8, 0xB8, 0x00}, // #F8B800
+    {0xB8, 0xF8, 0x18}, // #B8F818
+    {0x58, 0xD8, 0x54}, // #58D854
+    {0x58, 0xF8, 0x98}, // #58F898
+    {0x00, 0xE8, 0xD8}, // #00E8D8
+    {0x78, 0x78, 0x78}, // #787878
+    {0x00, 0x00, 0x00}, // #000000
+    {0x00, 0x00, 0x00}, // #000000
+    {0xFC, 0xFC, 0xFC}, // #FCFCFC
+    {0xA4, 0xE4, 0xFC}, // #A4E4FC
+    {0xB8, 0xB8, 0xF8}, // #B8B8F8
+    {0xD8, 0xB8, 0xF8}, // #D8B8F8
+    {0xF8, 0xB8, 0xF8}, // #F8B8F8
+    {0xF8, 0xA4, 0xC0}, // #F8A4C0
+    {0xF0, 0xD0, 0xB0}, // #F0D0B0
+    {0xFC, 0xE0, 0xA8}, // #FCE0A8
+    {0xF8, 0xD8, 0x78}, // #F8D878
+    {0xD8, 0xF8, 0x78}, // #D8F878
+    {0xB8, 0xF8, 0xB8}, // #B8F8B8
+    {0xB8, 0xF8, 0xD8}, // #B8F8D8
+    {0x00, 0xFC, 0xFC}, // #00FCFC
+    {0xF8, 0xD8, 0xF8}, // #F8D8F8
+    {0x00, 0x00, 0x00}, // #000000
+    {0x00, 0x00, 0x00}, // #000000
+};
+
+uint8_t  pallette_rgb24[PALLETTE_ENTRIES][3];
+uint32_t pallette_xrgb8888[PALLETTE_ENTRIES];
+uint16_t pallette_rgb565[PALLETTE_ENTRIES];
+
+static void pallette_pack_formats() {
+    for (int i = 0; i < PALLETTE_ENTRIES; ++i) {
+        uint8_t r = pallette_rgb24[i][0];
+        uint8_t g = pallette_rgb24[i][1];
+        uint8_t b = pallette_rgb24[i][2];
+
+        pallette_xrgb8888[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        pallette_rgb565[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    }
+}
+
+void pallette_init() {
+    pallette_build(REF_PALLETTE_MAP);
+}
+
+// Derives all 8 emphasis variants of a 64 colour palette
+void pallette_build(const uint8_t colors[PALLETTE_COLORS][3]) {
+    for (int emphasis = 0; emphasis < PALLETTE_EMPHASIS; ++emphasis) {
+        for (int color = 0; color < PALLETTE_COLORS; ++color) {
+            uint16_t i = (emphasis << PIXEL_EMPHASIS_POS) | color;
+
+            for (int channel = 0; channel < 3; ++channel) {
+                // Emphasising a channel darkens the two other channels. With
+                // all three bits set, everything is darkened.
+                bool attenuate = emphasis != 0 &&
+                    (emphasis == 0b111 || !(emphasis & (1 << channel)));
+                double level = colors[color][channel];
+
+                if (attenuate)
+                    level *= EMPHASIS_ATTENUATION;
+
+                pallette_rgb24[i][channel] = (uint8_t) (level + 0.5);
+            }
+        }
+    }
+
+    pallette_pack_formats();
+}
+
+// Loads a .pal file, either 64 colours (emphasis derived) or all 512 entries
+bool pallette_load_file(char* path) {
+    uint8_t buffer[PALLETTE_ENTRIES][3];
+    FILE* pal_file = fopen(path, "rb");
+
+    if (pal_file == NULL) {
+        fprintf(stderr, "Error: Could not open palette %s\n", path);
+        return false;
+    }
+
+    size_t entries = fread(buffer, 3, PALLETTE_ENTRIES, pal_file);
+    fclose(pal_file);
+
+    if (entries == PALLETTE_ENTRIES) {
+        memcpy(pallette_rgb24, buffer, sizeof(pallette_rgb24));
+        pallette_pack_formats();
+    } else if (entries == PALLETTE_COLORS) {
+        pallette_build((const uint8_t (*)[3]) buffer);
+    } else {
+        fprintf(stderr, "Error: Palette %s has %d colours, expected 64 or 512\n",
+            path, (int) entries);
+        return false;
+    }
+
+    return true;
+}
+
+// Output conversion
+uint8_t pallette_bytes_per_pixel(PixelFormat format) {
+    switch (format) {
+        case PIXEL_RGB24:    return 3;
+        case PIXEL_XRGB8888: return 4;
+        case PIXEL_RGB565:   return 2;
+        default:             return 0;
+    }
+}
+
+void pallette_convert(PixelFormat format, const uint16_t* src, void* dst, uint32_t count) {
+    switch (format) {
+        case PIXEL_RGB24:
+            pallette_convert_rgb24(src, (uint8_t*) dst, count);
+            break;
+        case PIXEL_XRGB8888:
+            pallette_convert_xrgb8888(src, (uint32_t*) dst, count);
+            break;
+        case PIXEL_RGB565:
+            pallette_convert_rgb565(src, (uint16_t*) dst, count);
+            break;
+    }
+}
+
+void pallette_convert_rgb24(const uint16_t* src, uint8_t* dst, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        memcpy(dst, pallette_rgb24[src[i]], 3);
+        dst += 3;
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static uint32_t pallette_gather_xrgb8888_avx2(const uint16_t* src, uint32_t* dst, uint32_t count) {
+    uint32_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i indices = _mm_loadu_si128((const __m128i*) &src[i]);
+        __m256i pixels = _mm256_i32gather_epi32(
+            (const int*) pallette_xrgb8888, _mm256_cvtepu16_epi32(indices), 4);
+        _mm256_storeu_si256((__m256i*) &dst[i], pixels);
+    }
+
+    return i;
+}
+#endif
+
+void pallette_convert_xrgb8888(const uint16_t* src, uint32_t* dst, uint32_t count) {
+    uint32_t i = 0;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2"))
+        i = pallette_gather_xrgb8888_avx2(src, dst, count);
+#endif
+
+    for (; i < count; ++i)
+        dst[i] = pallette_xrgb8888[src[i]];
+}
+
+void pallette_convert_rgb565(const uint16_t* src, uint16_t* dst, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i)
+        dst[i] = pallette_rgb565[src[i]];
+}
@@ -0,0 +1,38 @@
+#ifndef PALLETTE_H__
+#define PALLETTE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PALLETTE_COLORS    64
+#define PALLETTE_EMPHASIS  8
+#define PALLETTE_ENTRIES   (PALLETTE_COLORS) * (PALLETTE_EMPHASIS)
+
+// Pixels in the PPU framebuffer are 9-bit indices into the tables below: the
+// low 6 bits are the NES colour and the upper 3 bits are the PPUMASK emphasis
+// bits (red, green, blue) that were active when the pixel was drawn.
+#define PIXEL_COLOR_MASK   0b000111111
+#define PIXEL_EMPHASIS_POS 6
+
+typedef enum {
+    PIXEL_RGB24,
+    PIXEL_XRGB8888,
+    PIXEL_RGB565
+} PixelFormat;
+
+extern uint8_t  pallette_rgb24[PALLETTE_ENTRIES][3];
+extern uint32_t pallette_xrgb8888[PALLETTE_ENTRIES];
+extern uint16_t pallette_rgb565[PALLETTE_ENTRIES];
+
+void pallette_init();
+void pallette_build(const uint8_t colors[PALLETTE_COLORS][3]);
+bool pallette_load_file(char* path);
+
+// Output conversion
+void pallette_convert(PixelFormat format, const uint16_t* src, void* dst, uint32_t count);
+void pallette_convert_rgb24(const uint16_t* src, uint8_t* dst, uint32_t count);
+void pallette_convert_xrgb8888(const uint16_t* src, uint32_t* dst, uint32_t count);
+void pallette_convert_rgb565(const uint16_t* src, uint16_t* dst, uint32_t count);
+uint8_t pallette_bytes_per_pixel(PixelFormat format);
+
+#endif
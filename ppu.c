@@ -2,12 +2,18 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <assert.h>
 #include "ppu.h"
+#include "pallette.h"
+#include "triplebuf.h"
+#include "capture.h"
+#include "shmexport.h"
+#include "pacing.h"
+#include "cheat.h"
+#include "fiber.h"
 #include "util.h"
 
-PPU_t* ppu_init(ROM_t* cartridge) {
-    PPU_t* ppu = (PPU_t*) malloc(sizeof(PPU_t));
-
+void ppu_init(PPU_t* ppu, ROM_t* cartridge) {
     // Zero out memory
     memset(ppu->oam, 0, OAM_SIZE);
     memset(ppu->secondary_oam, 0, SECONDARY_OAM_SIZE);
@@ -28,30 +34,41 @@ PPU_t* ppu_init(ROM_t* cartridge) {
 
     ppu->framenumber = 0;
     ppu->cycle       = 0;
+    ppu->cycle_budget = 0;
     ppu->scanline    = -1;
+    ppu->scanline_cycle = 0;
     ppu->cartridge   = cartridge;
-    // false for vertical, true for horizontal
-    ppu->mirroring   = get_bit(ppu->cartridge->flags6, MIRRORING);
-
-    return ppu;
-}
-
-void ppu_free(PPU_t* ppu) {
-    free(ppu);
+    ppu->a12_watch   = false;
+    ppu->a12_high    = 0;
+    ppu->nmi_cycle   = SCHED_NEVER;
+
+    memset(ppu->bg_line, 0, FRAME_WIDTH);
+    memset(ppu->sprite_line, 0, FRAME_WIDTH);
+    ppu->bg_exact_line = false;
+    ppu->sprite_count = 0;
+    ppu->sprite0_on_line = false;
+    ppu->frameskip = 1;
+    ppu->render_frame = true;
+
+    ppu->capture = NULL;
+    ppu->shm = NULL;
+    ppu->pacer = NULL;
+    ppu->output = triplebuf_init(TRIPLEBUF_MAX_CONSUMERS);
+    ppu->framebuffer = triplebuf_back(ppu->output);
+    memset(ppu->page_table, 0, sizeof(ppu->page_table));
+    ppu_map_rebuild(ppu);
 }
 
 // Cycle instructions
 void ppu_start(PPU_t* ppu) {
-    pthread_mutex_lock(&clock_lock);
-
     while (ppu->cpu->powered_on) {
         ppu_render_scanline(ppu);
     }
-
-    pthread_mutex_unlock(&clock_lock);
 }
 
 void ppu_tick(PPU_t* ppu) {
+    assert(!fiber_in_cpu);
+
     ppu->cycle++;
     ppu->scanline_cycle++;
 
@@ -65,10 +82,8 @@ void ppu_tick(PPU_t* ppu) {
         ppu->clear_vsync = false;
     }
 
-    while (ppu->cycle_budget == 0) {
-        pthread_mutex_unlock(&clock_lock);
-        pthread_mutex_lock(&clock_lock);
-    }
+    while (ppu->cycle_budget == 0)
+        fiber_yield();
 
     ppu->cycle_budget--;
 }
@@ -81,9 +96,10 @@ void ppu_render_scanline(PPU_t* ppu) {
         ppu_prerender_scanline(ppu);
     else if (ppu->scanline >= 0 && ppu->scanline < 240)
         ppu_visible_scanline(ppu);
-    else if (ppu->scanline == 240)
+    else if (ppu->scanline == 240) {
+        ppu_frame_complete(ppu);
         ppu_idle_scanline(ppu);
-    else if (ppu->scanline == 241)
+    } else if (ppu->scanline == VBLANK_SCANLINE)
         ppu_vblank_scanline(ppu);
     else if (ppu->scanline >= 242 && ppu->scanline < 261)
         ppu_idle_scanline(ppu);
@@ -92,13 +108,51 @@ void ppu_render_scanline(PPU_t* ppu) {
     if (ppu->scanline > 261) {
         ppu->framenumber++;
         ppu->scanline = 0;
+
+        // When fast-forwarding only 1 of every `frameskip` frames produces
+        // pixels. The rest still run the full timing model.
+        ppu->render_frame = ppu->framenumber % ppu->frameskip == 0;
     }
 }
 
+// Called once the last visible line has been drawn
+void ppu_frame_complete(PPU_t* ppu) {
+    rom_flush_save(ppu->cartridge, false);
+    cheat_freeze(ppu->cpu);
+
+    if (!ppu->render_frame)
+        return;
+
+    if (ppu->capture != NULL)
+        capture_push_frame(ppu->capture, ppu->framebuffer, ppu->framenumber);
+    if (ppu->shm != NULL)
+        shmexport_publish(ppu->shm, ppu->framebuffer, ppu->framenumber, ppu->cpu->memory);
+
+    // Sleep off the rest of the frame's time slot so frames reach the
+    // display evenly spaced. The CPU is waiting on its budget meanwhile.
+    if (ppu->pacer != NULL)
+        pacer_frame(ppu->pacer);
+
+    // Hand the finished frame to the readers and carry on drawing into
+    // whichever buffer none of them is looking at
+    triplebuf_publish(ppu->output, ppu->framenumber);
+    ppu->framebuffer = triplebuf_back(ppu->output);
+}
+
 void ppu_prerender_scanline(PPU_t* ppu) {
+    ppu_tick(ppu); // Cycle 0
+    ppu_tick(ppu); // Cycle 1
+
     ppu->reg_PPUSTATUS = set_bit(ppu->reg_PPUSTATUS, stat_VBLANK, false);
+    ppu->reg_PPUSTATUS = set_bit(ppu->reg_PPUSTATUS, stat_SPRITE0, false);
+    ppu->reg_PPUSTATUS = set_bit(ppu->reg_PPUSTATUS, stat_SPRITEOVER, false);
+
+    for (int i = 2; i <= FRAME_WIDTH; ++i)
+        ppu_tick(ppu);
 
     // TODO: Set OAMADDR to 0 during ticks 257-320 (sprite tile loading interval)
+    ppu_fetch_sprites(ppu);
+    ppu_fetch_next_tiles(ppu);
 }
 
 void ppu_visible_scanline(PPU_t* ppu) {
@@ -110,39 +164,95 @@ void ppu_visible_scanline(PPU_t* ppu) {
         ppu_tick(ppu);
     }
 
+    // Sprite evaluation and the sprite 0 test run on every frame, since games
+    // poll PPUSTATUS for them. Everything producing pixels is skipped on
+    // frames dropped by frameskip.
+    ppu_sprite_eval(ppu);
+    int16_t sprite0_x = ppu_sprite0_hit_x(ppu);
+
+    if (ppu->render_frame)
+        ppu_plane_refresh(ppu);
+    ppu->bg_exact_line = false;
+
+    // The scroll position latched at the start of the line. As long as no
+    // register is touched mid-line, the whole background row is a windowed
+    // copy out of the cached planes.
+    uint16_t scroll_x = ppu_scroll_x(ppu);
+    uint16_t plane_y  = (ppu_scroll_y(ppu) + ppu->scanline) % (BG_PLANE_HEIGHT);
+    uint16_t cached_end = FRAME_WIDTH;
+
     // Read tile data
     for (int i = 0; i < TILES_PER_SCANLINE; ++i) {
-        // TODO:
-        // Read nametable byte
-        // Read Attribute table byte
-        // Read tile bitmap low
-        // Read tile bitmap high (at low addr + 8)
+        // A register write during the previous fetches invalidates the line
+        // start state, so the rest of the line is rendered pixel by pixel
+        // from VRAM using the registers as they are now.
+        if (ppu->bg_exact_line && ppu->render_frame) {
+            if (cached_end == FRAME_WIDTH)
+                cached_end = i * (TILE_SIZE);
+
+            uint16_t x = ppu_scroll_x(ppu) + i * (TILE_SIZE);
+            uint16_t y = (ppu_scroll_y(ppu) + ppu->scanline) % (BG_PLANE_HEIGHT);
+            for (int px = 0; px < (TILE_SIZE); ++px)
+                ppu->bg_line[i * (TILE_SIZE) + px] =
+                    ppu_bg_pixel_exact(ppu, (x + px) % (BG_PLANE_WIDTH), y);
+        }
+
+        // Nametable byte, attribute byte, tile bitmap low and high
+        ppu_fake_memory_access(ppu);
+        ppu_fake_memory_access(ppu);
+        if (ppu->a12_watch)
+            ppu_a12_fetch(ppu, ppu_base_patterntable(ppu) != 0);
+        ppu_fake_memory_access(ppu);
+        ppu_fake_memory_access(ppu);
+
+        // Sprite 0 hit is raised once the tile holding the hit pixel is out
+        if (sprite0_x >= 0 && sprite0_x < (i + 1) * (TILE_SIZE)) {
+            ppu->reg_PPUSTATUS = set_bit(ppu->reg_PPUSTATUS, stat_SPRITE0, true);
+            sprite0_x = -1;
+        }
+    }
+
+    if (ppu->render_frame) {
+        ppu_plane_window_copy(ppu, 0, cached_end, scroll_x, plane_y);
+        ppu_render_sprites(ppu);
+        ppu_compose_scanline(ppu);
     }
 
-    // Preload sprites for the next scanline
+    ppu_fetch_sprites(ppu);
+    ppu_fetch_next_tiles(ppu);
+}
+
+// Cycles 257-320, pattern data for the next line's sprites
+void ppu_fetch_sprites(PPU_t* ppu) {
+    bool tall = get_bit(ppu->reg_PPUCTRL, ctrl_SPRITESIZE);
+
     for (int i = 0; i < ((SECONDARY_OAM_SIZE) / (SPRITE_SIZE)); ++i) {
         // Garbage nametable reads
         ppu_fake_memory_access(ppu);
         ppu_fake_memory_access(ppu);
 
-        // TODO:
-        // Read tile bitmap low
-        // Read tile bitmap high (at low addr + 8)
+        // Tile bitmap low and high. If there are less than 8 sprites on the
+        // next scanline the left-over slots fetch tile $FF, which 8x16
+        // sprites take from the $1000 table.
+        if (ppu->a12_watch) {
+            uint8_t tile = ppu->secondary_oam[i * (SPRITE_SIZE) + 1];
+            ppu_a12_fetch(ppu, tall ? tile & 1 : get_bit(ppu->reg_PPUCTRL, ctrl_SPRITETABLE));
+        }
 
-        // If there are less than 8 sprites on the next scanline, then dummy
-        // fetches to tile $FF occur for the left-over sprites, because of the
-        // dummy sprite data in the secondary OAM (see sprite evaluation). This
-        // data is then discarded, and the sprites are loaded with a transparent
-        // bitmap instead.
+        ppu_fake_memory_access(ppu);
+        ppu_fake_memory_access(ppu);
     }
+}
 
-    // Get first 2 tiles for the *next* scanline
+// Cycles 321-340, the first 2 tiles of the *next* scanline
+void ppu_fetch_next_tiles(PPU_t* ppu) {
     for (int i = 0; i < 2; ++i) {
-        // TODO:
-        // Read nametable byte
-        // Read Attribute table byte
-        // Read tile bitmap low
-        // Read tile bitmap high (at low addr + 8)
+        ppu_fake_memory_access(ppu);
+        ppu_fake_memory_access(ppu);
+        if (ppu->a12_watch)
+            ppu_a12_fetch(ppu, ppu_base_patterntable(ppu) != 0);
+        ppu_fake_memory_access(ppu);
+        ppu_fake_memory_access(ppu);
     }
 
     // Two bytes are fetched, but the purpose for this is unknown
@@ -150,6 +260,19 @@ void ppu_visible_scanline(PPU_t* ppu) {
     ppu_fake_memory_access(ppu);
 }
 
+// Boards like the MMC3 clock a counter off A12 rising on the PPU bus. Only
+// the pattern fetches touch A12, and a rise only counts once A12 has been
+// low for a while.
+void ppu_a12_fetch(PPU_t* ppu, bool high) {
+    if (!high)
+        return;
+
+    if (ppu->cycle - ppu->a12_high > (A12_FILTER))
+        ppu->cartridge->mapper->a12_rise(ppu->cartridge);
+
+    ppu->a12_high = ppu->cycle;
+}
+
 void ppu_idle_scanline(PPU_t* ppu) {
     for (int i = 0; i < CYCLES_PER_SCANLINE; ++i)
         ppu_tick(ppu);
@@ -159,9 +282,8 @@ void ppu_vblank_scanline(PPU_t* ppu) {
     ppu_tick(ppu); // Cycle 0
     ppu_tick(ppu); // Cycle 1
 
+    // The NMI is raised from the CPU's side, see ppu_nmi_event()
     ppu->reg_PPUSTATUS = set_bit(ppu->reg_PPUSTATUS, stat_VBLANK, true);
-    if (get_bit(ppu->reg_PPUCTRL, ctrl_NMI))
-        ppu->cpu->sig_NMI = false;
 
     // Set i = 2 because we've already performed two cycles for this scanline
     for (int i = 2; i < CYCLES_PER_SCANLINE; ++i)
@@ -173,6 +295,324 @@ uint8_t ppu_get_pallette(PPU_t* ppu, bool sprite, uint8_t num, uint8_t value) {
     return ppu->pallette_indices[index & 0b00011111];
 }
 
+void ppu_sprite_eval(PPU_t* ppu) {
+    uint8_t height = get_bit(ppu->reg_PPUCTRL, ctrl_SPRITESIZE) ? 16 : 8;
+    uint8_t found = 0;
+
+    // Unused secondary OAM slots read back as $FF
+    memset(ppu->secondary_oam, 0xFF, SECONDARY_OAM_SIZE);
+    ppu->sprite0_on_line = false;
+
+    if (!ppu_rendering_enabled(ppu)) {
+        ppu->sprite_count = 0;
+        return;
+    }
+
+    for (int i = 0; i < (OAM_SIZE) / (SPRITE_SIZE); ++i) {
+        uint8_t* sprite = &ppu->oam[i * (SPRITE_SIZE)];
+        // Sprites are drawn one line below their OAM Y coordinate
+        int16_t row = ppu->scanline - 1 - sprite[0];
+
+        if (row < 0 || row >= height)
+            continue;
+
+        if (found == (SECONDARY_OAM_SIZE) / (SPRITE_SIZE)) {
+            ppu->reg_PPUSTATUS = set_bit(ppu->reg_PPUSTATUS, stat_SPRITEOVER, true);
+            break;
+        }
+
+        if (i == 0)
+            ppu->sprite0_on_line = true;
+
+        memcpy(&ppu->secondary_oam[found * (SPRITE_SIZE)], sprite, SPRITE_SIZE);
+        found++;
+    }
+
+    ppu->sprite_count = found;
+}
+
+// Fetches the pattern bits of one row of a sprite, honouring flips
+void ppu_sprite_row(PPU_t* ppu, uint8_t* sprite, uint8_t* low, uint8_t* high) {
+    bool tall = get_bit(ppu->reg_PPUCTRL, ctrl_SPRITESIZE);
+    uint8_t height = tall ? 16 : 8;
+    uint8_t row = ppu->scanline - 1 - sprite[0];
+
+    if (get_bit(sprite[2], 7)) // Vertical flip
+        row = height - 1 - row;
+
+    uint16_t address;
+    if (tall) {
+        // 8x16 sprites pick their pattern table with bit 0 of the tile index
+        address = ((sprite[1] & 1) << 12) | ((sprite[1] & 0xFE) << 4);
+        if (row >= 8)
+            address += 16;
+    } else {
+        address = (get_bit(ppu->reg_PPUCTRL, ctrl_SPRITETABLE) << 12) | (sprite[1] << 4);
+    }
+
+    address += row % 8;
+    *low  = *ppu_vram_ptr(ppu, address);
+    *high = *ppu_vram_ptr(ppu, address + 8);
+
+    if (get_bit(sprite[2], 6)) { // Horizontal flip
+        *low  = reverse_bits(*low);
+        *high = reverse_bits(*high);
+    }
+}
+
+// Works out where sprite 0 first overlaps an opaque background pixel on the
+// current line, straight from the sprite bitmap and the background planes.
+// Returns -1 if there is no hit.
+int16_t ppu_sprite0_hit_x(PPU_t* ppu) {
+    if (!ppu->sprite0_on_line || get_bit(ppu->reg_PPUSTATUS, stat_SPRITE0))
+        return -1;
+    if (!get_bit(ppu->reg_PPUMASK, mask_BG) || !get_bit(ppu->reg_PPUMASK, mask_SPRITES))
+        return -1;
+
+    uint8_t* sprite = ppu->oam;
+    uint8_t low, high;
+    ppu_sprite_row(ppu, sprite, &low, &high);
+
+    uint8_t sprite_mask = low | high;
+    if (sprite_mask == 0)
+        return -1;
+
+    // The background opacity comes from the plane cache, so it has to be
+    // current even on frames that are not being drawn.
+    ppu_plane_refresh(ppu);
+
+    uint16_t scroll_x = ppu_scroll_x(ppu);
+    uint16_t plane_y  = (ppu_scroll_y(ppu) + ppu->scanline) % (BG_PLANE_HEIGHT);
+    bool left_clipped = !get_bit(ppu->reg_PPUMASK, mask_LEFTBG) ||
+        !get_bit(ppu->reg_PPUMASK, mask_LEFTSPRITES);
+
+    for (int col = 0; col < 8; ++col) {
+        int16_t x = sprite[3] + col;
+
+        // No hit at x = 255 or inside a clipped left column
+        if (x >= FRAME_WIDTH - 1)
+            break;
+        if (x < 8 && left_clipped)
+            continue;
+        if (!get_bit(sprite_mask, 7 - col))
+            continue;
+
+        uint8_t bg = ppu->bg_planes[plane_y][(scroll_x + x) % (BG_PLANE_WIDTH)];
+        if (bg & 0b11)
+            return x;
+    }
+
+    return -1;
+}
+
+void ppu_render_sprites(PPU_t* ppu) {
+    memset(ppu->sprite_line, 0, FRAME_WIDTH);
+
+    if (!get_bit(ppu->reg_PPUMASK, mask_SPRITES))
+        return;
+
+    // Lower OAM indices win, so draw back to front
+    for (int i = ppu->sprite_count - 1; i >= 0; --i) {
+        uint8_t* sprite = &ppu->secondary_oam[i * (SPRITE_SIZE)];
+        uint8_t low, high;
+        ppu_sprite_row(ppu, sprite, &low, &high);
+
+        uint8_t attributes = 0x10 | ((sprite[2] & 0b11) << 2);
+        if (get_bit(sprite[2], 5)) // Behind background
+            attributes |= SPRITE_BEHIND_BG;
+
+        for (int col = 0; col < 8; ++col) {
+            int16_t x = sprite[3] + col;
+            uint8_t bit = 7 - col;
+            uint8_t value = (get_bit(high, bit) << 1) | get_bit(low, bit);
+
+            if (x >= FRAME_WIDTH)
+                break;
+            if (value != 0)
+                ppu->sprite_line[x] = attributes | value;
+        }
+    }
+}
+
+void ppu_compose_scanline(PPU_t* ppu) {
+    bool bg_enabled = get_bit(ppu->reg_PPUMASK, mask_BG);
+    uint16_t* out = ppu->framebuffer[ppu->scanline];
+
+    // Emphasis and greyscale are baked into the pixel index here, so the
+    // output stage converts with a single table lookup whatever PPUMASK did
+    // over the course of the frame.
+    uint16_t emphasis = ((uint16_t) (ppu->reg_PPUMASK >> mask_RED)) << PIXEL_EMPHASIS_POS;
+    uint8_t color_mask = get_bit(ppu->reg_PPUMASK, mask_GRAYSCALE) ? 0x30 : 0x3F;
+
+    for (int x = 0; x < FRAME_WIDTH; ++x) {
+        uint8_t value = bg_enabled ? ppu->bg_line[x] : 0;
+        uint8_t sprite = ppu->sprite_line[x];
+
+        if (x < 8 && !get_bit(ppu->reg_PPUMASK, mask_LEFTBG))
+            value = 0;
+        if (x < 8 && !get_bit(ppu->reg_PPUMASK, mask_LEFTSPRITES))
+            sprite = 0;
+
+        // Opaque sprite pixels win unless they sit behind an opaque
+        // background pixel
+        if ((sprite & 0b11) && !((sprite & SPRITE_BEHIND_BG) && (value & 0b11)))
+            value = sprite & 0x1F;
+
+        // Transparent pixels fall through to the universal background colour
+        uint8_t index = (value & 0b11) ? ppu->pallette_indices[value] : ppu->pallette_indices[0];
+
+        out[x] = emphasis | (index & color_mask);
+    }
+}
+
+// Background plane cache
+void ppu_plane_invalidate(PPU_t* ppu) {
+    memset(ppu->bg_tile_dirty, true, 4 * NAMETABLE_TILES * sizeof(bool));
+    memset(ppu->bg_chr_dirty, false, 256 * sizeof(bool));
+    ppu->bg_any_dirty = true;
+    ppu->bg_any_chr_dirty = false;
+    ppu->bg_plane_ptable = ppu_base_patterntable(ppu);
+}
+
+void ppu_plane_mark_nametable(PPU_t* ppu, uint16_t address) {
+    uint16_t offset = (address - 0x2000) % (NAMETABLE_SIZE);
+    uint8_t* target = ppu_nametable_read(ppu, (address - 0x2000) % (4 * (NAMETABLE_SIZE)));
+
+    // Every logical nametable that mirrors the written byte needs refreshing
+    for (uint8_t table = 0; table < 4; ++table) {
+        if (ppu_nametable_read(ppu, table * (NAMETABLE_SIZE) + offset) != target)
+            continue;
+
+        if (offset < ATTRIBUTE_OFFSET) {
+            ppu->bg_tile_dirty[table][offset] = true;
+        } else {
+            // One attribute byte covers a 4x4 block of tiles
+            uint8_t block_x = ((offset - ATTRIBUTE_OFFSET) % 8) * 4;
+            uint8_t block_y = ((offset - ATTRIBUTE_OFFSET) / 8) * 4;
+
+            for (uint8_t y = block_y; y < block_y + 4 && y < NAMETABLE_ROWS; ++y)
+                for (uint8_t x = block_x; x < block_x + 4; ++x)
+                    ppu->bg_tile_dirty[table][y * NAMETABLE_COLS + x] = true;
+        }
+    }
+
+    ppu->bg_any_dirty = true;
+}
+
+void ppu_plane_mark_chr(PPU_t* ppu, uint16_t address) {
+    if ((address & 0x1000) != ppu->bg_plane_ptable)
+        return;
+
+    ppu->bg_chr_dirty[(address >> 4) & 0xFF] = true;
+    ppu->bg_any_chr_dirty = true;
+}
+
+void ppu_plane_refresh(PPU_t* ppu) {
+    // Switching the background pattern table redraws everything
+    if (ppu_base_patterntable(ppu) != ppu->bg_plane_ptable)
+        ppu_plane_invalidate(ppu);
+
+    // Find every nametable entry that references a modified CHR tile
+    if (ppu->bg_any_chr_dirty) {
+        for (uint8_t table = 0; table < 4; ++table) {
+            for (uint16_t tile = 0; tile < NAMETABLE_TILES; ++tile) {
+                uint8_t index = *ppu_nametable_read(ppu, table * (NAMETABLE_SIZE) + tile);
+                if (ppu->bg_chr_dirty[index])
+                    ppu->bg_tile_dirty[table][tile] = true;
+            }
+        }
+
+        memset(ppu->bg_chr_dirty, false, 256 * sizeof(bool));
+        ppu->bg_any_chr_dirty = false;
+        ppu->bg_any_dirty = true;
+    }
+
+    if (!ppu->bg_any_dirty)
+        return;
+
+    for (uint8_t table = 0; table < 4; ++table) {
+        for (uint16_t tile = 0; tile < NAMETABLE_TILES; ++tile) {
+            if (ppu->bg_tile_dirty[table][tile]) {
+                ppu_plane_render_tile(ppu, table, tile);
+                ppu->bg_tile_dirty[table][tile] = false;
+            }
+        }
+    }
+
+    ppu->bg_any_dirty = false;
+}
+
+void ppu_plane_render_tile(PPU_t* ppu, uint8_t table, uint16_t tile) {
+    uint16_t base = table * (NAMETABLE_SIZE);
+    uint8_t tile_x = tile % NAMETABLE_COLS;
+    uint8_t tile_y = tile / NAMETABLE_COLS;
+
+    uint8_t pattern = *ppu_nametable_read(ppu, base + tile);
+    uint8_t attribute = *ppu_nametable_read(ppu,
+        base + ATTRIBUTE_OFFSET + (tile_y / 4) * 8 + tile_x / 4);
+    // Each attribute byte holds four 2-bit palettes for 2x2 tile quadrants
+    uint8_t shift = ((tile_y & 0b10) << 1) | (tile_x & 0b10);
+    uint8_t palette = ((attribute >> shift) & 0b11) << 2;
+
+    const uint8_t* bitmap = ppu_vram_ptr(ppu, ppu->bg_plane_ptable + pattern * 16);
+    uint16_t plane_x = (table & 1) * FRAME_WIDTH + tile_x * (TILE_SIZE);
+    uint16_t plane_y = (table >> 1) * FRAME_HEIGHT + tile_y * (TILE_SIZE);
+
+    for (int row = 0; row < (TILE_SIZE); ++row) {
+        uint8_t low  = bitmap[row];
+        uint8_t high = bitmap[row + 8];
+        uint8_t* out = &ppu->bg_planes[plane_y + row][plane_x];
+
+        for (int col = 0; col < (TILE_SIZE); ++col) {
+            uint8_t bit = 7 - col;
+            out[col] = palette | (get_bit(high, bit) << 1) | get_bit(low, bit);
+        }
+    }
+}
+
+void ppu_plane_window_copy(PPU_t* ppu, uint16_t x0, uint16_t x1, uint16_t scroll_x, uint16_t plane_y) {
+    const uint8_t* row = ppu->bg_planes[plane_y];
+
+    // The window may wrap around the right edge of the plane
+    while (x0 < x1) {
+        uint16_t src = (scroll_x + x0) % (BG_PLANE_WIDTH);
+        uint16_t len = x1 - x0;
+        if (src + len > BG_PLANE_WIDTH)
+            len = BG_PLANE_WIDTH - src;
+
+        memcpy(&ppu->bg_line[x0], &row[src], len);
+        x0 += len;
+    }
+}
+
+uint8_t ppu_bg_pixel_exact(PPU_t* ppu, uint16_t plane_x, uint16_t plane_y) {
+    uint8_t table = (plane_y / FRAME_HEIGHT) * 2 + plane_x / FRAME_WIDTH;
+    uint8_t tile_x = (plane_x % FRAME_WIDTH) / (TILE_SIZE);
+    uint8_t tile_y = (plane_y % FRAME_HEIGHT) / (TILE_SIZE);
+    uint16_t base = table * (NAMETABLE_SIZE);
+
+    uint8_t pattern = *ppu_nametable_read(ppu, base + tile_y * NAMETABLE_COLS + tile_x);
+    uint8_t attribute = *ppu_nametable_read(ppu,
+        base + ATTRIBUTE_OFFSET + (tile_y / 4) * 8 + tile_x / 4);
+    uint8_t shift = ((tile_y & 0b10) << 1) | (tile_x & 0b10);
+
+    const uint8_t* bitmap = ppu_vram_ptr(ppu, ppu_base_patterntable(ppu) + pattern * 16);
+    uint8_t row = plane_y % (TILE_SIZE);
+    uint8_t bit = 7 - (plane_x % (TILE_SIZE));
+
+    return (((attribute >> shift) & 0b11) << 2) |
+        (get_bit(bitmap[row + 8], bit) << 1) |
+        get_bit(bitmap[row], bit);
+}
+
+void ppu_register_written(PPU_t* ppu) {
+    // Only writes landing while the background is being fetched matter
+    if (ppu->scanline >= 0 && ppu->scanline < FRAME_HEIGHT &&
+        ppu->scanline_cycle > 0 && ppu->scanline_cycle <= FRAME_WIDTH &&
+        ppu_rendering_enabled(ppu))
+        ppu->bg_exact_line = true;
+}
+
 // Helper functions
 bool ppu_rendering_enabled(PPU_t* ppu) {
     // Rendering is considered disabled if both the sprite and background layers
@@ -185,15 +625,105 @@ uint16_t ppu_base_nametable(PPU_t* ppu) {
 }
 
 uint16_t ppu_base_patterntable(PPU_t* ppu) {
-    return get_bit(ppu->reg_PPUCTRL, ctrl_BGPTABLE) ? 0x0000 : 0x1000;
+    return get_bit(ppu->reg_PPUCTRL, ctrl_BGPTABLE) ? 0x1000 : 0x0000;
+}
+
+// Scroll position on the 512x480 plane formed by the four nametables
+uint16_t ppu_scroll_x(PPU_t* ppu) {
+    return ((ppu->reg_PPUCTRL & 0b01) * FRAME_WIDTH + (ppu->reg_PPUSCROLL & 0xFF))
+        % (BG_PLANE_WIDTH);
+}
+
+uint16_t ppu_scroll_y(PPU_t* ppu) {
+    return (((ppu->reg_PPUCTRL & 0b10) >> 1) * FRAME_HEIGHT + (ppu->reg_PPUSCROLL >> 8))
+        % (BG_PLANE_HEIGHT);
 }
 
 uint8_t ppu_vram_inc(PPU_t* ppu) {
     return get_bit(ppu->reg_PPUCTRL, ctrl_VRAMINC) ? 32 : 1;
 }
 
+static int64_t ppu_floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b < 0);
+}
+
+// Start of scanline 0 of the current frame
+static int64_t ppu_frame_origin(PPU_t* ppu) {
+    int16_t line = ppu->scanline < 0 ? 261 : ppu->scanline;
+    return (int64_t) (ppu->cycle - ppu->scanline_cycle) - line * (CYCLES_PER_SCANLINE);
+}
+
+// How many times a rendered line (0-239 and the pre-render line) has reached
+// `dot` by PPU cycle `cycle`, counted from an arbitrary but fixed point. Every
+// frame is taken to be FRAME_CYCLES long, so counts are exact near the
+// current frame and drift by the odd frame skip further out.
+int64_t ppu_dot_count(PPU_t* ppu, uint16_t dot, uint64_t cycle) {
+    int64_t offset = (int64_t) cycle - ppu_frame_origin(ppu);
+    int64_t frame = ppu_floor_div(offset, FRAME_CYCLES);
+    int64_t into = offset - frame * (FRAME_CYCLES);
+    int64_t count = frame * ((FRAME_HEIGHT) + 1);
+
+    if (into >= dot) {
+        int64_t lines = (into - dot) / (CYCLES_PER_SCANLINE) + 1;
+        count += lines < (FRAME_HEIGHT) ? lines : (FRAME_HEIGHT);
+    }
+    if (into >= 261 * (CYCLES_PER_SCANLINE) + dot)
+        count++;
+
+    return count;
+}
+
+// The PPU cycle the `n`th such dot falls on
+uint64_t ppu_dot_cycle(PPU_t* ppu, uint16_t dot, int64_t n) {
+    int64_t frame = ppu_floor_div(n - 1, (FRAME_HEIGHT) + 1);
+    int64_t line = (n - 1) - frame * ((FRAME_HEIGHT) + 1);
+
+    if (line == (FRAME_HEIGHT))
+        line = 261;
+
+    return ppu_frame_origin(ppu) + frame * (FRAME_CYCLES) + line * (CYCLES_PER_SCANLINE) + dot;
+}
+
+// Puts the NMI on the CPU's schedule for the next time the vblank flag goes
+// up, or takes it off when PPUCTRL turns NMIs off. Without a PPU thread
+// there's no vblank to wait for.
+void ppu_schedule_nmi(PPU_t* ppu) {
+    CPU_t* cpu = ppu->cpu;
+
+    if (!get_bit(ppu->reg_PPUCTRL, ctrl_NMI) || cpu->headless) {
+        ppu->nmi_cycle = SCHED_NEVER;
+        sched_set(&cpu->sched, SCHED_NMI, SCHED_NEVER);
+        return;
+    }
+
+    int64_t vblank = ppu_frame_origin(ppu) + VBLANK_SCANLINE * (CYCLES_PER_SCANLINE) + 2;
+    if (vblank <= (int64_t) ppu->cycle)
+        vblank += (FRAME_CYCLES);
+
+    ppu->nmi_cycle = vblank;
+    sched_set(&cpu->sched, SCHED_NMI, cpu->cycle + (vblank - ppu->cycle + 2) / 3);
+}
+
+// Runs on the CPU at the cycle picked by ppu_schedule_nmi()
+void ppu_nmi_event(PPU_t* ppu) {
+    CPU_t* cpu = ppu->cpu;
+
+    // The PPU can be a dot or two behind, check again next cycle
+    if (ppu->cycle < ppu->nmi_cycle) {
+        sched_set(&cpu->sched, SCHED_NMI, cpu->cycle + 1);
+        return;
+    }
+
+    cpu->sig_NMI = false;
+    cpu->poll = true;
+    ppu_schedule_nmi(ppu);
+}
+
 const uint8_t* ppu_rgb_from_pallette(PPU_t* ppu, uint8_t i) {
-    return REF_PALLETTE_MAP[i & 0b00111111];
+    uint16_t emphasis = ((uint16_t) (ppu->reg_PPUMASK >> mask_RED)) << PIXEL_EMPHASIS_POS;
+    uint8_t color_mask = get_bit(ppu->reg_PPUMASK, mask_GRAYSCALE) ? 0x30 : 0x3F;
+
+    return pallette_rgb24[emphasis | (i & color_mask)];
 }
 
 // Memory functions
@@ -201,11 +731,11 @@ void ppu_write_oam_from_reg(PPU_t* ppu) {
     ppu->oam[ppu->reg_OAMADDR++] = ppu->reg_OAMDATA;
 }
 
-uint8_t* ppu_read_oam_from_reg(PPU_t* ppu) {
+uint8_t* ppu_read_oam_from_reg(PPU_t* ppu, uint8_t i) {
     if (get_bit(ppu->reg_PPUSTATUS, stat_VBLANK))
-        return &ppu->oam[ppu->reg_OAMDATA];
+        return &ppu->oam[i];
     else
-        return &ppu->oam[ppu->reg_OAMDATA++];
+        return &ppu->oam[ppu->reg_OAMADDR++];
 }
 
 void ppu_fake_memory_access(PPU_t* ppu) {
@@ -213,37 +743,71 @@ void ppu_fake_memory_access(PPU_t* ppu) {
     ppu_tick(ppu);
 }
 
-uint8_t* ppu_memory_map_read(PPU_t* ppu, uint16_t address) {
-    ppu_tick(ppu);
-    ppu_tick(ppu);
+// Addresses $3F10, $3F14, $3F18, and $3F1C map to $3F0X, every other palette
+// address maps onto itself.
+static const uint8_t PALLETTE_REMAP[PALLETTE_IND_SIZE] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+    0x00, 0x11, 0x12, 0x13, 0x04, 0x15, 0x16, 0x17,
+    0x08, 0x19, 0x1A, 0x1B, 0x0C, 0x1D, 0x1E, 0x1F
+};
+
+// Which physical nametable each of the four logical ones shows
+static const uint8_t NAMETABLE_LAYOUT[5][4] = {
+    [MIRROR_HORIZONTAL]  = {0, 0, 1, 1},
+    [MIRROR_VERTICAL]    = {0, 1, 0, 1},
+    [MIRROR_SINGLE_LOW]  = {0, 0, 0, 0},
+    [MIRROR_SINGLE_HIGH] = {1, 1, 1, 1},
+    [MIRROR_FOUR]        = {0, 1, 2, 3}
+};
+
+// Picks up the cartridge's current CHR banks and mirroring. Only tiles from
+// CHR pages that actually moved are redrawn in the background cache.
+void ppu_map_rebuild(PPU_t* ppu) {
+    ROM_t* rom = ppu->cartridge;
+
+    for (uint16_t i = 0; i < CHR_WINDOWS; ++i) {
+        if (ppu->page_table[i] == rom->chr_banks[i])
+            continue;
+
+        ppu->page_table[i] = rom->chr_banks[i];
+
+        for (uint16_t tile = 0; tile < (PPU_PAGE_SIZE) / 16; ++tile)
+            ppu_plane_mark_chr(ppu, i * (PPU_PAGE_SIZE) + tile * 16);
+    }
 
-    // The current 8KiB page of CHR ROM is mapped onto the $0000 - $2000 range
-    // of the PPU memory map.
-    if (address < 0x2000)
-        return &ppu->cartridge->chr_data[address];
-    // The PPU nametables are mapped onto $2000 - $3000.
-    else if (address >= 0x2000 && address < 0x3000)
-        return ppu_nametable_read(ppu, address - 0x2000);
-    // A mirror of $2000 - $2EFF exists in the range $3000 - $3EFF.
-    else if (address >= 0x3000 && address < 0x3EFF)
-        return ppu_nametable_read(ppu, address - 0x3000);
-    // The rest of memory is filled with repeating mirrors of the pallete
-    // indices.
-    else if (address >= 0x3F00 && address < 0x4000) {
-        uint8_t i = (address - 0x3F00) % PALLETTE_IND_SIZE;
-        switch (i) {
-            // Addresses $3F10, $3F14, $3F18, and $3F1C map to $3F0X
-            case 0x10:
-            case 0x14:
-            case 0x18:
-            case 0x1C:
-                return &ppu->pallette_indices[i - 0x10];
-            default:
-                return &ppu->pallette_indices[i];
-        }
+    // The nametables are mapped onto $2000 - $2FFF and mirrored again through
+    // $3000 - $3FFF. $3F00 - $3FFF is caught by the palette check before the
+    // page table is consulted.
+    bool moved = false;
+
+    for (int i = 0; i < 4; ++i) {
+        uint8_t* table = &ppu->memory[NAMETABLE_LAYOUT[rom->mirroring][i] * (NAMETABLE_SIZE)];
+
+        moved |= ppu->page_table[8 + i] != table;
+        ppu->page_table[8 + i] = table;
+        ppu->page_table[12 + i] = table;
+    }
+
+    // What the logical nametables show has changed underneath the cache
+    if (moved)
+        ppu_plane_invalidate(ppu);
+}
+
+uint8_t* ppu_vram_ptr(PPU_t* ppu, uint16_t address) {
     // Addresses above $3FFF are mirrors of $0000 - $3FFF
-    } else
-        return ppu_memory_map_read(ppu, address - 0x4000);
+    address &= 0x3FFF;
+
+    if (address >= 0x3F00)
+        return &ppu->pallette_indices[PALLETTE_REMAP[address & 0x1F]];
+
+    return ppu->page_table[address >> 10] + (address & ((PPU_PAGE_SIZE) - 1));
+}
+
+// The CPU's side of PPUDATA. Only resolves the address, the PPU accounts
+// for its own fetches, so this must never tick it.
+uint8_t* ppu_memory_map_read(PPU_t* ppu, uint16_t address) {
+    return ppu_vram_ptr(ppu, address);
 }
 
 uint8_t* ppu_memory_map_read_inc(PPU_t* ppu, uint16_t address) {
@@ -252,11 +816,18 @@ uint8_t* ppu_memory_map_read_inc(PPU_t* ppu, uint16_t address) {
 }
 
 void ppu_memory_map_write(PPU_t* ppu, uint16_t address, uint8_t value) {
-    ppu_tick(ppu);
-    ppu_tick(ppu);
+    address &= 0x3FFF;
+
+    if (address >= 0x2000) {
+        *ppu_vram_ptr(ppu, address) = value;
 
-    if (address >= 0x2000)
-        *ppu_memory_map_read(ppu, address) = value;
+        if (address < 0x3F00)
+            ppu_plane_mark_nametable(ppu, 0x2000 + (address - 0x2000) % 0x1000);
+    } else if (ppu->cartridge->chr_page_count == 0) {
+        // CHR RAM
+        *ppu_vram_ptr(ppu, address) = value;
+        ppu_plane_mark_chr(ppu, address);
+    }
 }
 
 void ppu_memory_map_write_inc(PPU_t* ppu, uint16_t address, uint8_t value) {
@@ -265,16 +836,6 @@ void ppu_memory_map_write_inc(PPU_t* ppu, uint16_t address, uint8_t value) {
 }
 
 uint8_t* ppu_nametable_read(PPU_t* ppu, uint16_t address) {
-    uint8_t  relative_addr = address % (NAMETABLE_SIZE);
-    uint8_t* table1_result = &ppu->memory[relative_addr];
-    uint8_t* table2_result = &ppu->memory[(NAMETABLE_SIZE) + relative_addr];
-
-    // Switch over the nametable index
-    switch (address / (NAMETABLE_SIZE)) {
-        case 0: return table1_result;
-        case 1: return ppu->mirroring ? table1_result : table2_result;
-        case 2: return ppu->mirroring ? table2_result : table1_result;
-        case 3: return table2_result;
-        default: return NULL;
-    }
+    // address is relative to $2000
+    return ppu->page_table[8 + ((address >> 10) & 0b11)] + (address % (NAMETABLE_SIZE));
 }
@@ -12,10 +12,21 @@
 #define TILE_SIZE           1 << 3  // 8 pixels
 #define TILES_PER_SCANLINE  (FRAME_WIDTH) / (TILE_SIZE)
 #define NAMETABLE_SIZE      1 << 10 // 1KiB
+#define NAMETABLE_COLS      32
+#define NAMETABLE_ROWS      30
+#define ATTRIBUTE_OFFSET    0x3C0
 #define RENDERING_MASK      0b00011000
+#define SPRITE_BEHIND_BG    0x80 // Priority flag in sprite_line pixels
+#define FRAME_CYCLES        (NUM_SCANELINES) * (CYCLES_PER_SCANLINE)
+#define VBLANK_SCANLINE     241
 
-PPU_t* ppu_init(ROM_t* cartridge);
-void ppu_free(PPU_t* ppu);
+// Where the first pattern fetch from each table lands on a rendered line,
+// counted in cycles from the start of the line
+#define A12_SPRITE_DOT      261 // Sprite patterns for the next line
+#define A12_BG_DOT          325 // First tile of the next line
+#define A12_FILTER          16  // Cycles A12 has to stay low before a rise counts
+
+void ppu_init(PPU_t* ppu, ROM_t* cartridge);
 
 // Cycle instructions
 void ppu_start(PPU_t* ppu);
@@ -23,21 +34,47 @@ void ppu_tick(PPU_t* ppu);
 
 // Rendering functions
 void ppu_render_scanline(PPU_t* ppu);
+void ppu_frame_complete(PPU_t* ppu);
 void ppu_prerender_scanline(PPU_t* ppu);
 void ppu_visible_scanline(PPU_t* ppu);
 void ppu_idle_scanline(PPU_t* ppu);
 void ppu_vblank_scanline(PPU_t* ppu);
+void ppu_fetch_sprites(PPU_t* ppu);
+void ppu_fetch_next_tiles(PPU_t* ppu);
+void ppu_a12_fetch(PPU_t* ppu, bool high);
 void ppu_sprite_eval(PPU_t* ppu);
+void ppu_sprite_row(PPU_t* ppu, uint8_t* sprite, uint8_t* low, uint8_t* high);
+int16_t ppu_sprite0_hit_x(PPU_t* ppu);
+void ppu_render_sprites(PPU_t* ppu);
 uint8_t ppu_get_pallette(PPU_t* ppu, bool sprite, uint8_t num, uint8_t value);
+void ppu_compose_scanline(PPU_t* ppu);
+
+// Background plane cache
+void ppu_plane_invalidate(PPU_t* ppu);
+void ppu_plane_mark_nametable(PPU_t* ppu, uint16_t address);
+void ppu_plane_mark_chr(PPU_t* ppu, uint16_t address);
+void ppu_plane_refresh(PPU_t* ppu);
+void ppu_plane_render_tile(PPU_t* ppu, uint8_t table, uint16_t tile);
+void ppu_plane_window_copy(PPU_t* ppu, uint16_t x0, uint16_t x1, uint16_t scroll_x, uint16_t plane_y);
+uint8_t ppu_bg_pixel_exact(PPU_t* ppu, uint16_t plane_x, uint16_t plane_y);
+void ppu_register_written(PPU_t* ppu);
 
 // Helper functions
 bool ppu_rendering_enabled(PPU_t* ppu);
 uint16_t ppu_base_nametable(PPU_t* ppu);
 uint16_t ppu_base_patterntable(PPU_t* ppu);
+uint16_t ppu_scroll_x(PPU_t* ppu);
+uint16_t ppu_scroll_y(PPU_t* ppu);
 uint8_t ppu_vram_inc(PPU_t* ppu);
 const uint8_t* ppu_rgb_from_pallette(PPU_t* ppu, uint8_t i);
+int64_t ppu_dot_count(PPU_t* ppu, uint16_t dot, uint64_t cycle);
+uint64_t ppu_dot_cycle(PPU_t* ppu, uint16_t dot, int64_t n);
+void ppu_schedule_nmi(PPU_t* ppu);
+void ppu_nmi_event(PPU_t* ppu);
 
 // Memory functions
+void ppu_map_rebuild(PPU_t* ppu);
+uint8_t* ppu_vram_ptr(PPU_t* ppu, uint16_t address);
 uint8_t* ppu_memory_map_read(PPU_t* ppu, uint16_t address);
 uint8_t* ppu_memory_map_read_inc(PPU_t* ppu, uint16_t address);
 uint8_t* ppu_nametable_read(PPU_t* ppu, uint16_t address);
@@ -49,7 +86,6 @@ uint8_t* ppu_read_oam_from_reg(PPU_t* ppu, uint8_t i);
 // OAM functions
 uint8_t* ppu_read_oam(PPU_t* ppu, uint8_t address);
 void ppu_write_oam_from_reg(PPU_t* ppu);
-uint16_t sprite_pattern_address(uint8_t* sprite);
 
 enum PPUStatusBits {
     stat_VBLANK     = 7,
@@ -65,7 +101,7 @@ enum PPUMaskBits {
     mask_SPRITES      = 4,
     mask_BG           = 3,
     mask_LEFTSPRITES  = 2,
-    mask_RIGHTSPRITES = 1,
+    mask_LEFTBG       = 1,
     mask_GRAYSCALE    = 0,
 };
 
@@ -79,72 +115,4 @@ enum PPUCtrlBits {
     ctrl_BASENTABLE  = 0b00000011
 };
 
-// NES reference pallette in 24-bit RGB
-const uint8_t REF_PALLETTE_MAP[64][3] = {
-    {0x7C, 0x7C, 0x7C}, // #7C7C7C
-    {0x00, 0x00, 0xFC}, // #0000FC
-    {0x00, 0x00, 0xBC}, // #0000BC
-    {0x44, 0x28, 0xBC}, // #4428BC
-    {0x94, 0x00, 0x84}, // #940084
-    {0xA8, 0x00, 0x20}, // #A80020
-    {0xA8, 0x10, 0x00}, // #A81000
-    {0x88, 0x14, 0x00}, // #881400
-    {0x50, 0x30, 0x00}, // #503000
-    {0x00, 0x78, 0x00}, // #007800
-    {0x00, 0x68, 0x00}, // #006800
-    {0x00, 0x58, 0x00}, // #005800
-    {0x00, 0x40, 0x58}, // #004058
-    {0x00, 0x00, 0x00}, // #000000
-    {0x00, 0x00, 0x00}, // #000000
-    {0x00, 0x00, 0x00}, // #000000
-    {0xBC, 0xBC, 0xBC}, // #BCBCBC
-    {0x00, 0x78, 0xF8}, // #0078F8
-    {0x00, 0x58, 0xF8}, // #0058F8
-    {0x68, 0x44, 0xFC}, // #6844FC
-    {0xD8, 0x00, 0xCC}, // #D800CC
-    {0xE4, 0x00, 0x58}, // #E40058
-    {0xF8, 0x38, 0x00}, // #F83800
-    {0xE4, 0x5C, 0x10}, // #E45C10
-    {0xAC, 0x7C, 0x00}, // #AC7C00
-    {0x00, 0xB8, 0x00}, // #00B800
-    {0x00, 0xA8, 0x00}, // #00A800
-    {0x00, 0xA8, 0x44}, // #00A844
-    {0x00, 0x88, 0x88}, // #008888
-    {0x00, 0x00, 0x00}, // #000000
-    {0x00, 0x00, 0x00}, // #000000
-    {0x00, 0x00, 0x00}, // #000000
-    {0xF8, 0xF8, 0xF8}, // #F8F8F8
-    {0x3C, 0xBC, 0xFC}, // #3CBCFC
-    {0x68, 0x88, 0xFC}, // #6888FC
-    {0x98, 0x78, 0xF8}, // #9878F8
-    {0xF8, 0x78, 0xF8}, // #F878F8
-    {0xF8, 0x58, 0x98}, // #F85898
-    {0xF8, 0x78, 0x58}, // #F87858
-    {0xFC, 0xA0, 0x44}, // #FCA044
-    {0xF8, 0xB8, 0x00}, // #F8B800
-    {0xB8, 0xF8, 0x18}, // #B8F818
-    {0x58, 0xD8, 0x54}, // #58D854
-    {0x58, 0xF8, 0x98}, // #58F898
-    {0x00, 0xE8, 0xD8}, // #00E8D8
-    {0x78, 0x78, 0x78}, // #787878
-    {0x00, 0x00, 0x00}, // #000000
-    {0x00, 0x00, 0x00}, // #000000
-    {0xFC, 0xFC, 0xFC}, // #FCFCFC
-    {0xA4, 0xE4, 0xFC}, // #A4E4FC
-    {0xB8, 0xB8, 0xF8}, // #B8B8F8
-    {0xD8, 0xB8, 0xF8}, // #D8B8F8
-    {0xF8, 0xB8, 0xF8}, // #F8B8F8
-    {0xF8, 0xA4, 0xC0}, // #F8A4C0
-    {0xF0, 0xD0, 0xB0}, // #F0D0B0
-    {0xFC, 0xE0, 0xA8}, // #FCE0A8
-    {0xF8, 0xD8, 0x78}, // #F8D878
-    {0xD8, 0xF8, 0x78}, // #D8F878
-    {0xB8, 0xF8, 0xB8}, // #B8F8B8
-    {0xB8, 0xF8, 0xD8}, // #B8F8D8
-    {0x00, 0xFC, 0xFC}, // #00FCFC
-    {0xF8, 0xD8, 0xF8}, // #F8D8F8
-    {0x00, 0x00, 0x00}, // #000000
-    {0x00, 0x00, 0x00}, // #000000
-};
-
 #endif
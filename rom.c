@@ -1,78 +1,305 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "rom.h"
 #include "console.h"
 #include "util.h"
+#include "mapper.h"
 
 ROM_t* rom_from_file(char* path) {
     ROM_t* rom = NULL;
-    uint8_t *buffer = NULL;
-    uint32_t file_size = 0;
-    FILE* rom_file = fopen(path, "rb");
+    uint8_t* image = NULL;
+    struct stat info;
+    int rom_file = open(path, O_RDONLY);
 
-    if (rom_file == NULL) {
+    if (rom_file < 0) {
         fprintf(stderr, "Error: Could not open file %s\n", path);
-        goto cleanup_fhandler;
+        return NULL;
     }
 
-    fseek(rom_file, 0, SEEK_END);
-    file_size = ftell(rom_file);
+    if (fstat(rom_file, &info) != 0 || !S_ISREG(info.st_mode)) {
+        fprintf(stderr, "Error: %s is not a regular file\n", path);
+        goto cleanup_fhandler;
+    }
 
     // Make sure the file is big enough for a header
-    if (file_size < (HEADER_SIZE)) {
-        fprintf(stderr, "Error: File too small, only %d bytes\n", file_size);
+    if (info.st_size < (HEADER_SIZE)) {
+        fprintf(stderr, "Error: File too small, only %ld bytes\n", (long) info.st_size);
         goto cleanup_fhandler;
     }
 
-    rewind(rom_file);
-    buffer = (uint8_t*) malloc(file_size * sizeof(char));
-    fread(buffer, file_size, 1, rom_file);
+    // Nothing is copied out of the file, so every instance of the same ROM
+    // shares the page cache and only the pages actually used get read
+    image = (uint8_t*) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, rom_file, 0);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map %s\n", path);
+        goto cleanup_fhandler;
+    }
 
     // Check for magic bytes
-    if (!(buffer[0] == 'N') ||
-        !(buffer[1] == 'E') ||
-        !(buffer[2] == 'S') ||
-        !(buffer[3] == 0x1A)) {
+    if (!(image[0] == 'N') ||
+        !(image[1] == 'E') ||
+        !(image[2] == 'S') ||
+        !(image[3] == 0x1A)) {
         fprintf(stderr, "Error: No magic bytes\n");
-        goto cleanup_filebuffer;
+        goto cleanup_image;
     }
 
-    rom = (ROM_t*) malloc(sizeof(ROM_t));
+    rom = (ROM_t*) calloc(1, sizeof(ROM_t));
 
-    rom->prg_page = 0;
-    rom->prg_page_count = buffer[4];
-    rom->chr_page_count = buffer[5];
-    rom->ram_page_count = buffer[8];
+    rom->image = image;
+    rom->image_size = info.st_size;
+    rom->owned = ROM_OWNS_IMAGE;
 
-    rom->flags6 = buffer[6];
-    rom->flags7 = buffer[7];
-    rom->flags9 = buffer[9];
+    rom->prg_page_count = image[4];
+    rom->chr_page_count = image[5];
+    rom->ram_page_count = image[8];
 
-    if (!rom_file_valid(rom, file_size)) {
+    rom->flags6 = image[6];
+    rom->flags7 = image[7];
+    rom->flags9 = image[9];
+
+    if (!rom_file_valid(rom, info.st_size)) {
         fprintf(stderr, "Error: File is not valid\n");
         free(rom);
-        return NULL;
+        rom = NULL;
+        goto cleanup_image;
+    }
+
+    rom->mapper = mapper_find(rom_mapper(rom));
+    if (rom->mapper == NULL) {
+        fprintf(stderr, "Error: Unsupported mapper %d\n", rom_mapper(rom));
+        free(rom);
+        rom = NULL;
+        goto cleanup_image;
     }
 
-    rom_load_pages(rom, buffer);
+    if (get_bit(rom->flags6, IGNORE_MIRROR))
+        rom->mirroring = MIRROR_FOUR;
+    else if (get_bit(rom->flags6, MIRRORING))
+        rom->mirroring = MIRROR_VERTICAL;
+    else
+        rom->mirroring = MIRROR_HORIZONTAL;
+
+    rom_load_pages(rom, image);
+    if (get_bit(rom->flags6, RAM_BATTERY))
+        rom_load_save(rom, path);
+
+    if (rom->mapper->reset != NULL)
+        rom->mapper->reset(rom);
+    goto cleanup_fhandler;
 
-cleanup_filebuffer:
-    free(buffer);
+cleanup_image:
+    munmap(image, info.st_size);
 cleanup_fhandler:
-    fclose(rom_file);
+    // The mapping outlives the descriptor
+    close(rom_file);
 
     return rom;
 }
 
 void rom_free(ROM_t* rom) {
-    free(rom->prg_data);
-    free(rom->chr_data);
-    free(rom->ram_data);
-    free(rom->trainer_data);
+    if (rom->owned & ROM_OWNS_IMAGE)
+        munmap(rom->image, rom->image_size);
+    if (rom->owned & ROM_OWNS_CHR)
+        free(rom->chr_data);
+    if (rom->owned & ROM_OWNS_RAM)
+        free(rom->ram_data);
+    free(rom->patch_data);
+    if (rom->owned & ROM_OWNS_SAVE) {
+        rom_flush_save(rom, true);
+        munmap(rom->ram_data, rom->ram_page_count * (RAM_PAGE_SIZE));
+    }
+
     free(rom);
 }
 
+// Moves `pointer` from somewhere in `from` to the same place in `to`
+static uint8_t* rom_rebase(uint8_t* pointer, uint8_t* from, uint8_t* to, size_t size) {
+    if (from != NULL && pointer >= from && pointer < from + size)
+        return to + (pointer - from);
+
+    return pointer;
+}
+
+// A copy of everything the game can change: mapper registers, the banks they
+// picked, CHR RAM, PRG RAM and cheat patches. The image itself is read-only
+// and stays shared with the original, which has to outlive the clone. Battery
+// RAM is copied too but the clone never writes it back to the .sav file.
+// NULL if any of it couldn't be allocated.
+ROM_t* rom_clone(ROM_t* rom) {
+    ROM_t* clone = (ROM_t*) malloc(sizeof(ROM_t));
+    size_t ram_size = rom->ram_page_count * (RAM_PAGE_SIZE);
+    size_t patch_size = (PRG_READ_PAGES) * (PRG_READ_SIZE);
+
+    if (clone == NULL)
+        return NULL;
+
+    // Nothing is owned until it's been copied, so rom_free() can clean up
+    // after a clone that only got halfway
+    memcpy(clone, rom, sizeof(ROM_t));
+    clone->owned = 0;
+    clone->cpu = NULL;
+    clone->patch_data = NULL;
+
+    if (rom->owned & ROM_OWNS_CHR) {
+        clone->chr_data = (uint8_t*) malloc(rom->chr_size);
+        if (clone->chr_data == NULL) {
+            rom_free(clone);
+            return NULL;
+        }
+
+        memcpy(clone->chr_data, rom->chr_data, rom->chr_size);
+        clone->owned |= ROM_OWNS_CHR;
+
+        for (uint8_t i = 0; i < CHR_WINDOWS; ++i)
+            clone->chr_banks[i] = rom_rebase(rom->chr_banks[i], rom->chr_data, clone->chr_data, rom->chr_size);
+    }
+
+    if (rom->ram_data != NULL) {
+        clone->ram_data = (uint8_t*) malloc(ram_size);
+        if (clone->ram_data == NULL) {
+            rom_free(clone);
+            return NULL;
+        }
+
+        memcpy(clone->ram_data, rom->ram_data, ram_size);
+        clone->owned |= ROM_OWNS_RAM;
+    }
+
+    if (rom->patch_data != NULL) {
+        clone->patch_data = (uint8_t*) malloc(patch_size);
+        if (clone->patch_data == NULL) {
+            rom_free(clone);
+            return NULL;
+        }
+
+        memcpy(clone->patch_data, rom->patch_data, patch_size);
+
+        for (uint8_t i = 0; i < PRG_READ_PAGES; ++i)
+            clone->prg_read[i] = rom_rebase(rom->prg_read[i], rom->patch_data, clone->patch_data, patch_size);
+    }
+
+    return clone;
+}
+
+// Pointers into the image, or patched copies of it, can't be written through
+bool rom_in_image(ROM_t* rom, uint8_t* address) {
+    if (rom->patch_data != NULL && address >= rom->patch_data &&
+        address < rom->patch_data + (PRG_READ_PAGES) * (PRG_READ_SIZE))
+        return true;
+
+    return address >= rom->image && address < rom->image + rom->image_size;
+}
+
+// Points a CPU page back at its bank, or copies the bank into the page's
+// patch buffer and applies every cheat on it whose compare byte matches
+static void rom_refresh_page(ROM_t* rom, uint8_t page) {
+    uint8_t* bank = rom->prg_banks[page / ((PRG_WINDOW_SIZE) / (PRG_READ_SIZE))] +
+        (page % ((PRG_WINDOW_SIZE) / (PRG_READ_SIZE))) * (PRG_READ_SIZE);
+
+    if (!rom->patched[page]) {
+        rom->prg_read[page] = bank;
+        return;
+    }
+
+    uint8_t* copy = &rom->patch_data[page * (PRG_READ_SIZE)];
+    memcpy(copy, bank, PRG_READ_SIZE);
+
+    for (uint8_t i = 0; i < rom->patch_count; ++i) {
+        Cheat_t* cheat = &rom->patches[i];
+        uint8_t offset = cheat->address & ((PRG_READ_SIZE) - 1);
+
+        if (((cheat->address - 0x8000) >> 8) != page)
+            continue;
+        if (!cheat->has_compare || bank[offset] == cheat->compare)
+            copy[offset] = cheat->value;
+    }
+
+    rom->prg_read[page] = copy;
+}
+
+// Called by the mappers whenever PRG windows have been switched
+void rom_refresh_prg(ROM_t* rom, uint8_t window, uint8_t count) {
+    uint8_t pages = (PRG_WINDOW_SIZE) / (PRG_READ_SIZE);
+
+    for (uint8_t page = window * pages; page < (window + count) * pages; ++page)
+        rom_refresh_page(rom, page);
+}
+
+bool rom_patch(ROM_t* rom, Cheat_t cheat) {
+    if (cheat.address < 0x8000 || rom->patch_count == CHEAT_MAX)
+        return false;
+
+    if (rom->patch_data == NULL)
+        rom->patch_data = (uint8_t*) malloc((PRG_READ_PAGES) * (PRG_READ_SIZE));
+
+    uint8_t page = (cheat.address - 0x8000) >> 8;
+
+    rom->patches[rom->patch_count++] = cheat;
+    rom->patched[page] = true;
+    rom_refresh_page(rom, page);
+
+    return true;
+}
+
+// Battery backed RAM lives in a .sav file next to the ROM, mapped shared so
+// every write lands straight in the page cache. Even if the process gets
+// killed the kernel still writes it back. Falls back to the plain RAM from
+// rom_load_pages() when the file can't be used.
+bool rom_load_save(ROM_t* rom, char* rom_path) {
+    char path[PATH_MAX];
+    size_t size = rom->ram_page_count * (RAM_PAGE_SIZE);
+    struct stat info;
+
+    // Swap the extension, if there is one, for .sav
+    char* slash = strrchr(rom_path, '/');
+    char* dot = strrchr(rom_path, '.');
+    int stem = dot != NULL && (slash == NULL || dot > slash) ? dot - rom_path : (int) strlen(rom_path);
+    snprintf(path, sizeof(path), "%.*s.sav", stem, rom_path);
+
+    int save_file = open(path, O_RDWR | O_CREAT, 0644);
+    if (save_file < 0) {
+        fprintf(stderr, "Warning: Could not open %s, the game won't be saved\n", path);
+        return false;
+    }
+
+    // New saves start out zeroed, and a short one is padded out
+    if (fstat(save_file, &info) != 0 || (info.st_size < (off_t) size && ftruncate(save_file, size) != 0)) {
+        fprintf(stderr, "Warning: Could not size %s, the game won't be saved\n", path);
+        close(save_file);
+        return false;
+    }
+
+    uint8_t* ram = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, save_file, 0);
+    close(save_file);
+
+    if (ram == MAP_FAILED) {
+        fprintf(stderr, "Warning: Could not map %s, the game won't be saved\n", path);
+        return false;
+    }
+
+    if (rom->owned & ROM_OWNS_RAM)
+        free(rom->ram_data);
+
+    rom->ram_data = ram;
+    rom->owned = (rom->owned & ~ROM_OWNS_RAM) | ROM_OWNS_SAVE;
+
+    return true;
+}
+
+// Starts writing battery RAM back to disk. Only dirty pages go out, so this
+// is cheap enough to call every frame.
+void rom_flush_save(ROM_t* rom, bool wait) {
+    if (rom->owned & ROM_OWNS_SAVE)
+        msync(rom->ram_data, rom->ram_page_count * (RAM_PAGE_SIZE), wait ? MS_SYNC : MS_ASYNC);
+}
+
 bool rom_file_valid(ROM_t* rom, uint32_t buffer_len) {
     if (rom->prg_page_count == 0) {
         return false;
@@ -86,35 +313,38 @@ bool rom_file_valid(ROM_t* rom, uint32_t buffer_len) {
     return rom_computed_size <= buffer_len;
 }
 
+// Points PRG, CHR and the trainer into the mapped file
 void rom_load_pages(ROM_t* rom, uint8_t* buffer) {
     buffer += HEADER_SIZE; // Skip past headers
 
-    // Copy trainer data if present
     if (get_bit(rom->flags6, TRAINER)) {
-        rom->trainer_data = (uint8_t*) malloc(TRAINER_SIZE);
-        memcpy(rom->trainer_data, buffer, TRAINER_SIZE);
-
+        rom->trainer_data = buffer;
         buffer += TRAINER_SIZE;
     } else {
         rom->trainer_data = NULL;
     }
 
-    // Copy PRG data
-    uint32_t prg_data_size = rom->prg_page_count * (PRG_PAGE_SIZE);
-    rom->prg_data = (uint8_t*) malloc(prg_data_size);
-    memcpy(rom->prg_data, buffer, prg_data_size);
-    buffer += prg_data_size;
+    rom->prg_data = buffer;
+    rom->prg_size = rom->prg_page_count * (PRG_PAGE_SIZE);
+    buffer += rom->prg_size;
 
-    // Copy CHR data
-    uint32_t chr_data_size = rom->prg_page_count * (CHR_PAGE_SIZE);
-    rom->chr_data = (uint8_t*) malloc(chr_data_size);
-    memcpy(rom->chr_data, buffer, chr_data_size);
+    // Carts without CHR ROM have 8KiB of CHR RAM instead
+    if (rom->chr_page_count > 0) {
+        rom->chr_data = buffer;
+        rom->chr_size = rom->chr_page_count * (CHR_PAGE_SIZE);
+    } else {
+        rom->chr_data = (uint8_t*) calloc(1, CHR_PAGE_SIZE);
+        rom->chr_size = CHR_PAGE_SIZE;
+        rom->owned |= ROM_OWNS_CHR;
+    }
 
-    // Also initialize catridge RAM
-    if (rom->ram_page_count > 0)
-        rom->ram_data = (uint8_t*) malloc(rom->ram_page_count * (RAM_PAGE_SIZE));
-    else
-        rom->ram_data = NULL;
+    // Also initialize catridge RAM. A size of 0 means the 8KiB most boards
+    // have, since iNES 1.0 dumps rarely fill the field in.
+    if (rom->ram_page_count == 0)
+        rom->ram_page_count = 1;
+
+    rom->ram_data = (uint8_t*) calloc(rom->ram_page_count, RAM_PAGE_SIZE);
+    rom->owned |= ROM_OWNS_RAM;
 }
 
 uint8_t rom_mapper(ROM_t* rom) {
@@ -130,36 +360,45 @@ void rom_print_details(ROM_t* rom) {
     printf("\t->prg_page_count %d\n", rom->prg_page_count);
     printf("\t->chr_page_count %d\n", rom->chr_page_count);
     printf("\t->ram_page_count %d\n", rom->ram_page_count);
+    printf("\t->mapper %d (%s)\n", rom->mapper->number, rom->mapper->name);
     printf("\t->flags6 %02x\n", rom->flags6);
     printf("\t->flags7 %02x\n", rom->flags7);
     printf("\t->flags9 %02x\n", rom->flags9);
 }
 
 uint8_t* rom_map_read(ROM_t* rom, uint16_t address) {
-    uint8_t mapper = rom_mapper(rom);
-
-    switch (mapper) {
-        case 0:
-            if (address >= 0x6000 && address < 0x8000) {
-                if (rom->ram_page_count > 0)
-                    return &rom->ram_data[address - 0x6000];
-                else
-                    return &ZERO;
-            }
-
-            if (address >= 0x8000 && address < 0xC000)
-                return &rom->prg_data[address - 0x8000];
-
-            if (address >= 0xC000) {
-                if (rom->prg_page_count == 1)
-                    return &rom->prg_data[address - 0xC000]; // Mirror first page
-                else if (rom->prg_page_count == 2)
-                    return &rom->prg_data[address - 0xC000 + (PRG_PAGE_SIZE)];
-                else
-                    return &ZERO;
-            }
-        default:
-            fprintf(stderr, "Error: Unsupported mapper %d\n", mapper);
-            return &ZERO;
+    if (address >= 0x8000)
+        return &rom->prg_read[(address >> 8) & 0x7F][address & 0xFF];
+
+    if (address >= 0x6000 && rom->ram_page_count > 0)
+        return &rom->ram_data[address - 0x6000];
+
+    return &ZERO;
+}
+
+// Returns true when the PPU has to rebuild its view of the cartridge
+bool rom_map_write(ROM_t* rom, uint16_t address, uint8_t value) {
+    if (address >= 0x6000 && address < 0x8000) {
+        if (rom->ram_page_count > 0)
+            rom->ram_data[address - 0x6000] = value;
+
+        return false;
     }
+
+    if (rom->mapper->write == NULL)
+        return false;
+
+    return rom->mapper->write(rom, address, value);
+}
+
+// PPUCTRL or PPUMASK was written, which can move the mapper's IRQ
+void rom_ppu_changed(ROM_t* rom) {
+    if (rom->mapper->ppu_changed != NULL)
+        rom->mapper->ppu_changed(rom);
+}
+
+// Has the mapper's `event` run once the CPU reaches `cycle`
+void rom_schedule(ROM_t* rom, uint64_t cycle) {
+    if (rom->cpu != NULL)
+        sched_set(&rom->cpu->sched, SCHED_MAPPER, cycle);
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "cheat.h"
 
 #define HEADER_SIZE   1 << 4  // 16B
 #define TRAINER_SIZE  1 << 9  // 512B
@@ -10,8 +11,69 @@
 #define CHR_PAGE_SIZE 1 << 13 // 8KiB
 #define RAM_PAGE_SIZE 1 << 13 // 8KiB
 
+// Bank switching granularity. Every mapper's banks are made up of these.
+#define PRG_WINDOW_SIZE 1 << 12 // 4KiB
+#define PRG_WINDOWS     8       // $8000-$FFFF
+#define CHR_WINDOW_SIZE 1 << 10 // 1KiB
+#define CHR_WINDOWS     8       // $0000-$1FFF
+#define PRG_READ_SIZE   1 << 8  // 256B, the granularity of cheat patches
+#define PRG_READ_PAGES  128     // $8000-$FFFF
+
+typedef struct ROM_t ROM_t;
+
+typedef enum {
+    MIRROR_HORIZONTAL,
+    MIRROR_VERTICAL,
+    MIRROR_SINGLE_LOW,
+    MIRROR_SINGLE_HIGH,
+    MIRROR_FOUR
+} Mirroring;
+
+// A cartridge board. `write` sees every CPU write to $4020-$5FFF and
+// $8000-$FFFF and returns true when the PPU's view of CHR or mirroring moved,
+// boards without registers leave it NULL. `reset` may be NULL too.
+// Boards with an IRQ also get told about PPUCTRL/PPUMASK writes, run `event`
+// once the CPU reaches the cycle passed to rom_schedule() and, while the PPU is watching A12,
+// see every rise of it.
+typedef struct {
+    uint16_t    number;
+    const char* name;
+    void (*reset)(ROM_t* rom);
+    bool (*write)(ROM_t* rom, uint16_t address, uint8_t value);
+    void (*ppu_changed)(ROM_t* rom);
+    void (*event)(ROM_t* rom);
+    void (*a12_rise)(ROM_t* rom);
+} Mapper_t;
+
+typedef struct {
+    uint8_t shift;
+    uint8_t count;
+    uint8_t control;
+    uint8_t chr0;
+    uint8_t chr1;
+    uint8_t prg;
+} MMC1_t;
+
 typedef struct {
-    uint8_t  prg_page;
+    uint8_t  select;
+    uint8_t  regs[8];
+    uint8_t  irq_latch;
+    uint8_t  irq_counter;
+    bool     irq_reload;
+    bool     irq_enabled;
+    bool     irq_pending;
+    bool     irq_tracking; // The PPU reports each A12 rise
+    uint16_t irq_dot;      // Where the counter is clocked on a rendered line, 0 for never
+    uint64_t irq_synced;   // PPU cycle the counter is up to date with
+} MMC3_t;
+
+struct ROM_t {
+    // The file is mapped read-only and PRG, CHR and the trainer point straight
+    // into it. `owned` says which buffers rom_free() has to release.
+    uint8_t* image;
+    uint32_t image_size;
+    uint8_t  owned;
+
     uint8_t  prg_page_count;
     uint8_t* prg_data;
     uint8_t  chr_page_count;
@@ -23,19 +85,60 @@ typedef struct {
     uint8_t flags6;
     uint8_t flags7;
     uint8_t flags9;
-} ROM_t;
+
+    // What the CPU and PPU currently see. A bank switch only repoints these,
+    // so reads stay a single indexed load.
+    uint8_t*  prg_banks[PRG_WINDOWS];
+    uint8_t*  chr_banks[CHR_WINDOWS];
+    uint32_t  prg_size;
+    uint32_t  chr_size;
+    Mirroring mirroring;
+
+    // $8000-$FFFF as the CPU reads it. Pages point into prg_banks, except
+    // those with a cheat on them, which point at a patched copy in
+    // patch_data. Those are only rebuilt when the bank under them moves.
+    uint8_t*  prg_read[PRG_READ_PAGES];
+    uint8_t*  patch_data;
+    bool      patched[PRG_READ_PAGES];
+    Cheat_t   patches[CHEAT_MAX];
+    uint8_t   patch_count;
+
+    const Mapper_t* mapper;
+    struct CPU_t*   cpu; // The console it's plugged into
+    union {
+        MMC1_t mmc1;
+        MMC3_t mmc3;
+    } state;
+};
 
 ROM_t* rom_from_file(char* path);
 bool rom_file_valid(ROM_t* rom, uint32_t buffer_len);
 void rom_load_pages(ROM_t* rom, uint8_t* buffer);
+ROM_t* rom_clone(ROM_t* rom);
 void rom_free(ROM_t* rom);
+bool rom_in_image(ROM_t* rom, uint8_t* address);
+bool rom_patch(ROM_t* rom, Cheat_t cheat);
+void rom_refresh_prg(ROM_t* rom, uint8_t window, uint8_t count);
+bool rom_load_save(ROM_t* rom, char* rom_path);
+void rom_flush_save(ROM_t* rom, bool wait);
 
 uint8_t* rom_map_read(ROM_t* rom, uint16_t address);
+bool rom_map_write(ROM_t* rom, uint16_t address, uint8_t value);
+void rom_ppu_changed(ROM_t* rom);
+void rom_schedule(ROM_t* rom, uint64_t cycle);
 
 uint8_t rom_mapper(ROM_t* rom);
+bool rom_nes2(ROM_t* rom);
 
 void rom_print_details(ROM_t* rom);
 
+enum ROMOwnership {
+    ROM_OWNS_IMAGE = 1 << 0, // munmap
+    ROM_OWNS_CHR   = 1 << 1, // CHR RAM
+    ROM_OWNS_RAM   = 1 << 2,
+    ROM_OWNS_SAVE  = 1 << 3  // munmap, battery RAM backed by the .sav file
+};
+
 enum Flag6Masks {
     MIRRORING      = 0,
     RAM_BATTERY    = 1,
@@ -0,0 +1,438 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "scale.h"
+#include "pallette.h"
+
+bool scale_parse(char* name, ScaleFilter* filter, uint8_t* factor) {
+    *factor = 1;
+
+    if (strcmp(name, "scale2x") == 0) {
+        *filter = SCALE_2X;
+    } else if (strcmp(name, "scale3x") == 0) {
+        *filter = SCALE_3X;
+    } else if (strcmp(name, "xbr2x") == 0) {
+        *filter = SCALE_XBR2X;
+    } else if (strncmp(name, "nearest", 7) == 0) {
+        // "nearest3" and friends, plain "nearest" is 2x
+        *filter = SCALE_NEAREST;
+        *factor = name[7] == '\0' ? 2 : atoi(&name[7]);
+        return *factor >= 1 && *factor <= SCALE_MAX_FACTOR;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+uint8_t scale_factor(ScaleFilter filter, uint8_t factor) {
+    switch (filter) {
+        case SCALE_NEAREST: return factor;
+        case SCALE_2X:      return 2;
+        case SCALE_3X:      return 3;
+        case SCALE_XBR2X:   return 2;
+        default:            return 1;
+    }
+}
+
+void scale_band(ScaleFilter filter, uint8_t factor, const uint16_t (*src)[FRAME_WIDTH],
+    uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1) {
+    switch (filter) {
+        case SCALE_NEAREST: scale_nearest(factor, src, dst, pitch, y0, y1); break;
+        case SCALE_2X:      scale_scale2x(src, dst, pitch, y0, y1); break;
+        case SCALE_3X:      scale_scale3x(src, dst, pitch, y0, y1); break;
+        case SCALE_XBR2X:   scale_xbr2x(src, dst, pitch, y0, y1); break;
+    }
+}
+
+typedef struct {
+    ScaleFilter filter;
+    uint8_t factor;
+    const uint16_t (*src)[FRAME_WIDTH];
+    uint32_t* dst;
+    size_t pitch;
+    uint16_t y0;
+    uint16_t y1;
+} ScaleJob_t;
+
+static void* scale_worker(void* arg) {
+    ScaleJob_t* job = (ScaleJob_t*) arg;
+    scale_band(job->filter, job->factor, job->src, job->dst, job->pitch, job->y0, job->y1);
+    return NULL;
+}
+
+// Splits the frame into horizontal bands, the calling thread takes the first
+void scale_frame(ScaleFilter filter, uint8_t factor, const uint16_t (*src)[FRAME_WIDTH],
+    uint32_t* dst, size_t pitch, uint8_t bands) {
+    ScaleJob_t jobs[SCALE_MAX_BANDS];
+    pthread_t threads[SCALE_MAX_BANDS];
+    bool started[SCALE_MAX_BANDS];
+
+    if (bands < 1)
+        bands = 1;
+    if (bands > SCALE_MAX_BANDS)
+        bands = SCALE_MAX_BANDS;
+
+    for (uint8_t i = 0; i < bands; ++i) {
+        jobs[i] = (ScaleJob_t) {
+            filter, factor, src, dst, pitch,
+            FRAME_HEIGHT * i / bands, FRAME_HEIGHT * (i + 1) / bands
+        };
+
+        started[i] = i > 0 &&
+            pthread_create(&threads[i], NULL, &scale_worker, &jobs[i]) == 0;
+    }
+
+    scale_worker(&jobs[0]);
+
+    for (uint8_t i = 1; i < bands; ++i) {
+        // Do the band here if its thread could not be started
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            scale_worker(&jobs[i]);
+    }
+}
+
+// Nearest neighbour
+void scale_nearest(uint8_t factor, const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1) {
+    uint32_t rgb[FRAME_WIDTH];
+
+    for (uint16_t y = y0; y < y1; ++y) {
+        uint32_t* out = &dst[(size_t) y * factor * pitch];
+        uint16_t x = 0;
+
+        pallette_convert_xrgb8888(src[y], rgb, FRAME_WIDTH);
+
+#ifdef __SSE2__
+        if (factor == 2) {
+            for (; x + 4 <= FRAME_WIDTH; x += 4) {
+                __m128i pixels = _mm_loadu_si128((const __m128i*) &rgb[x]);
+                _mm_storeu_si128((__m128i*) &out[x * 2], _mm_unpacklo_epi32(pixels, pixels));
+                _mm_storeu_si128((__m128i*) &out[x * 2 + 4], _mm_unpackhi_epi32(pixels, pixels));
+            }
+        } else if (factor >= 4) {
+            for (; x < FRAME_WIDTH; ++x) {
+                __m128i pixel = _mm_set1_epi32(rgb[x]);
+                for (uint8_t i = 0; i + 4 <= factor; i += 4)
+                    _mm_storeu_si128((__m128i*) &out[x * factor + i], pixel);
+                for (uint8_t i = factor & ~3; i < factor; ++i)
+                    out[x * factor + i] = rgb[x];
+            }
+        }
+#endif
+
+        for (; x < FRAME_WIDTH; ++x)
+            for (uint8_t i = 0; i < factor; ++i)
+                out[x * factor + i] = rgb[x];
+
+        // The remaining lines of the block are copies of the first
+        for (uint8_t i = 1; i < factor; ++i)
+            memcpy(&out[i * pitch], out, FRAME_WIDTH * factor * sizeof(uint32_t));
+    }
+}
+
+// Copies a row with its edge pixels repeated once on each side
+static void scale_pad_row(const uint16_t* row, uint16_t* out) {
+    out[0] = row[0];
+    memcpy(&out[1], row, FRAME_WIDTH * sizeof(uint16_t));
+    out[FRAME_WIDTH + 1] = row[FRAME_WIDTH - 1];
+}
+
+static void scale_neighbour_rows(const uint16_t (*src)[FRAME_WIDTH], uint16_t y,
+    uint16_t* up, uint16_t* cur, uint16_t* down) {
+    scale_pad_row(src[y > 0 ? y - 1 : 0], up);
+    scale_pad_row(src[y], cur);
+    scale_pad_row(src[y < FRAME_HEIGHT - 1 ? y + 1 : y], down);
+}
+
+#ifdef __SSE2__
+static inline __m128i scale_select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+// Scale2x
+void scale_scale2x(const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1) {
+    uint16_t up[FRAME_WIDTH + 2], cur[FRAME_WIDTH + 2], down[FRAME_WIDTH + 2];
+    uint16_t out0[FRAME_WIDTH * 2], out1[FRAME_WIDTH * 2];
+
+    for (uint16_t y = y0; y < y1; ++y) {
+        uint16_t x = 0;
+        scale_neighbour_rows(src, y, up, cur, down);
+
+        //   B
+        // D E F  ->  E0 E1
+        //   H        E2 E3
+#ifdef __SSE2__
+        for (; x + 8 <= FRAME_WIDTH; x += 8) {
+            __m128i B = _mm_loadu_si128((const __m128i*) &up[x + 1]);
+            __m128i D = _mm_loadu_si128((const __m128i*) &cur[x]);
+            __m128i E = _mm_loadu_si128((const __m128i*) &cur[x + 1]);
+            __m128i F = _mm_loadu_si128((const __m128i*) &cur[x + 2]);
+            __m128i H = _mm_loadu_si128((const __m128i*) &down[x + 1]);
+
+            __m128i db = _mm_cmpeq_epi16(D, B);
+            __m128i bf = _mm_cmpeq_epi16(B, F);
+            __m128i dh = _mm_cmpeq_epi16(D, H);
+            __m128i hf = _mm_cmpeq_epi16(H, F);
+
+            __m128i e0 = scale_select(_mm_andnot_si128(bf, _mm_andnot_si128(dh, db)), D, E);
+            __m128i e1 = scale_select(_mm_andnot_si128(db, _mm_andnot_si128(hf, bf)), F, E);
+            __m128i e2 = scale_select(_mm_andnot_si128(db, _mm_andnot_si128(hf, dh)), D, E);
+            __m128i e3 = scale_select(_mm_andnot_si128(dh, _mm_andnot_si128(bf, hf)), F, E);
+
+            _mm_storeu_si128((__m128i*) &out0[x * 2],     _mm_unpacklo_epi16(e0, e1));
+            _mm_storeu_si128((__m128i*) &out0[x * 2 + 8], _mm_unpackhi_epi16(e0, e1));
+            _mm_storeu_si128((__m128i*) &out1[x * 2],     _mm_unpacklo_epi16(e2, e3));
+            _mm_storeu_si128((__m128i*) &out1[x * 2 + 8], _mm_unpackhi_epi16(e2, e3));
+        }
+#endif
+
+        for (; x < FRAME_WIDTH; ++x) {
+            uint16_t B = up[x + 1], D = cur[x], E = cur[x + 1], F = cur[x + 2], H = down[x + 1];
+
+            out0[x * 2]     = D == B && B != F && D != H ? D : E;
+            out0[x * 2 + 1] = B == F && B != D && F != H ? F : E;
+            out1[x * 2]     = D == H && D != B && H != F ? D : E;
+            out1[x * 2 + 1] = H == F && D != H && B != F ? F : E;
+        }
+
+        pallette_convert_xrgb8888(out0, &dst[(size_t) (y * 2) * pitch], FRAME_WIDTH * 2);
+        pallette_convert_xrgb8888(out1, &dst[(size_t) (y * 2 + 1) * pitch], FRAME_WIDTH * 2);
+    }
+}
+
+// Scale3x
+void scale_scale3x(const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1) {
+    uint16_t up[FRAME_WIDTH + 2], cur[FRAME_WIDTH + 2], down[FRAME_WIDTH + 2];
+    uint16_t e[9][FRAME_WIDTH];
+    uint16_t out[3][FRAME_WIDTH * 3];
+
+    for (uint16_t y = y0; y < y1; ++y) {
+        uint16_t x = 0;
+        scale_neighbour_rows(src, y, up, cur, down);
+
+        // A B C      E0 E1 E2
+        // D E F  ->  E3 E4 E5
+        // G H I      E6 E7 E8
+#ifdef __SSE2__
+        for (; x + 8 <= FRAME_WIDTH; x += 8) {
+            __m128i A = _mm_loadu_si128((const __m128i*) &up[x]);
+            __m128i B = _mm_loadu_si128((const __m128i*) &up[x + 1]);
+            __m128i C = _mm_loadu_si128((const __m128i*) &up[x + 2]);
+            __m128i D = _mm_loadu_si128((const __m128i*) &cur[x]);
+            __m128i E = _mm_loadu_si128((const __m128i*) &cur[x + 1]);
+            __m128i F = _mm_loadu_si128((const __m128i*) &cur[x + 2]);
+            __m128i G = _mm_loadu_si128((const __m128i*) &down[x]);
+            __m128i H = _mm_loadu_si128((const __m128i*) &down[x + 1]);
+            __m128i I = _mm_loadu_si128((const __m128i*) &down[x + 2]);
+
+            __m128i db = _mm_cmpeq_epi16(D, B);
+            __m128i bf = _mm_cmpeq_epi16(B, F);
+            __m128i dh = _mm_cmpeq_epi16(D, H);
+            __m128i hf = _mm_cmpeq_epi16(H, F);
+            __m128i ea = _mm_cmpeq_epi16(E, A);
+            __m128i ec = _mm_cmpeq_epi16(E, C);
+            __m128i eg = _mm_cmpeq_epi16(E, G);
+            __m128i ei = _mm_cmpeq_epi16(E, I);
+
+            // The four corner conditions of the Scale2x rules
+            __m128i c_db = _mm_andnot_si128(bf, _mm_andnot_si128(dh, db));
+            __m128i c_bf = _mm_andnot_si128(db, _mm_andnot_si128(hf, bf));
+            __m128i c_dh = _mm_andnot_si128(db, _mm_andnot_si128(hf, dh));
+            __m128i c_hf = _mm_andnot_si128(dh, _mm_andnot_si128(bf, hf));
+
+            __m128i m1 = _mm_or_si128(_mm_andnot_si128(ec, c_db), _mm_andnot_si128(ea, c_bf));
+            __m128i m3 = _mm_or_si128(_mm_andnot_si128(eg, c_db), _mm_andnot_si128(ea, c_dh));
+            __m128i m5 = _mm_or_si128(_mm_andnot_si128(ei, c_bf), _mm_andnot_si128(ec, c_hf));
+            __m128i m7 = _mm_or_si128(_mm_andnot_si128(ei, c_dh), _mm_andnot_si128(eg, c_hf));
+
+            _mm_storeu_si128((__m128i*) &e[0][x], scale_select(c_db, D, E));
+            _mm_storeu_si128((__m128i*) &e[1][x], scale_select(m1, B, E));
+            _mm_storeu_si128((__m128i*) &e[2][x], scale_select(c_bf, F, E));
+            _mm_storeu_si128((__m128i*) &e[3][x], scale_select(m3, D, E));
+            _mm_storeu_si128((__m128i*) &e[4][x], E);
+            _mm_storeu_si128((__m128i*) &e[5][x], scale_select(m5, F, E));
+            _mm_storeu_si128((__m128i*) &e[6][x], scale_select(c_dh, D, E));
+            _mm_storeu_si128((__m128i*) &e[7][x], scale_select(m7, H, E));
+            _mm_storeu_si128((__m128i*) &e[8][x], scale_select(c_hf, F, E));
+        }
+#endif
+
+        for (; x < FRAME_WIDTH; ++x) {
+            uint16_t A = up[x],   B = up[x + 1],   C = up[x + 2];
+            uint16_t D = cur[x],  E = cur[x + 1],  F = cur[x + 2];
+            uint16_t G = down[x], H = down[x + 1], I = down[x + 2];
+
+            bool c_db = D == B && B != F && D != H;
+            bool c_bf = B == F && B != D && F != H;
+            bool c_dh = D == H && D != B && H != F;
+            bool c_hf = H == F && D != H && B != F;
+
+            e[0][x] = c_db ? D : E;
+            e[1][x] = (c_db && E != C) || (c_bf && E != A) ? B : E;
+            e[2][x] = c_bf ? F : E;
+            e[3][x] = (c_db && E != G) || (c_dh && E != A) ? D : E;
+            e[4][x] = E;
+            e[5][x] = (c_bf && E != I) || (c_hf && E != C) ? F : E;
+            e[6][x] = c_dh ? D : E;
+            e[7][x] = (c_dh && E != I) || (c_hf && E != G) ? H : E;
+            e[8][x] = c_hf ? F : E;
+        }
+
+        for (int row = 0; row < 3; ++row) {
+            for (x = 0; x < FRAME_WIDTH; ++x) {
+                out[row][x * 3]     = e[row * 3][x];
+                out[row][x * 3 + 1] = e[row * 3 + 1][x];
+                out[row][x * 3 + 2] = e[row * 3 + 2][x];
+            }
+
+            pallette_convert_xrgb8888(out[row], &dst[(size_t) (y * 3 + row) * pitch], FRAME_WIDTH * 3);
+        }
+    }
+}
+
+// 2xBR
+//
+// Edge detection works on YUV distances between pallette entries, blending
+// is done on the RGB output. Every distance is looked up from a table since
+// a frame only ever uses a handful of colours.
+static uint8_t xbr_yuv[PALLETTE_ENTRIES][3];
+static uint16_t xbr_diff[PALLETTE_ENTRIES][PALLETTE_ENTRIES];
+static pthread_once_t xbr_once = PTHREAD_ONCE_INIT;
+
+static void xbr_build_tables() {
+    for (int i = 0; i < PALLETTE_ENTRIES; ++i) {
+        int r = pallette_rgb24[i][0];
+        int g = pallette_rgb24[i][1];
+        int b = pallette_rgb24[i][2];
+
+        xbr_yuv[i][0] = (int) ( 0.299 * r + 0.587 * g + 0.114 * b);
+        xbr_yuv[i][1] = (int) (-0.169 * r - 0.331 * g + 0.500 * b) + 128;
+        xbr_yuv[i][2] = (int) ( 0.500 * r - 0.419 * g - 0.081 * b) + 128;
+    }
+
+    for (int a = 0; a < PALLETTE_ENTRIES; ++a)
+        for (int b = 0; b < PALLETTE_ENTRIES; ++b)
+            xbr_diff[a][b] = abs(xbr_yuv[a][0] - xbr_yuv[b][0]) +
+                abs(xbr_yuv[a][1] - xbr_yuv[b][1]) +
+                abs(xbr_yuv[a][2] - xbr_yuv[b][2]);
+}
+
+static inline unsigned xbr_df(uint16_t a, uint16_t b) {
+    return xbr_diff[a][b];
+}
+
+static inline bool xbr_eq(uint16_t a, uint16_t b) {
+    return xbr_df(a, b) < 155;
+}
+
+// Moves each channel of a towards b by num / 2^shift
+static inline uint32_t xbr_blend(uint32_t a, uint32_t b, int num, int shift) {
+    uint32_t result = 0xFF000000;
+
+    for (int channel = 0; channel < 24; channel += 8) {
+        int ca = (a >> channel) & 0xFF;
+        int cb = (b >> channel) & 0xFF;
+        result |= (uint32_t) (ca + (((cb - ca) * num) >> shift)) << channel;
+    }
+
+    return result;
+}
+
+// One corner of the 2xBR kernel; the four corners are the same rule with the
+// neighbourhood rotated.
+static inline void xbr_corner(uint32_t* E,
+    uint16_t PE, uint16_t PI, uint16_t PH, uint16_t PF, uint16_t PG,
+    uint16_t PC, uint16_t PD, uint16_t PB,
+    uint16_t F4, uint16_t I4, uint16_t H5, uint16_t I5,
+    int N1, int N2, int N3) {
+    if (PE == PH || PE == PF)
+        return;
+
+    unsigned e = xbr_df(PE, PC) + xbr_df(PE, PG) + xbr_df(PI, H5) + xbr_df(PI, F4) + (xbr_df(PH, PF) << 2);
+    unsigned i = xbr_df(PH, PD) + xbr_df(PH, I5) + xbr_df(PF, I4) + xbr_df(PF, PB) + (xbr_df(PE, PI) << 2);
+
+    if (e > i)
+        return;
+
+    uint32_t px = pallette_xrgb8888[xbr_df(PE, PF) <= xbr_df(PE, PH) ? PF : PH];
+
+    if (e < i && ((!xbr_eq(PF, PB) && !xbr_eq(PH, PD)) ||
+        (xbr_eq(PE, PI) && !xbr_eq(PF, I4) && !xbr_eq(PH, I5)) ||
+        xbr_eq(PE, PG) || xbr_eq(PE, PC))) {
+        unsigned ke = xbr_df(PF, PG);
+        unsigned ki = xbr_df(PH, PC);
+        bool left = (ke << 1) <= ki && PE != PG && PD != PG;
+        bool up   = ke >= (ki << 1) && PE != PC && PB != PC;
+
+        if (left && up) {
+            E[N3] = xbr_blend(E[N3], px, 7, 3);
+            E[N2] = xbr_blend(E[N2], px, 1, 2);
+            E[N1] = E[N2];
+        } else if (left) {
+            E[N3] = xbr_blend(E[N3], px, 3, 2);
+            E[N2] = xbr_blend(E[N2], px, 1, 2);
+        } else if (up) {
+            E[N3] = xbr_blend(E[N3], px, 3, 2);
+            E[N1] = xbr_blend(E[N1], px, 1, 2);
+        } else {
+            E[N3] = xbr_blend(E[N3], px, 1, 1);
+        }
+    } else {
+        E[N3] = xbr_blend(E[N3], px, 1, 1);
+    }
+}
+
+void scale_xbr2x(const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1) {
+    pthread_once(&xbr_once, &xbr_build_tables);
+
+    for (int y = y0; y < y1; ++y) {
+        // Rows two above to two below, clamped at the frame edges
+        const uint16_t* r[5];
+        for (int i = 0; i < 5; ++i) {
+            int row = y + i - 2;
+            r[i] = src[row < 0 ? 0 : row >= FRAME_HEIGHT ? FRAME_HEIGHT - 1 : row];
+        }
+
+        uint32_t* out0 = &dst[(size_t) (y * 2) * pitch];
+        uint32_t* out1 = &dst[(size_t) (y * 2 + 1) * pitch];
+
+        for (int x = 0; x < FRAME_WIDTH; ++x) {
+            int c[5];
+            for (int i = 0; i < 5; ++i) {
+                int col = x + i - 2;
+                c[i] = col < 0 ? 0 : col >= FRAME_WIDTH ? FRAME_WIDTH - 1 : col;
+            }
+
+            //     A1 B1 C1
+            //  A0 PA PB PC C4
+            //  D0 PD PE PF F4
+            //  G0 PG PH PI I4
+            //     G5 H5 I5
+            uint16_t A1 = r[0][c[1]], B1 = r[0][c[2]], C1 = r[0][c[3]];
+            uint16_t A0 = r[1][c[0]], PA = r[1][c[1]], PB = r[1][c[2]], PC = r[1][c[3]], C4 = r[1][c[4]];
+            uint16_t D0 = r[2][c[0]], PD = r[2][c[1]], PE = r[2][c[2]], PF = r[2][c[3]], F4 = r[2][c[4]];
+            uint16_t G0 = r[3][c[0]], PG = r[3][c[1]], PH = r[3][c[2]], PI = r[3][c[3]], I4 = r[3][c[4]];
+            uint16_t G5 = r[4][c[1]], H5 = r[4][c[2]], I5 = r[4][c[3]];
+
+            uint32_t E[4];
+            E[0] = E[1] = E[2] = E[3] = pallette_xrgb8888[PE];
+
+            xbr_corner(E, PE, PI, PH, PF, PG, PC, PD, PB, F4, I4, H5, I5, 1, 2, 3);
+            xbr_corner(E, PE, PC, PF, PB, PI, PA, PH, PD, B1, C1, F4, C4, 0, 3, 1);
+            xbr_corner(E, PE, PA, PB, PD, PC, PG, PF, PH, D0, A0, B1, A1, 2, 1, 0);
+            xbr_corner(E, PE, PG, PD, PH, PA, PI, PB, PF, H5, G5, D0, G0, 3, 0, 2);
+
+            out0[x * 2]     = E[0];
+            out0[x * 2 + 1] = E[1];
+            out1[x * 2]     = E[2];
+            out1[x * 2 + 1] = E[3];
+        }
+    }
+}
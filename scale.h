@@ -0,0 +1,35 @@
+#ifndef SCALE_H__
+#define SCALE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "console.h"
+
+#define SCALE_MAX_FACTOR 8
+#define SCALE_MAX_BANDS  16
+
+typedef enum {
+    SCALE_NEAREST, // Integer pixel replication, any factor
+    SCALE_2X,      // Scale2x (EPX)
+    SCALE_3X,      // Scale3x
+    SCALE_XBR2X    // 2xBR, edge-directed with blending
+} ScaleFilter;
+
+// Upscalers working straight off the indexed framebuffer. They write XRGB8888
+// into the caller's buffer; `pitch` is the distance between destination rows
+// in pixels. Each call covers source rows [y0, y1), so a frame can be split
+// into horizontal bands and scaled on several threads.
+bool scale_parse(char* name, ScaleFilter* filter, uint8_t* factor);
+uint8_t scale_factor(ScaleFilter filter, uint8_t factor);
+void scale_band(ScaleFilter filter, uint8_t factor, const uint16_t (*src)[FRAME_WIDTH],
+    uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1);
+void scale_frame(ScaleFilter filter, uint8_t factor, const uint16_t (*src)[FRAME_WIDTH],
+    uint32_t* dst, size_t pitch, uint8_t bands);
+
+void scale_nearest(uint8_t factor, const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1);
+void scale_scale2x(const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1);
+void scale_scale3x(const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1);
+void scale_xbr2x(const uint16_t (*src)[FRAME_WIDTH], uint32_t* dst, size_t pitch, uint16_t y0, uint16_t y1);
+
+#endif
@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include "scheduler.h"
+
+static void sched_swap(Scheduler_t* sched, uint8_t a, uint8_t b) {
+    uint8_t event = sched->heap[a];
+
+    sched->heap[a] = sched->heap[b];
+    sched->heap[b] = event;
+    sched->index[sched->heap[a]] = a;
+    sched->index[sched->heap[b]] = b;
+}
+
+static uint64_t sched_at(Scheduler_t* sched, uint8_t i) {
+    return sched->cycle[sched->heap[i]];
+}
+
+void sched_init(Scheduler_t* sched) {
+    for (uint8_t i = 0; i < SCHED_EVENTS; ++i) {
+        sched->cycle[i] = SCHED_NEVER;
+        sched->heap[i] = i;
+        sched->index[i] = i;
+    }
+
+    sched->next = SCHED_NEVER;
+}
+
+void sched_set(Scheduler_t* sched, uint8_t event, uint64_t cycle) {
+    uint8_t i = sched->index[event];
+
+    sched->cycle[event] = cycle;
+
+    // Sift up
+    while (i > 0 && sched_at(sched, (i - 1) / 2) > cycle) {
+        sched_swap(sched, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+
+    // Sift down
+    for (;;) {
+        uint8_t least = i;
+        uint8_t left = 2 * i + 1;
+        uint8_t right = 2 * i + 2;
+
+        if (left < SCHED_EVENTS && sched_at(sched, left) < sched_at(sched, least))
+            least = left;
+        if (right < SCHED_EVENTS && sched_at(sched, right) < sched_at(sched, least))
+            least = right;
+        if (least == i)
+            break;
+
+        sched_swap(sched, i, least);
+        i = least;
+    }
+
+    sched->next = sched_at(sched, 0);
+}
+
+// Takes the earliest event off the schedule and returns its kind
+uint8_t sched_pop(Scheduler_t* sched) {
+    uint8_t event = sched->heap[0];
+
+    sched_set(sched, event, SCHED_NEVER);
+    return event;
+}
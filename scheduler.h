@@ -0,0 +1,32 @@
+#ifndef SCHEDULER_H__
+#define SCHEDULER_H__
+
+#include <stdint.h>
+
+#define SCHED_NEVER UINT64_MAX
+
+// Everything that has to happen at a particular CPU cycle. Each kind has at
+// most one pending entry, setting it again moves it.
+enum SchedEvents {
+    SCHED_APU,    // Frame counter IRQ, DMC fetch or the end of an audio frame
+    SCHED_MAPPER, // Cartridge IRQ, see Mapper_t
+    SCHED_NMI,    // The PPU sets the vblank flag
+    SCHED_DMC,    // The DMC halts the CPU for a sample fetch, see cpu_dmc_fetch()
+    SCHED_EVENTS
+};
+
+// Min-heap of event kinds ordered by the cycle they're due on. `index` is
+// where each kind currently sits in `heap`, so entries can be moved in
+// place. `next` mirrors the top so the CPU checks it with a single compare.
+typedef struct {
+    uint64_t next;
+    uint64_t cycle[SCHED_EVENTS];
+    uint8_t  heap[SCHED_EVENTS];
+    uint8_t  index[SCHED_EVENTS];
+} Scheduler_t;
+
+void sched_init(Scheduler_t* sched);
+void sched_set(Scheduler_t* sched, uint8_t event, uint64_t cycle);
+uint8_t sched_pop(Scheduler_t* sched);
+
+#endif
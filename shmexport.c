@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "shmexport.h"
+
+// "memfd" creates an anonymous region, reachable through /proc/<pid>/fd.
+// Any other name is a POSIX shared memory object under /dev/shm.
+ShmExport_t* shmexport_open(char* name, uint32_t sample_rate) {
+    int fd;
+    bool anonymous = strcmp(name, "memfd") == 0;
+
+    if (anonymous)
+        fd = memfd_create("nts-export", 0);
+    else
+        fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create shared memory %s\n", name);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(ShmRegion_t)) != 0) {
+        fprintf(stderr, "Error: Could not size shared memory %s\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    void* region = mmap(NULL, sizeof(ShmRegion_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map shared memory %s\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    ShmExport_t* shm = (ShmExport_t*) malloc(sizeof(ShmExport_t));
+    shm->region = (ShmRegion_t*) region;
+    shm->fd = fd;
+    shm->name = anonymous ? NULL : name;
+    shm->audio_samples = 0;
+
+    ShmHeader_t* header = &shm->region->header;
+    header->slot_count = SHM_EXPORT_SLOTS;
+    header->slot_size = sizeof(ShmSlot_t);
+    header->frame_width = FRAME_WIDTH;
+    header->frame_height = FRAME_HEIGHT;
+    header->sample_rate = sample_rate;
+    header->latest = 0;
+    memcpy(header->pallette, pallette_xrgb8888, sizeof(header->pallette));
+
+    // Readers check the magic last
+    header->version = SHM_EXPORT_VERSION;
+    __atomic_store_n(&header->magic, SHM_EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+    if (anonymous)
+        printf("Exporting frames to /proc/%d/fd/%d\n", (int) getpid(), fd);
+
+    return shm;
+}
+
+void shmexport_close(ShmExport_t* shm) {
+    munmap(shm->region, sizeof(ShmRegion_t));
+    close(shm->fd);
+
+    if (shm->name != NULL)
+        shm_unlink(shm->name);
+
+    free(shm);
+}
+
+void shmexport_publish(ShmExport_t* shm, uint16_t (*frame)[FRAME_WIDTH], uint64_t frame_number, const uint8_t* ram) {
+    ShmHeader_t* header = &shm->region->header;
+    uint64_t latest = header->latest;
+    ShmSlot_t* slot = &shm->region->slots[latest % SHM_EXPORT_SLOTS];
+    uint32_t sequence = slot->sequence;
+
+    // Odd while the slot is inconsistent
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->frame_number = frame_number;
+    memcpy(slot->frame, frame, sizeof(slot->frame));
+    memcpy(slot->ram, ram, sizeof(slot->ram));
+    memcpy(slot->audio, shm->audio, shm->audio_samples * sizeof(int16_t));
+    slot->audio_samples = shm->audio_samples;
+    shm->audio_samples = 0;
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->latest, latest + 1, __ATOMIC_RELEASE);
+}
+
+void shmexport_push_audio(ShmExport_t* shm, const int16_t* samples, uint32_t count) {
+    uint32_t space = SHM_AUDIO_CHUNK - shm->audio_samples;
+    if (count > space)
+        count = space;
+
+    memcpy(&shm->audio[shm->audio_samples], samples, count * sizeof(int16_t));
+    shm->audio_samples += count;
+}
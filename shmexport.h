@@ -0,0 +1,84 @@
+#ifndef SHMEXPORT_H__
+#define SHMEXPORT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "console.h"
+#include "pallette.h"
+#include "input.h"
+
+#define SHM_EXPORT_MAGIC    0x5853544E // "NTSX"
+#define SHM_EXPORT_VERSION  2
+#define SHM_EXPORT_SLOTS    4
+#define SHM_AUDIO_CHUNK     2048 // Samples per frame, plenty for 48kHz
+
+// Layout of the shared region. Everything a reader needs is in here, so it
+// can be mapped by tools that never link against the emulator.
+//
+// Each slot is guarded by a sequence counter that is odd while the emulator
+// writes the slot. Readers pick the slot of `latest`, read the frame in
+// place, and retry if the sequence changed underneath them.
+typedef struct {
+    uint32_t sequence;
+    uint32_t audio_samples;
+    uint64_t frame_number;
+    uint16_t frame[FRAME_HEIGHT][FRAME_WIDTH]; // 9-bit pallette indices
+    uint8_t  ram[CPU_MEMORY_SIZE];
+    int16_t  audio[SHM_AUDIO_CHUNK];
+} __attribute__((aligned(64))) ShmSlot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t frame_width;
+    uint32_t frame_height;
+    uint32_t sample_rate;
+    uint32_t reserved;
+    uint64_t latest;  // Number of frames published, the newest is latest - 1
+    uint32_t pallette[PALLETTE_ENTRIES]; // XRGB8888 for the frame indices
+} __attribute__((aligned(64))) ShmHeader_t;
+
+// Readers may also push InputEvent_t's into `input` with input_push(), one
+// writer at a time. They're picked up the next time the game reads the pads.
+typedef struct {
+    ShmHeader_t  header;
+    ShmSlot_t    slots[SHM_EXPORT_SLOTS];
+    InputQueue_t input;
+} ShmRegion_t;
+
+struct ShmExport_t {
+    ShmRegion_t* region;
+    int      fd;
+    char*    name;
+
+    // Audio gathered over the frame being emulated
+    int16_t  audio[SHM_AUDIO_CHUNK];
+    uint32_t audio_samples;
+};
+
+ShmExport_t* shmexport_open(char* name, uint32_t sample_rate);
+void shmexport_close(ShmExport_t* shm);
+void shmexport_publish(ShmExport_t* shm, uint16_t (*frame)[FRAME_WIDTH], uint64_t frame_number, const uint8_t* ram);
+void shmexport_push_audio(ShmExport_t* shm, const int16_t* samples, uint32_t count);
+
+// Reader side, for consumers mapping the region
+static inline const ShmSlot_t* shmexport_read_begin(const ShmRegion_t* region, uint32_t* sequence) {
+    uint64_t latest = __atomic_load_n(&region->header.latest, __ATOMIC_ACQUIRE);
+    if (latest == 0)
+        return NULL;
+
+    const ShmSlot_t* slot = &region->slots[(latest - 1) % SHM_EXPORT_SLOTS];
+    *sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+    return (*sequence & 1) ? NULL : slot;
+}
+
+// True if the slot was not rewritten while it was being read
+static inline bool shmexport_read_valid(const ShmSlot_t* slot, uint32_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+#endif
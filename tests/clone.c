@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../console.h"
+#include "../cpu.h"
+#include "../ppu.h"
+#include "../rom.h"
+
+// Changes a clone of a UxROM console with CHR RAM in every way a game can,
+// and checks none of it leaks back into the original
+
+#define BANK_TAG 0x3FF0 // Same as tests/mkroms.c
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL clone: %s\n", what);
+        failures++;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Syntax: clone uxrom.nes\n");
+        return 1;
+    }
+
+    ROM_t* rom = rom_from_file(argv[1]);
+    if (rom == NULL)
+        return 1;
+
+    Console_t* console = console_init(rom);
+    Console_t* clone = console_clone(console);
+    CPU_t* cpu = &clone->cpu;
+    PPU_t* ppu = &clone->ppu;
+
+    // Nobody is running the PPU, so don't wait for it
+    console->cpu.headless = true;
+    cpu->headless = true;
+
+    cpu_map_write(cpu, 0x8000, 2);
+    cpu_map_write(cpu, 0x6000, 0x77);
+    ppu_memory_map_write(ppu, 0x2000, 0x55);
+    ppu_memory_map_write(ppu, 0x0010, 0xAA);
+
+    check(*cpu_map_read(cpu, 0x8000 + BANK_TAG) == 2, "clone didn't switch banks");
+    check(*cpu_map_read(cpu, 0x6000) == 0x77, "clone lost its PRG RAM write");
+    check(*ppu_vram_ptr(ppu, 0x2000) == 0x55, "clone lost its nametable write");
+    check(*ppu_vram_ptr(ppu, 0x0010) == 0xAA, "clone lost its CHR RAM write");
+
+    cpu = &console->cpu;
+    ppu = &console->ppu;
+
+    check(*cpu_map_read(cpu, 0x8000 + BANK_TAG) == 0, "bank switch leaked into the original");
+    check(*cpu_map_read(cpu, 0x6000) == 0, "PRG RAM write leaked into the original");
+    check(*ppu_vram_ptr(ppu, 0x2000) == 0, "nametable write leaked into the original");
+    check(*ppu_vram_ptr(ppu, 0x0010) == 0, "CHR RAM write leaked into the original");
+    check(rom->cpu == cpu, "the original cartridge was plugged into the clone");
+
+    console_free(clone);
+    console_free(console);
+    rom_free(rom);
+
+    if (failures == 0)
+        printf("ok   clone\n");
+
+    return failures > 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+// Writes the little test images used by tests/run.sh. Each one is a few lines
+// of hand assembled 6502 at $8000, with the NMI handler at $8100. Every 16KiB
+// PRG bank holds its own number at BANK_TAG, so tests can tell them apart.
+
+#define PRG_SIZE 0x8000
+#define CHR_SIZE 0x2000
+#define BANK_TAG 0x3FF0 // Offset into each 16KiB bank of its number
+
+typedef struct {
+    const char*    name;
+    uint8_t        mapper;
+    uint8_t        prg_banks; // 16KiB each, the code goes in the last one
+    uint8_t        chr_banks; // 8KiB each, 0 for CHR RAM
+    const uint8_t* reset;
+    size_t         reset_size;
+    const uint8_t* nmi;
+    size_t         nmi_size;
+} TestRom_t;
+
+// Turns NMIs on and pokes PPUDATA once a frame
+static const uint8_t VRAM_WRITE[] = {
+    0x78,             // SEI
+    0xA9, 0x80,       // LDA #$80
+    0x8D, 0x00, 0x20, // STA $2000
+    0x4C, 0x06, 0x80  // loop: JMP loop
+};
+
+static const uint8_t VRAM_WRITE_NMI[] = {
+    0xA9, 0x20,       // LDA #$20
+    0x8D, 0x06, 0x20, // STA $2006
+    0xA9, 0x00,       // LDA #$00
+    0x8D, 0x06, 0x20, // STA $2006
+    0x8E, 0x07, 0x20, // STX $2007
+    0xAD, 0x07, 0x20, // LDA $2007
+    0xE8,             // INX
+    0x40              // RTI
+};
+
+// Banks switched, but otherwise just waits on NMIs forever
+static const uint8_t IDLE[] = {
+    0x78,             // SEI
+    0xA9, 0x80,       // LDA #$80
+    0x8D, 0x00, 0x20, // STA $2000
+    0x4C, 0x06, 0x80  // loop: JMP loop
+};
+
+static const uint8_t IDLE_NMI[] = {
+    0x40              // RTI
+};
+
+// Waits on RAM for an NMI that never changes it, the way nearly every game
+// waits for vblank. The loop gets fused and skipped ahead a frame at a time.
+static const uint8_t NMI_WAIT[] = {
+    0x78,             // SEI
+    0xA9, 0x80,       // LDA #$80
+    0x8D, 0x00, 0x20, // STA $2000
+    0xA5, 0x10,       // loop: LDA $10
+    0xF0, 0xFC,       // BEQ loop
+    0x4C, 0x06, 0x80  // JMP loop
+};
+
+static const uint8_t NMI_WAIT_NMI[] = {
+    0xE6, 0x11,       // INC $11
+    0x40              // RTI
+};
+
+static const TestRom_t ROMS[] = {
+    {"vram_write", 0, 2, 1, VRAM_WRITE, sizeof(VRAM_WRITE), VRAM_WRITE_NMI, sizeof(VRAM_WRITE_NMI)},
+    {"nmi_wait",   0, 2, 1, NMI_WAIT, sizeof(NMI_WAIT), NMI_WAIT_NMI, sizeof(NMI_WAIT_NMI)},
+    {"uxrom",      2, 4, 0, IDLE, sizeof(IDLE), IDLE_NMI, sizeof(IDLE_NMI)},
+    {"mmc3",       4, 2, 1, IDLE, sizeof(IDLE), IDLE_NMI, sizeof(IDLE_NMI)},
+};
+
+static int mkrom(const char* dir, const TestRom_t* rom) {
+    static uint8_t prg[0x100 * 0x4000];
+    static const uint8_t chr[CHR_SIZE];
+    const uint8_t header[16] = {'N', 'E', 'S', 0x1A, rom->prg_banks, rom->chr_banks, (rom->mapper & 0x0F) << 4, rom->mapper & 0xF0};
+    size_t prg_size = rom->prg_banks * 0x4000;
+    char path[256];
+
+    memset(prg, 0xEA, prg_size); // NOP
+    for (uint8_t bank = 0; bank < rom->prg_banks; ++bank)
+        prg[bank * 0x4000 + BANK_TAG] = bank;
+
+    // The last 32KiB is what's mapped in at power on, for NROM and UxROM
+    uint8_t* code = prg + prg_size - PRG_SIZE;
+    memcpy(code, rom->reset, rom->reset_size);
+    memcpy(code + 0x100, rom->nmi, rom->nmi_size);
+
+    // NMI, reset and IRQ vectors
+    const uint8_t vectors[6] = {0x00, 0x81, 0x00, 0x80, 0x00, 0x81};
+    memcpy(prg + prg_size - 6, vectors, sizeof(vectors));
+
+    snprintf(path, sizeof(path), "%s/%s.nes", dir, rom->name);
+    FILE* file = fopen(path, "wb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not create %s\n", path);
+        return 1;
+    }
+
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(prg, 1, prg_size, file);
+    fwrite(chr, 1, rom->chr_banks * sizeof(chr), file);
+    fclose(file);
+
+    printf("%s\n", rom->name);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* dir = argc > 1 ? argv[1] : ".";
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(ROMS) / sizeof(ROMS[0]); ++i)
+        failed |= mkrom(dir, &ROMS[i]);
+
+    return failed;
+}
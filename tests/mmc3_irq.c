@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../console.h"
+#include "../cpu.h"
+#include "../ppu.h"
+#include "../rom.h"
+
+// Puts the background and sprites on the same pattern table, which the MMC3
+// can't predict the IRQ for, and checks the counter still gets clocked
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL mmc3_irq: %s\n", what);
+        failures++;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Syntax: mmc3_irq mmc3.nes\n");
+        return 1;
+    }
+
+    ROM_t* rom = rom_from_file(argv[1]);
+    if (rom == NULL)
+        return 1;
+
+    Console_t* console = console_init(rom);
+    CPU_t* cpu = &console->cpu;
+    PPU_t* ppu = &console->ppu;
+
+    // The PPU is stepped by hand, so neither side waits for the other
+    cpu->headless = true;
+    ppu->cycle_budget = UINT32_MAX;
+
+    cpu_map_write(cpu, 0x2000, 0x18); // Both on $1000, 8x8 sprites
+    cpu_map_write(cpu, 0x2001, 0x18);
+    cpu_map_write(cpu, 0xC000, 0);    // IRQ on every clock
+    cpu_map_write(cpu, 0xC001, 0);
+    cpu_map_write(cpu, 0xE001, 0);
+
+    check(ppu->a12_watch, "A12 isn't being watched");
+
+    for (int line = 0; line < 2 * (NUM_SCANELINES); ++line)
+        ppu_render_scanline(ppu);
+
+    check(rom->state.mmc3.irq_pending, "the IRQ never fired");
+    check(cpu->irq_sources & IRQ_MAPPER, "the IRQ line was never pulled");
+
+    console_free(console);
+    rom_free(rom);
+
+    if (failures == 0)
+        printf("ok   mmc3_irq\n");
+
+    return failures > 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Runs every generated test ROM for a few seconds, unthrottled, and fails if
+# any of them doesn't get through a reasonable number of frames. Then builds
+# and runs the unit tests in here.
+
+NTS=${NTS:-./nts}
+CC=${CC:-cc}
+FLAGS=${FLAGS:---std=c99 -D_GNU_SOURCE -O2 -pthread}
+LIBS=${LIBS:--lrt -lm}
+SECONDS_EACH=${SECONDS_EACH:-3}
+MIN_FRAMES=${MIN_FRAMES:-120}
+FRAME_SIZE=$((6 + 256 * 240 * 3)) # Y4M FRAME line and a 4:4:4 frame
+DIR=$(mktemp -d)
+status=0
+
+trap 'rm -rf "$DIR"' EXIT
+
+$CC -o "$DIR/mkroms" tests/mkroms.c || exit 1
+
+for rom in $("$DIR/mkroms" "$DIR"); do
+    timeout -s INT "$SECONDS_EACH" "$NTS" -r off -c "$DIR/$rom.y4m" "$DIR/$rom.nes" > /dev/null 2>&1
+    size=$(wc -c < "$DIR/$rom.y4m")
+    frames=$(( (size - 50) / FRAME_SIZE ))
+
+    if [ "$frames" -lt "$MIN_FRAMES" ]; then
+        echo "FAIL $rom: $frames frames"
+        status=1
+    else
+        echo "ok   $rom: $frames frames"
+    fi
+done
+
+# Unit tests, linked against everything but main.c, each with the ROM it
+# pokes at
+for test in clone:uxrom mmc3_irq:mmc3; do
+    name=${test%%:*}
+    $CC $FLAGS -o "$DIR/$name" tests/$name.c $(ls ./*.c | grep -v main.c) $LIBS || exit 1
+    "$DIR/$name" "$DIR/${test#*:}.nes" || status=1
+done
+
+exit $status
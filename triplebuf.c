@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "triplebuf.h"
+
+TripleBuffer_t* triplebuf_init(uint8_t max_consumers) {
+    if (max_consumers == 0 || max_consumers > TRIPLEBUF_MAX_CONSUMERS)
+        return NULL;
+
+    TripleBuffer_t* tb = (TripleBuffer_t*) malloc(sizeof(TripleBuffer_t));
+    if (tb == NULL)
+        return NULL;
+
+    // One buffer per consumer, plus the back buffer and the latest frame
+    tb->buffer_count = max_consumers + 2;
+    tb->consumer_count = 0;
+    tb->frames = (Frame_t*) calloc(tb->buffer_count, sizeof(Frame_t));
+    tb->frame_numbers = (uint64_t*) calloc(tb->buffer_count, sizeof(uint64_t));
+
+    if (tb->frames == NULL || tb->frame_numbers == NULL) {
+        triplebuf_free(tb);
+        return NULL;
+    }
+
+    tb->back = 0;
+    tb->latest = 1;
+    memset(tb->held, TRIPLEBUF_NONE, sizeof(tb->held));
+
+    return tb;
+}
+
+void triplebuf_free(TripleBuffer_t* tb) {
+    free(tb->frames);
+    free(tb->frame_numbers);
+    free(tb);
+}
+
+// Producer side
+uint16_t (*triplebuf_back(TripleBuffer_t* tb))[FRAME_WIDTH] {
+    return tb->frames[tb->back];
+}
+
+void triplebuf_publish(TripleBuffer_t* tb, uint64_t frame_number) {
+    tb->frame_numbers[tb->back] = frame_number;
+    __atomic_store_n(&tb->latest, tb->back, __ATOMIC_SEQ_CST);
+
+    // Pick any buffer that is neither the one just published nor pinned by a
+    // reader. There is always one, since there are two more buffers than
+    // consumers.
+    for (uint8_t i = 0; i < tb->buffer_count; ++i) {
+        bool in_use = i == tb->back;
+
+        for (uint8_t c = 0; c < TRIPLEBUF_MAX_CONSUMERS && !in_use; ++c)
+            in_use = __atomic_load_n(&tb->held[c], __ATOMIC_SEQ_CST) == i;
+
+        if (!in_use) {
+            tb->back = i;
+            return;
+        }
+    }
+}
+
+// Consumer side
+int triplebuf_register(TripleBuffer_t* tb) {
+    if (tb->consumer_count + 2 >= tb->buffer_count)
+        return -1;
+
+    return tb->consumer_count++;
+}
+
+// Pins the newest complete frame until triplebuf_release is called. The
+// returned frame is read in place.
+const uint16_t (*triplebuf_acquire(TripleBuffer_t* tb, int consumer, uint64_t* frame_number))[FRAME_WIDTH] {
+    uint8_t latest;
+
+    // Announce the buffer before using it, then make sure it was still the
+    // newest one at that point. Once that holds, the producer's scan of the
+    // held slots after its next publish is guaranteed to see the pin.
+    do {
+        latest = __atomic_load_n(&tb->latest, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&tb->held[consumer], latest, __ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&tb->latest, __ATOMIC_SEQ_CST) != latest);
+
+    if (frame_number != NULL)
+        *frame_number = tb->frame_numbers[latest];
+
+    return (const uint16_t (*)[FRAME_WIDTH]) tb->frames[latest];
+}
+
+void triplebuf_release(TripleBuffer_t* tb, int consumer) {
+    __atomic_store_n(&tb->held[consumer], TRIPLEBUF_NONE, __ATOMIC_RELEASE);
+}
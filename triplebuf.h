@@ -0,0 +1,46 @@
+#ifndef TRIPLEBUF_H__
+#define TRIPLEBUF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "console.h"
+
+// Display, encoder and streamer
+#define TRIPLEBUF_MAX_CONSUMERS 3
+#define TRIPLEBUF_NONE          0xFF
+
+typedef uint16_t Frame_t[FRAME_HEIGHT][FRAME_WIDTH];
+
+// Lock-free handoff of completed frames from the emulation thread to any
+// number of reader threads. The producer always owns one back buffer, one
+// buffer holds the newest published frame, and each consumer may pin one
+// buffer while it reads it. With one consumer this is a plain triple buffer;
+// every extra consumer costs one more buffer. Nobody ever waits and no frame
+// is ever copied.
+struct TripleBuffer_t {
+    Frame_t* frames;
+    uint64_t* frame_numbers;
+    uint8_t  buffer_count;
+    uint8_t  consumer_count;
+
+    // Owned by the producer
+    uint8_t  back;
+
+    // Shared, only accessed atomically
+    uint8_t  latest;
+    uint8_t  held[TRIPLEBUF_MAX_CONSUMERS];
+};
+
+TripleBuffer_t* triplebuf_init(uint8_t max_consumers);
+void triplebuf_free(TripleBuffer_t* tb);
+
+// Producer side
+uint16_t (*triplebuf_back(TripleBuffer_t* tb))[FRAME_WIDTH];
+void triplebuf_publish(TripleBuffer_t* tb, uint64_t frame_number);
+
+// Consumer side
+int triplebuf_register(TripleBuffer_t* tb);
+const uint16_t (*triplebuf_acquire(TripleBuffer_t* tb, int consumer, uint64_t* frame_number))[FRAME_WIDTH];
+void triplebuf_release(TripleBuffer_t* tb, int consumer);
+
+#endif
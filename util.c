@@ -3,16 +3,11 @@
 #include <stdio.h>
 #include "util.h"
 
-inline uint8_t set_bit(uint8_t byte, uint8_t n, bool value) {
-    uint8_t mask = 1 << n;
-    if (value)
-        return byte | mask;
-    else
-        return byte & (~mask);
-}
-
-inline bool get_bit(uint8_t byte, uint8_t n) {
-    return (byte << (7 - n)) >> 7;
+uint8_t reverse_bits(uint8_t byte) {
+    byte = (byte & 0xF0) >> 4 | (byte & 0x0F) << 4;
+    byte = (byte & 0xCC) >> 2 | (byte & 0x33) << 2;
+    byte = (byte & 0xAA) >> 1 | (byte & 0x55) << 1;
+    return byte;
 }
 
 void print_data(uint8_t* start, uint16_t num_bytes) {
@@ -4,8 +4,19 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-inline uint8_t set_bit(uint8_t byte, uint8_t n, bool value);
-inline bool get_bit(uint8_t byte, uint8_t n);
+static inline uint8_t set_bit(uint8_t byte, uint8_t n, bool value) {
+    uint8_t mask = 1 << n;
+    if (value)
+        return byte | mask;
+    else
+        return byte & (~mask);
+}
+
+static inline bool get_bit(uint8_t byte, uint8_t n) {
+    return (byte >> n) & 1;
+}
+
+uint8_t reverse_bits(uint8_t byte);
 void print_data(uint8_t* start, uint16_t num_bytes);
 
 #endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "wav.h"
+
+#define WAV_HEADER_SIZE 44
+
+static void wav_put_u16(uint8_t* out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void wav_put_u32(uint8_t* out, uint32_t value) {
+    wav_put_u16(out, value);
+    wav_put_u16(out + 2, value >> 16);
+}
+
+static void wav_write_header(WavWriter_t* wav, uint32_t data_bytes) {
+    uint8_t header[WAV_HEADER_SIZE] = {
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0,
+        'd', 'a', 't', 'a', 0, 0, 0, 0
+    };
+    uint16_t block_align = wav->channels * sizeof(int16_t);
+
+    wav_put_u32(&header[4], data_bytes + WAV_HEADER_SIZE - 8);
+    wav_put_u16(&header[22], wav->channels);
+    wav_put_u32(&header[24], wav->sample_rate);
+    wav_put_u32(&header[28], wav->sample_rate * block_align);
+    wav_put_u16(&header[32], block_align);
+    wav_put_u32(&header[40], data_bytes);
+
+    fwrite(header, WAV_HEADER_SIZE, 1, wav->file);
+}
+
+// `path` may also be "-" for stdout or "|command" to feed an encoder
+WavWriter_t* wav_open(char* path, uint32_t sample_rate, uint16_t channels) {
+    bool pipe = path[0] == '|';
+    FILE* file;
+
+    if (strcmp(path, "-") == 0) {
+        file = stdout;
+    } else if (pipe) {
+        // A dead encoder should surface as a write error
+        signal(SIGPIPE, SIG_IGN);
+        file = popen(path + 1, "w");
+    } else {
+        file = fopen(path, "wb");
+    }
+
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open %s for writing\n", path);
+        return NULL;
+    }
+
+    WavWriter_t* wav = wav_from_file(file, sample_rate, channels);
+    wav->pipe = pipe;
+    return wav;
+}
+
+WavWriter_t* wav_from_file(FILE* file, uint32_t sample_rate, uint16_t channels) {
+    WavWriter_t* wav = (WavWriter_t*) malloc(sizeof(WavWriter_t));
+
+    wav->file = file;
+    wav->sample_rate = sample_rate;
+    wav->channels = channels;
+    wav->data_bytes = 0;
+    wav->seekable = fseek(file, 0, SEEK_CUR) == 0;
+    wav->pipe = false;
+
+    // Pipes never get their sizes patched in, so claim the maximum length
+    // the way streaming encoders expect
+    wav_write_header(wav, wav->seekable ? 0 : 0xFFFFFFFF - WAV_HEADER_SIZE);
+
+    return wav;
+}
+
+bool wav_write(WavWriter_t* wav, const int16_t* samples, uint32_t count) {
+    // Samples are stored little endian
+    uint8_t buffer[1024 * sizeof(int16_t)];
+
+    while (count > 0) {
+        uint32_t chunk = count < 1024 ? count : 1024;
+
+        for (uint32_t i = 0; i < chunk; ++i)
+            wav_put_u16(&buffer[i * 2], (uint16_t) samples[i]);
+
+        if (fwrite(buffer, sizeof(int16_t), chunk, wav->file) != chunk)
+            return false;
+
+        wav->data_bytes += chunk * sizeof(int16_t);
+        samples += chunk;
+        count -= chunk;
+    }
+
+    return true;
+}
+
+void wav_close(WavWriter_t* wav) {
+    if (wav->seekable) {
+        rewind(wav->file);
+        wav_write_header(wav, wav->data_bytes);
+    }
+
+    if (wav->pipe)
+        pclose(wav->file);
+    else if (wav->file != stdout)
+        fclose(wav->file);
+    else
+        fflush(stdout);
+
+    free(wav);
+}
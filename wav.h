@@ -0,0 +1,23 @@
+#ifndef WAV_H__
+#define WAV_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// 16-bit PCM .wav output
+typedef struct {
+    FILE*    file;
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint32_t data_bytes;
+    bool     seekable;
+    bool     pipe;
+} WavWriter_t;
+
+WavWriter_t* wav_open(char* path, uint32_t sample_rate, uint16_t channels);
+WavWriter_t* wav_from_file(FILE* file, uint32_t sample_rate, uint16_t channels);
+bool wav_write(WavWriter_t* wav, const int16_t* samples, uint32_t count);
+void wav_close(WavWriter_t* wav);
+
+#endif